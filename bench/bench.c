@@ -0,0 +1,86 @@
+/*
+ * Benchmark host for lua-fenster. Links src/main.c directly against an
+ * embedded Lua, so the benchmarks measure the binding as it is in the source
+ * tree, without having to install it with LuaRocks first.
+ *
+ * Usage: bench/bench [script] [arguments...]
+ * The script defaults to bench/run.lua, all other arguments are passed to the
+ * script in the global arg table, just like the lua interpreter does.
+ */
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/main.h"
+
+/** Script that runs the benchmarks if none is given */
+static const char *DEFAULT_SCRIPT = "bench/run.lua";
+
+/**
+ * Message handler for lua_pcall that adds a traceback to the error message.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int traceback(lua_State *L) {
+  const char *message = lua_tostring(L, 1);
+  if (message == NULL) {
+    message = "(error object is not a string)";
+  }
+  lua_getglobal(L, "debug");
+  lua_getfield(L, -1, "traceback");
+  lua_pushstring(L, message);
+  lua_pushinteger(L, 2);
+  lua_call(L, 2, 1);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  // a script argument is anything ending in .lua, the rest is for the script
+  int first_arg = 1;
+  const char *script = DEFAULT_SCRIPT;
+  if (argc > 1) {
+    const size_t length = strlen(argv[1]);
+    if (length > 4 && strcmp(argv[1] + length - 4, ".lua") == 0) {
+      script = argv[1];
+      first_arg = 2;
+    }
+  }
+
+  lua_State *L = luaL_newstate();
+  if (L == NULL) {
+    fprintf(stderr, "bench: failed to create Lua state\n");
+    return 1;
+  }
+  luaL_openlibs(L);
+
+  // make require('fenster') return the linked module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, luaopen_fenster);
+  lua_setfield(L, -2, "fenster");
+  lua_pop(L, 2);
+
+  // fill the global arg table like the lua interpreter
+  lua_createtable(L, argc - first_arg, 1);
+  lua_pushstring(L, script);
+  lua_rawseti(L, -2, 0);
+  for (int i = first_arg; i < argc; i++) {
+    lua_pushstring(L, argv[i]);
+    lua_rawseti(L, -2, i - first_arg + 1);
+  }
+  lua_setglobal(L, "arg");
+
+  lua_pushcfunction(L, traceback);
+  int status = luaL_loadfile(L, script);
+  if (status == 0) {
+    status = lua_pcall(L, 0, 0, -2);
+  }
+  if (status != 0) {
+    fprintf(stderr, "bench: %s\n", lua_tostring(L, -1));
+  }
+  lua_close(L);
+  return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,455 @@
+-- Benchmarks for the hot paths of lua-fenster.
+--
+-- Usage: lua bench/run.lua [options]
+--    or: bench/bench [options] (see bench/bench.c)
+--
+-- Options:
+--   --display            Open real windows instead of headless ones (e.g. under xvfb-run)
+--   --time <ms>          Minimum time each benchmark runs for (default: 500)
+--   --filter <pattern>   Only run benchmarks whose name matches the Lua pattern
+--   --output <path>      Write the JSON results to a file instead of stdout
+--   --baseline <path>    Compare against saved JSON results and fail on regressions
+--   --threshold <pct>    Allowed slowdown against the baseline in percent (default: 10)
+
+local fenster = require('fenster')
+
+-- Hack to get the current script directory
+local dirname = './' .. (debug.getinfo(1, 'S').source:match('^@?(.*[/\\])') or '') ---@type string
+
+local atan2 = math.atan2 or math.atan
+
+---Parses the command line arguments
+---@return table
+local function parse_args()
+	local options = {
+		display = false,
+		time = 500,
+		filter = nil,
+		output = nil,
+		baseline = nil,
+		threshold = 10,
+	}
+	local i = 1
+	while arg[i] do
+		local name = arg[i]
+		if name == '--display' then
+			options.display = true
+		elseif name == '--time' or name == '--threshold' then
+			options[name:sub(3)] = assert(tonumber(arg[i + 1]), name .. ' requires a number')
+			i = i + 1
+		elseif name == '--filter' or name == '--output' or name == '--baseline' then
+			options[name:sub(3)] = assert(arg[i + 1], name .. ' requires a value')
+			i = i + 1
+		else
+			error('unknown option: ' .. name)
+		end
+		i = i + 1
+	end
+	return options
+end
+
+local options = parse_args()
+
+---Opens a window for a benchmark, headless unless --display was given
+---@param width integer
+---@param height integer
+---@param scale integer|nil
+---@return userdata
+local function open(width, height, scale)
+	return fenster.open(width, height, 'fenster benchmark', scale or 1, 0, { headless = not options.display })
+end
+
+---Runs the given function with a growing number of operations until it took
+---at least the configured time and returns the nanoseconds per operation
+---@param run fun(n: integer)
+---@return number
+local function measure(run)
+	run(1) -- warm up
+	local n = 1
+	while true do
+		local start = fenster.timens()
+		run(n)
+		local elapsed = fenster.timens() - start
+		if elapsed >= options.time * 1000000 then
+			return elapsed / n
+		end
+		-- aim a bit above the configured time to not stop just below it
+		local factor = elapsed > 0 and (options.time * 1000000 * 1.2) / elapsed or 10
+		n = math.max(n + 1, math.floor(n * math.min(factor, 10)))
+	end
+end
+
+-- Microbenchmarks of single methods ---------------------------------------
+
+local micro = {
+	{
+		name = 'window:set',
+		pixels = 1,
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for i = 1, n do
+				window:set(i % 256, i % 144, i % 0x1000000)
+			end
+		end,
+	},
+	{
+		name = 'window:get',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for i = 1, n do
+				window:get(i % 256, i % 144)
+			end
+		end,
+	},
+	{
+		name = 'window:clear',
+		pixels = 256 * 144,
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for i = 1, n do
+				window:clear(i % 0x1000000)
+			end
+		end,
+	},
+	{
+		name = 'window:loop (idle)',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for _ = 1, n do
+				window:loop()
+			end
+		end,
+	},
+	{
+		name = 'window:loop (full damage, scale 4)',
+		pixels = 256 * 144,
+		setup = function() return open(256, 144, 4) end,
+		run = function(window, n)
+			for i = 1, n do
+				window:clear(i % 0x1000000)
+				window:loop()
+			end
+		end,
+	},
+	{
+		name = 'window.width',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for _ = 1, n do
+				local _ = window.width
+			end
+		end,
+	},
+	{
+		name = 'window.keys',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for _ = 1, n do
+				local _ = window.keys[27]
+			end
+		end,
+	},
+	{
+		name = 'window.indexed',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for _ = 1, n do
+				local _ = window.indexed
+			end
+		end,
+	},
+	{
+		name = 'window input (properties)',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for _ = 1, n do
+				local _, _, _ = window.mousex, window.mousey, window.mousedown
+				local _, _, _, _ = window.modcontrol, window.modshift, window.modalt, window.modgui
+			end
+		end,
+	},
+	{
+		name = 'window input (mouse, mods)',
+		setup = function() return open(256, 144) end,
+		run = function(window, n)
+			for _ = 1, n do
+				local _, _, _ = window:mouse()
+				local _, _, _, _ = window:mods()
+			end
+		end,
+	},
+}
+
+-- Scenarios modelled on the demos -----------------------------------------
+
+---Returns the bitwise XOR of two non-negative integers
+---@param a integer
+---@param b integer
+---@return integer
+local function xor(a, b)
+	local result = 0
+	local bitval = 1
+	while a > 0 or b > 0 do
+		if a % 2 ~= b % 2 then
+			result = result + bitval
+		end
+		bitval = bitval * 2
+		a = math.floor(a / 2)
+		b = math.floor(b / 2)
+	end
+	return result
+end
+
+local scenarios = {
+	{
+		name = 'plasma',
+		width = 256,
+		height = 144,
+		scale = 4,
+		setup = function(window)
+			local time = 0
+			return function()
+				local py = 0
+				for y = 0, 143 do
+					local px = 0
+					for x = 0, 255 do
+						local k = 0.1 + math.cos(py + math.sin(0.148 - time)) + 2.4 * time
+						local w = 0.9 + math.cos(px + math.cos(0.628 + time)) - 0.7 * time
+						local d = math.sqrt(px * px + py * py)
+						local s = 7.0 * math.cos(d + w) * math.sin(k + w)
+						local r = math.floor((0.5 + 0.5 * math.cos(s + 0.2)) * 255)
+						local g = math.floor((0.5 + 0.5 * math.cos(s + 0.5)) * 255)
+						local b = math.floor((0.5 + 0.5 * math.cos(s + 0.7)) * 255)
+						window:set(x, y, fenster.rgb(r, g, b))
+						px = px + 1 / 256
+					end
+					py = py + 1 / 144
+				end
+				time = time + 0.5 / 60
+			end
+		end,
+	},
+	{
+		name = 'tunnel',
+		width = 256,
+		height = 144,
+		scale = 4,
+		setup = function(window)
+			local texture = {}
+			for y = 0, 255 do
+				texture[y] = {}
+				for x = 0, 255 do
+					texture[y][x] = xor(x, y)
+				end
+			end
+			local distance_table = {}
+			local angle_table = {}
+			for y = 0, 287 do
+				distance_table[y] = {}
+				angle_table[y] = {}
+				for x = 0, 511 do
+					local distance = math.floor(32 * 256 / math.sqrt((x - 256) ^ 2 + (y - 144) ^ 2)) % 256
+					if distance ~= distance then distance = 0 end
+					distance_table[y][x] = distance
+					local angle = math.floor(0.5 * 256 * atan2(y - 144, x - 256) / math.pi)
+					if angle ~= angle then angle = 0 end
+					angle_table[y][x] = angle
+				end
+			end
+			local time = 0
+			return function()
+				local shift_x = math.floor(256 * time)
+				local shift_y = math.floor(256 * 0.25 * time)
+				local look_x = 128 + math.floor(128 * math.sin(time))
+				local look_y = 72 + math.floor(72 * math.sin(time * 2))
+				for y = 0, 143 do
+					local distances = distance_table[y + look_y]
+					local angles = angle_table[y + look_y]
+					for x = 0, 255 do
+						local texture_x = (distances[x + look_x] + shift_x) % 256
+						local texture_y = (angles[x + look_x] + shift_y) % 256
+						window:set(x, y, texture[texture_y][texture_x])
+					end
+				end
+				time = time + 0.5 / 60
+			end
+		end,
+	},
+	{
+		name = 'image',
+		width = 512,
+		height = 512,
+		scale = 1,
+		setup = function(window)
+			local image = assert(fenster.loadimage(dirname .. '../demos/assets/uv.ppm'))
+			local offset = 0
+			return function()
+				image:blit(window, offset % 64 - 32, 0)
+				offset = offset + 1
+			end
+		end,
+	},
+	{
+		name = 'game-of-life',
+		width = 200,
+		height = 200,
+		scale = 4,
+		setup = function(window)
+			local width, height = 200, 200
+			local world, next_world = {}, {}
+			for x = 1, width do
+				world[x], next_world[x] = {}, {}
+				for y = 1, height do
+					world[x][y] = (x * 7 + y * 13) % 5 == 0
+				end
+			end
+			return function()
+				for x = 1, width do
+					local left, column, right = world[x - 1], world[x], world[x + 1]
+					for y = 1, height do
+						local count = 0
+						if left then
+							if left[y - 1] then count = count + 1 end
+							if left[y] then count = count + 1 end
+							if left[y + 1] then count = count + 1 end
+						end
+						if column[y - 1] then count = count + 1 end
+						if column[y + 1] then count = count + 1 end
+						if right then
+							if right[y - 1] then count = count + 1 end
+							if right[y] then count = count + 1 end
+							if right[y + 1] then count = count + 1 end
+						end
+						local alive = column[y]
+						window:set(x - 1, y - 1, alive and 0xffffff or 0x000000)
+						next_world[x][y] = count == 3 or (alive and count == 2)
+					end
+				end
+				world, next_world = next_world, world
+			end
+		end,
+	},
+}
+
+-- Running ------------------------------------------------------------------
+
+---@param name string
+---@return boolean
+local function selected(name)
+	return options.filter == nil or name:find(options.filter) ~= nil
+end
+
+local results = {}
+
+for _, benchmark in ipairs(micro) do
+	if selected(benchmark.name) then
+		local window = benchmark.setup()
+		local ns_per_op = measure(function(n) benchmark.run(window, n) end)
+		window:close()
+		results[#results + 1] = {
+			name = benchmark.name,
+			ns_per_op = ns_per_op,
+			ops_per_sec = 1e9 / ns_per_op,
+			pixels_per_sec = benchmark.pixels and benchmark.pixels * 1e9 / ns_per_op or nil,
+		}
+	end
+end
+
+for _, scenario in ipairs(scenarios) do
+	if selected(scenario.name) then
+		local window = open(scenario.width, scenario.height, scenario.scale)
+		local frame = scenario.setup(window)
+		local ns_per_op = measure(function(n)
+			for _ = 1, n do
+				frame()
+				window:loop()
+			end
+		end)
+		window:close()
+		results[#results + 1] = {
+			name = scenario.name,
+			ns_per_op = ns_per_op,
+			frames_per_sec = 1e9 / ns_per_op,
+			pixels_per_sec = scenario.width * scenario.height * 1e9 / ns_per_op,
+		}
+	end
+end
+
+-- JSON output ----------------------------------------------------------------
+
+local FIELDS = { 'name', 'ns_per_op', 'ops_per_sec', 'frames_per_sec', 'pixels_per_sec' }
+
+---@param value string|number
+---@return string
+local function encode(value)
+	if type(value) == 'number' then
+		return string.format('%.3f', value)
+	end
+	return '"' .. value:gsub('[%c"\\]', function(c)
+		return string.format('\\u%04x', c:byte())
+	end) .. '"'
+end
+
+local lines = {}
+for i, result in ipairs(results) do
+	local fields = {}
+	for _, field in ipairs(FIELDS) do
+		if result[field] ~= nil then
+			fields[#fields + 1] = encode(field) .. ': ' .. encode(result[field])
+		end
+	end
+	lines[i] = '    { ' .. table.concat(fields, ', ') .. ' }'
+end
+local json = '{\n' ..
+	'  "version": 1,\n' ..
+	'  "lua": ' .. encode(_VERSION) .. ',\n' ..
+	'  "display": ' .. tostring(options.display) .. ',\n' ..
+	'  "results": [\n' .. table.concat(lines, ',\n') .. '\n  ]\n' ..
+	'}\n'
+
+if options.output then
+	local file = assert(io.open(options.output, 'w'))
+	file:write(json)
+	file:close()
+else
+	io.write(json)
+end
+
+-- Baseline comparison ----------------------------------------------------------
+
+if options.baseline then
+	local file = assert(io.open(options.baseline, 'r'))
+	local baseline_json = file:read('*a')
+	file:close()
+
+	-- the results are written one per line, so a full JSON parser is not needed
+	local baseline = {}
+	for line in baseline_json:gmatch('[^\n]+') do
+		local name = line:match('"name": "(.-)"')
+		local ns_per_op = line:match('"ns_per_op": ([%d%.]+)')
+		if name and ns_per_op then
+			baseline[name] = tonumber(ns_per_op)
+		end
+	end
+
+	local regressions = 0
+	io.stderr:write(string.format('%-40s %14s %14s %9s\n', 'benchmark', 'baseline ns', 'current ns', 'change'))
+	for _, result in ipairs(results) do
+		local base = baseline[result.name]
+		if base then
+			local change = (result.ns_per_op - base) / base * 100
+			local regressed = change > options.threshold
+			if regressed then
+				regressions = regressions + 1
+			end
+			io.stderr:write(string.format('%-40s %14.1f %14.1f %+8.1f%%%s\n',
+				result.name, base, result.ns_per_op, change, regressed and ' REGRESSION' or ''))
+		else
+			io.stderr:write(string.format('%-40s %14s %14.1f %9s\n', result.name, '-', result.ns_per_op, 'new'))
+		end
+	end
+	if regressions > 0 then
+		io.stderr:write(string.format('%d benchmark(s) regressed by more than %g%%\n', regressions, options.threshold))
+		os.exit(1)
+	end
+end
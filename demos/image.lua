@@ -4,34 +4,16 @@ local fenster = require('fenster')
 
 -- Hack to get the current script directory
 local dirname = './' .. (debug.getinfo(1, 'S').source:match('^@?(.*[/\\])') or '') ---@type string
--- Add the project root directory to the package path
-package.path = dirname .. '../?.lua;' .. package.path
-
-local ppm = require('demos.lib.ppm')
-
----Draw a loaded image.
----@param window window*
----@param x integer
----@param y integer
----@param image_pixels integer[][]
----@param image_width integer
----@param image_height integer
-local function draw_image(window, x, y, image_pixels, image_width, image_height)
-	for iy = 1, image_height do
-		local dy = y + (iy - 1)
-		for ix = 1, image_width do
-			window:set(x + (ix - 1), dy, image_pixels[iy][ix])
-		end
-	end
-end
 
 -- Load either a user-specified image or the default image
 local image_path = arg[1] or dirname .. 'assets/uv.ppm'
-local image_pixels, image_width, image_height, image_err = ppm.load(image_path)
-if not image_pixels or not image_width or not image_height then
+local image, image_err = fenster.loadimage(image_path)
+if not image then
 	print('Failed to load image: ' .. tostring(image_err))
 	return
 end
+local image_width = image.width
+local image_height = image.height
 
 -- Calculate the window scale
 local window_scale = 1
@@ -48,14 +30,7 @@ local window = fenster.open(
 )
 
 -- Draw the image
-draw_image(
-	window,
-	0,
-	0,
-	image_pixels,
-	image_width,
-	image_height
-)
+image:blit(window, 0, 0)
 
 -- Empty window loop
 while window:loop() and not window.keys[27] do
@@ -1,43 +1,5 @@
 local fenster = require('fenster')
 
----Draw a line between two points (window boundary version)
----@param window window*
----@param x0 integer
----@param y0 integer
----@param x1 integer
----@param y1 integer
----@param color integer
-local function draw_line(window, x0, y0, x1, y1, color)
-	local window_width = window.width
-	local window_height = window.height
-	local dx = math.abs(x1 - x0)
-	local dy = math.abs(y1 - y0)
-	local sx = x0 < x1 and 1 or -1
-	local sy = y0 < y1 and 1 or -1
-	local err = (dx > dy and dx or -dy) / 2
-	local e2 ---@type number
-	while true do
-		-- NOTE: If you are copying this code, you may want to remove this boundary check
-		if x0 >= 0 and x0 < window_width and y0 >= 0 and y0 < window_height then
-			window:set(x0, y0, color)
-		end
-
-		if x0 == x1 and y0 == y1 then
-			break
-		end
-
-		e2 = err
-		if e2 > -dx then
-			err = err - dy
-			x0 = x0 + sx
-		end
-		if e2 < dy then
-			err = err + dx
-			y0 = y0 + sy
-		end
-	end
-end
-
 ---Fill an area with a specific color
 ---@param window window*
 ---@param x integer
@@ -124,8 +86,7 @@ while window:loop() and not window.keys[27] do
 	if mouse_down then
 		-- Draw a line between the last mouse position and the current mouse position
 		-- (Uses current mouse position if last mouse position is not set)
-		draw_line(
-			window,
+		window:line(
 			last_mouse_x or mouse_x,
 			last_mouse_y or mouse_y,
 			mouse_x,
@@ -15,9 +15,20 @@ local window = fenster.open(
 local plasma_y_step = 1 / window_height
 local plasma_x_step = 1 / window_width
 
+-- Under LuaJIT, write the pixels straight into the window buffer through the
+-- FFI, so the loop below compiles to machine code
+local ok, fenster_ffi = pcall(require, 'fenster.ffi')
+local buffer = jit and ok and fenster_ffi.buffer
+
 -- Draw plasma effect
 local time = 0
 while window:loop() and not window.keys[27] do
+	local pixels, stride
+	if buffer then
+		local _
+		pixels, _, _, stride = buffer(window)
+	end
+
 	local py = 0
 	for y = 1, window_height - 1 do
 		local px = 0
@@ -29,7 +40,11 @@ while window:loop() and not window.keys[27] do
 			local r = math.floor((0.5 + 0.5 * math.cos(s + 0.2)) * 255)
 			local g = math.floor((0.5 + 0.5 * math.cos(s + 0.5)) * 255)
 			local b = math.floor((0.5 + 0.5 * math.cos(s + 0.7)) * 255)
-			window:set(x, y, fenster.rgb(r, g, b))
+			if pixels then
+				pixels[y * stride + x] = r * 0x10000 + g * 0x100 + b
+			else
+				window:set(x, y, fenster.rgb(r, g, b))
+			end
 
 			px = px + plasma_x_step
 		end
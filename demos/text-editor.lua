@@ -1,216 +1,7 @@
 local fenster = require('fenster')
 
--- Define the microknight font
-local microknight_font = {
-	0x00, 0x0c, 0x1b, 0x0d, 0x81, 0x03, 0x01, 0xc0, 0x30, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x0c, 0x1b, 0x0d, 0x87, 0xc4, 0xb3, 0x60, 0x30, 0x30, 0x0c, 0x1b, 0x03, 0x00, 0x00, 0x00,
-	0x00, 0x0c, 0x09, 0x1f, 0xcd, 0x03, 0xe1, 0xc0, 0x10, 0x60, 0x06, 0x0e, 0x03, 0x00, 0x00, 0x00,
-	0x00, 0x0c, 0x00, 0x0d, 0x87, 0xc0, 0xc3, 0xd8, 0x20, 0x60, 0x06, 0x3f, 0x8f, 0xc0, 0x03, 0xe0,
-	0x00, 0x0c, 0x00, 0x1f, 0xc1, 0x61, 0x83, 0x70, 0x00, 0x60, 0x06, 0x0e, 0x03, 0x01, 0x80, 0x00,
-	0x00, 0x00, 0x00, 0x0d, 0x81, 0x63, 0x63, 0x60, 0x00, 0x30, 0x0c, 0x1b, 0x03, 0x01, 0x80, 0x00,
-	0x00, 0x0c, 0x00, 0x0d, 0x87, 0xc6, 0x91, 0xf0, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x80, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x60, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x03, 0x07, 0xc1, 0xe0, 0x61, 0xf0, 0x70, 0x7f, 0x1e, 0x0f, 0x00, 0x00, 0x00,
-	0x00, 0x03, 0x1e, 0x03, 0x00, 0x60, 0x30, 0x61, 0x80, 0xc0, 0x03, 0x33, 0x19, 0x81, 0x80, 0xc0,
-	0x00, 0x06, 0x33, 0x07, 0x03, 0xc0, 0xe0, 0xc1, 0xf8, 0xfc, 0x06, 0x1f, 0x18, 0xc1, 0x80, 0xc0,
-	0x00, 0x0c, 0x37, 0x83, 0x06, 0x00, 0x31, 0xb0, 0x0c, 0xc6, 0x0c, 0x31, 0x98, 0xc0, 0x00, 0x00,
-	0x00, 0x18, 0x3d, 0x83, 0x0c, 0x02, 0x33, 0x30, 0x8c, 0xc6, 0x0c, 0x31, 0x8f, 0xc0, 0x00, 0x00,
-	0x18, 0x30, 0x39, 0x83, 0x0c, 0x06, 0x33, 0xf9, 0x98, 0xcc, 0x0c, 0x33, 0x00, 0xc1, 0x80, 0xc0,
-	0x18, 0x60, 0x1f, 0x0f, 0xcf, 0xe3, 0xe0, 0x30, 0xf0, 0x78, 0x0c, 0x1e, 0x03, 0x81, 0x80, 0x40,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x0f, 0x83, 0x83, 0xc3, 0xe0, 0xf0, 0xf8, 0x7f, 0x3f, 0x87, 0x0c, 0x63, 0xf0,
-	0x18, 0x00, 0x0c, 0x18, 0xc6, 0xc6, 0x63, 0x31, 0x98, 0xcc, 0x60, 0x30, 0x0c, 0x0c, 0x60, 0xc0,
-	0x30, 0x3e, 0x06, 0x00, 0xcd, 0xe6, 0x33, 0xf1, 0x80, 0xc6, 0x7e, 0x3f, 0x18, 0x0c, 0x60, 0xc0,
-	0x60, 0x00, 0x03, 0x07, 0x8f, 0x67, 0xf3, 0x19, 0x80, 0xc6, 0x60, 0x30, 0x19, 0xcf, 0xe0, 0xc0,
-	0x30, 0x3e, 0x06, 0x06, 0x0d, 0xe6, 0x33, 0x19, 0x80, 0xc6, 0x60, 0x30, 0x18, 0xcc, 0x60, 0xc0,
-	0x18, 0x00, 0x0c, 0x00, 0x0c, 0x06, 0x33, 0x31, 0x8c, 0xc6, 0x60, 0x30, 0x18, 0xcc, 0x60, 0xc0,
-	0x00, 0x00, 0x00, 0x06, 0x06, 0x66, 0x33, 0xe0, 0xf8, 0xfc, 0x7f, 0x30, 0x0f, 0xcc, 0x63, 0xf0,
-	0x00, 0x00, 0x00, 0x00, 0x03, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x0e, 0x63, 0x30, 0x18, 0xcc, 0x63, 0xc3, 0xe0, 0xf0, 0xf8, 0x3c, 0x1f, 0x98, 0xcc, 0x66, 0x30,
-	0x06, 0x66, 0x30, 0x1d, 0xce, 0x66, 0x63, 0x31, 0x98, 0xcc, 0x60, 0x06, 0x18, 0xcc, 0x66, 0x30,
-	0x06, 0x6c, 0x30, 0x1f, 0xcf, 0x66, 0x33, 0x19, 0x8c, 0xc6, 0x3e, 0x06, 0x18, 0xcc, 0x66, 0x30,
-	0x06, 0x78, 0x30, 0x1a, 0xcd, 0xe6, 0x33, 0x19, 0x8c, 0xc6, 0x03, 0x06, 0x18, 0xc6, 0xc6, 0xb0,
-	0xc6, 0x6c, 0x30, 0x18, 0xcc, 0xe6, 0x33, 0xf1, 0x8c, 0xfc, 0x23, 0x06, 0x18, 0xc6, 0xc7, 0xf0,
-	0xc6, 0x66, 0x30, 0x18, 0xcc, 0x66, 0x33, 0x01, 0xac, 0xd8, 0x63, 0x06, 0x18, 0xc3, 0x87, 0x70,
-	0x7c, 0x63, 0x3f, 0x98, 0xcc, 0x63, 0xe3, 0x00, 0xf8, 0xcc, 0x3e, 0x06, 0x0f, 0x83, 0x86, 0x30,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xc6, 0x63, 0x3f, 0x87, 0x00, 0x01, 0xc0, 0x40, 0x00, 0x18, 0x00, 0x30, 0x00, 0x00, 0x60, 0x00,
-	0x6c, 0x63, 0x03, 0x06, 0x0c, 0x00, 0xc0, 0xe0, 0x00, 0x18, 0x1e, 0x3e, 0x0f, 0x03, 0xe3, 0xc0,
-	0x38, 0x63, 0x06, 0x06, 0x06, 0x00, 0xc1, 0xb0, 0x00, 0x10, 0x03, 0x33, 0x19, 0x86, 0x66, 0x60,
-	0x38, 0x3e, 0x0c, 0x06, 0x03, 0x00, 0xc0, 0x00, 0x00, 0x08, 0x3f, 0x31, 0x98, 0x0c, 0x67, 0xe0,
-	0x6c, 0x06, 0x18, 0x06, 0x01, 0x80, 0xc0, 0x00, 0x00, 0x00, 0x63, 0x31, 0x98, 0x0c, 0x66, 0x00,
-	0xc6, 0x06, 0x30, 0x06, 0x00, 0xc0, 0xc0, 0x00, 0x00, 0x00, 0x63, 0x31, 0x98, 0xcc, 0x66, 0x30,
-	0xc6, 0x06, 0x3f, 0x87, 0x00, 0x61, 0xc0, 0x00, 0x00, 0x00, 0x3f, 0x3f, 0x0f, 0x87, 0xe3, 0xe0,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xfc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x38, 0x00, 0x30, 0x03, 0x00, 0xc6, 0x00, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x6c, 0x3f, 0x3e, 0x00, 0x00, 0x06, 0x60, 0x61, 0x88, 0xf8, 0x3c, 0x3e, 0x07, 0xcf, 0xc3, 0xc0,
-	0x60, 0x63, 0x33, 0x07, 0x01, 0xc6, 0xc0, 0x61, 0xdc, 0xcc, 0x66, 0x33, 0x0c, 0xcc, 0x66, 0x00,
-	0x78, 0x63, 0x31, 0x83, 0x00, 0xc7, 0x80, 0x61, 0xfc, 0xc6, 0x63, 0x31, 0x98, 0xcc, 0x03, 0xe0,
-	0x60, 0x63, 0x31, 0x83, 0x00, 0xc6, 0xc0, 0x61, 0xac, 0xc6, 0x63, 0x31, 0x98, 0xcc, 0x00, 0x30,
-	0x60, 0x3f, 0x31, 0x83, 0x00, 0xc6, 0x60, 0x61, 0x8c, 0xc6, 0x63, 0x31, 0x98, 0xcc, 0x06, 0x30,
-	0x60, 0x03, 0x31, 0x8f, 0xc4, 0xc6, 0x31, 0xf9, 0x8c, 0xc6, 0x3e, 0x3f, 0x0f, 0xcc, 0x03, 0xe0,
-	0x60, 0x3e, 0x00, 0x00, 0x03, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0xc0, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x1c, 0x87, 0x00, 0x00, 0xc0,
-	0x7c, 0x63, 0x31, 0x98, 0xcc, 0x66, 0x33, 0xf8, 0x30, 0x18, 0x0c, 0x27, 0x0e, 0x00, 0x00, 0x00,
-	0x30, 0x63, 0x31, 0x9a, 0xc6, 0xc6, 0x30, 0x30, 0x30, 0x18, 0x0c, 0x00, 0x1c, 0x00, 0x00, 0xc0,
-	0x30, 0x63, 0x1b, 0x1f, 0xc3, 0x86, 0x30, 0x60, 0x60, 0x18, 0x06, 0x00, 0x18, 0x20, 0x00, 0xc0,
-	0x30, 0x63, 0x1b, 0x0f, 0x83, 0x86, 0x30, 0xc0, 0x30, 0x18, 0x0c, 0x00, 0x10, 0x60, 0x00, 0xc0,
-	0x32, 0x63, 0x0e, 0x0d, 0x86, 0xc3, 0xf1, 0x80, 0x30, 0x18, 0x0c, 0x00, 0x00, 0xe0, 0x00, 0xc0,
-	0x1c, 0x3f, 0x0e, 0x08, 0x8c, 0x60, 0x33, 0xf8, 0x18, 0x18, 0x18, 0x00, 0x01, 0xc0, 0x00, 0xc0,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xe0, 0x00, 0x00, 0x18, 0x00, 0x00, 0x03, 0x80, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x30, 0x1c, 0x00, 0x18, 0xc1, 0x83, 0xc1, 0xb0, 0x78, 0x00, 0x00, 0x1f, 0x00, 0x03, 0xc3, 0xe0,
-	0x78, 0x36, 0x31, 0x98, 0xc1, 0x86, 0x00, 0x00, 0x84, 0x7e, 0x1b, 0x03, 0x00, 0x04, 0x20, 0x00,
-	0xcc, 0x30, 0x1f, 0x18, 0xc1, 0x83, 0xe0, 0x01, 0x32, 0xc6, 0x36, 0x00, 0x00, 0x0b, 0x90, 0x00,
-	0xc0, 0x7c, 0x31, 0x8f, 0x80, 0x06, 0x30, 0x01, 0x42, 0xc6, 0x6c, 0x00, 0x0f, 0x8a, 0x50, 0x00,
-	0xc0, 0x30, 0x31, 0x81, 0x81, 0x86, 0x30, 0x01, 0x42, 0x7e, 0x36, 0x00, 0x00, 0x0b, 0x90, 0x00,
-	0xc6, 0x30, 0x1f, 0x07, 0xc1, 0x83, 0xe0, 0x01, 0x32, 0x00, 0x1b, 0x00, 0x00, 0x0a, 0x50, 0x00,
-	0x7c, 0x7f, 0x31, 0x81, 0x81, 0x80, 0x30, 0x00, 0x84, 0x7c, 0x00, 0x00, 0x00, 0x04, 0x20, 0x00,
-	0x30, 0x00, 0x00, 0x00, 0x00, 0x01, 0xe0, 0x00, 0x78, 0x00, 0x00, 0x00, 0x00, 0x03, 0xc0, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x38, 0x00, 0x1c, 0x0e, 0x01, 0x80, 0x00, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x06, 0x03, 0x00,
-	0x6c, 0x08, 0x06, 0x03, 0x03, 0x06, 0x31, 0xf8, 0x00, 0x00, 0x38, 0x1f, 0x1b, 0x0e, 0x67, 0x30,
-	0x6c, 0x3e, 0x0c, 0x06, 0x06, 0x06, 0x33, 0xd0, 0x30, 0x00, 0x18, 0x31, 0x8d, 0x86, 0xc3, 0x60,
-	0x38, 0x08, 0x18, 0x03, 0x00, 0x06, 0x31, 0xd0, 0x30, 0x00, 0x18, 0x31, 0x86, 0xc7, 0xa3, 0xc0,
-	0x00, 0x00, 0x1e, 0x0e, 0x00, 0x06, 0x30, 0x50, 0x00, 0x00, 0x3c, 0x1f, 0x0d, 0x83, 0x61, 0xf0,
-	0x00, 0x3e, 0x00, 0x00, 0x00, 0x06, 0x30, 0x50, 0x00, 0x00, 0x00, 0x00, 0x1b, 0x06, 0xf3, 0x18,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0xe0, 0x50, 0x00, 0x18, 0x00, 0x1f, 0x00, 0x0c, 0xf6, 0x70,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x30, 0xf8,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xe0, 0x18, 0x0c, 0x03, 0x03, 0x03, 0x91, 0xb0, 0xf0, 0x3f, 0x3c, 0x0c, 0x03, 0x01, 0x83, 0x60,
-	0x36, 0x00, 0x02, 0x04, 0x0c, 0xc4, 0xe0, 0x01, 0x98, 0x6c, 0x66, 0x02, 0x04, 0x06, 0x60, 0x00,
-	0x6c, 0x18, 0x1e, 0x0f, 0x07, 0x83, 0xc1, 0xe0, 0xf0, 0xcf, 0x60, 0x3f, 0x9f, 0xcf, 0xe7, 0xf0,
-	0x3a, 0x1e, 0x33, 0x19, 0x8c, 0xc6, 0x63, 0x31, 0x98, 0xfc, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x00,
-	0xf6, 0x03, 0x3f, 0x9f, 0xcf, 0xe7, 0xf3, 0xf9, 0xfc, 0xcc, 0x60, 0x3f, 0x1f, 0x8f, 0xc7, 0xe0,
-	0x6f, 0x63, 0x31, 0x98, 0xcc, 0x66, 0x33, 0x19, 0x8c, 0xcc, 0x63, 0x30, 0x18, 0x0c, 0x06, 0x00,
-	0xcf, 0x3e, 0x31, 0x98, 0xcc, 0x66, 0x33, 0x19, 0x8c, 0xcf, 0x3e, 0x3f, 0x9f, 0xcf, 0xe7, 0xf0,
-	0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x30, 0x0c, 0x06, 0x0d, 0x8f, 0x83, 0x90, 0xc0, 0x30, 0x30, 0x39, 0x1b, 0x00, 0x07, 0x81, 0x80,
-	0x08, 0x10, 0x19, 0x80, 0x0c, 0xc4, 0xe0, 0x20, 0x40, 0xcc, 0x4e, 0x00, 0x0f, 0x8c, 0xc0, 0x40,
-	0x7e, 0x3f, 0x1f, 0x8f, 0xcc, 0x67, 0x31, 0xe0, 0xf0, 0x78, 0x3c, 0x1e, 0x1a, 0xcd, 0xe6, 0x30,
-	0x18, 0x0c, 0x06, 0x03, 0x0e, 0x67, 0xb3, 0x31, 0x98, 0xcc, 0x66, 0x33, 0x1f, 0xef, 0x66, 0x30,
-	0x18, 0x0c, 0x06, 0x03, 0x0c, 0x66, 0xf3, 0x19, 0x8c, 0xc6, 0x63, 0x31, 0x9b, 0x6e, 0x66, 0x30,
-	0x18, 0x0c, 0x06, 0x03, 0x0c, 0x66, 0x73, 0x19, 0x8c, 0xc6, 0x63, 0x31, 0x98, 0xec, 0x66, 0x30,
-	0x7e, 0x3f, 0x1f, 0x8f, 0xcf, 0xc6, 0x31, 0xf0, 0xf8, 0x7c, 0x3e, 0x1f, 0x0f, 0xc7, 0xc3, 0xe0,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x18, 0x0c, 0x1b, 0x03, 0x0c, 0x00, 0x00, 0xc0, 0x30, 0x18, 0x39, 0x1b, 0x07, 0x80, 0x00, 0x00,
-	0x20, 0x33, 0x00, 0x04, 0x0f, 0x83, 0xc0, 0x20, 0x40, 0x66, 0x4e, 0x00, 0x0c, 0xc7, 0xe3, 0xc0,
-	0xc6, 0x63, 0x31, 0x98, 0xcc, 0xc6, 0x60, 0xf0, 0x78, 0x3c, 0x1e, 0x0f, 0x07, 0x81, 0xb6, 0x60,
-	0xc6, 0x63, 0x31, 0x98, 0xcc, 0x66, 0xe0, 0x18, 0x0c, 0x06, 0x03, 0x01, 0x80, 0xc7, 0xf6, 0x00,
-	0xc6, 0x63, 0x31, 0x8f, 0x8f, 0xc6, 0x31, 0xf8, 0xfc, 0x7e, 0x3f, 0x1f, 0x8f, 0xcd, 0x86, 0x00,
-	0xc6, 0x63, 0x31, 0x81, 0x8c, 0x06, 0x33, 0x19, 0x8c, 0xc6, 0x63, 0x31, 0x98, 0xcd, 0x86, 0x30,
-	0x7c, 0x3e, 0x1f, 0x01, 0x8c, 0x06, 0xe1, 0xf8, 0xfc, 0x7e, 0x3f, 0x1f, 0x8f, 0xc7, 0xf3, 0xe0,
-	0x00, 0x00, 0x00, 0x00, 0x0c, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x80,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x30, 0x0c, 0x0c, 0x0d, 0x83, 0x00, 0xc0, 0x60, 0xd8, 0x0c, 0x39, 0x0c, 0x03, 0x01, 0x83, 0x90,
-	0x08, 0x10, 0x33, 0x00, 0x00, 0x81, 0x01, 0x98, 0x00, 0x16, 0x4e, 0x02, 0x04, 0x06, 0x64, 0xe0,
-	0x78, 0x3c, 0x1e, 0x0f, 0x03, 0x81, 0xc0, 0xe0, 0x70, 0x3e, 0x7c, 0x1e, 0x0f, 0x07, 0x83, 0xc0,
-	0xfc, 0x7e, 0x3f, 0x1f, 0x81, 0x80, 0xc0, 0x60, 0x30, 0x66, 0x66, 0x33, 0x19, 0x8c, 0xc6, 0x60,
-	0xc0, 0x60, 0x30, 0x18, 0x01, 0x80, 0xc0, 0x60, 0x30, 0xc6, 0x63, 0x31, 0x98, 0xcc, 0x66, 0x30,
-	0xc6, 0x63, 0x31, 0x98, 0xc1, 0x80, 0xc0, 0x60, 0x30, 0xc6, 0x63, 0x31, 0x98, 0xcc, 0x66, 0x30,
-	0x7c, 0x3e, 0x1f, 0x0f, 0x87, 0xe3, 0xf1, 0xf8, 0xfc, 0x7e, 0x63, 0x1f, 0x0f, 0x87, 0xc3, 0xe0,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x6c, 0x00, 0x00, 0x06, 0x01, 0x80, 0xc1, 0xb0, 0x30, 0xc0, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x0c, 0x1e, 0x01, 0x02, 0x03, 0x30, 0x00, 0x40, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x78, 0x00, 0x33, 0x18, 0xcc, 0x66, 0x33, 0x19, 0x8c, 0xf8, 0x63, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xcc, 0x3f, 0x37, 0x98, 0xcc, 0x66, 0x33, 0x19, 0x8c, 0xcc, 0x63, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xc6, 0x00, 0x3d, 0x98, 0xcc, 0x66, 0x33, 0x19, 0x8c, 0xc6, 0x63, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0xc6, 0x0c, 0x39, 0x98, 0xcc, 0x66, 0x33, 0x18, 0xfc, 0xfc, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x7c, 0x00, 0x1f, 0x0f, 0xc7, 0xe3, 0xf1, 0xf8, 0x0c, 0xc0, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0xc0, 0x3e, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-}
-
--- Define the microknight layout
-local microknight_layout = {
-	{ 0,  0 }, { 9, 0 }, { 18, 0 }, { 27, 0 }, { 36, 0 }, { 45, 0 }, { 54, 0 }, { 63, 0 }, { 72, 0 }, { 81, 0 }, { 90, 0 },
-	{ 99, 0 }, { 108, 0 }, { 117, 0 }, { 0, 9 }, { 9, 9 }, { 18, 9 }, { 27, 9 }, { 36, 9 }, { 45, 9 }, { 54, 9 },
-	{ 63, 9 }, { 72, 9 }, { 81, 9 }, { 90, 9 }, { 99, 9 }, { 108, 9 }, { 117, 9 }, { 0, 18 }, { 9, 18 }, { 18, 18 },
-	{ 27, 18 }, { 36, 18 }, { 45, 18 }, { 54, 18 }, { 63, 18 }, { 72, 18 }, { 81, 18 }, { 90, 18 }, { 99, 18 },
-	{ 108, 18 }, { 117, 18 }, { 0, 27 }, { 9, 27 }, { 18, 27 }, { 27, 27 }, { 36, 27 }, { 45, 27 }, { 54, 27 }, { 63, 27 },
-	{ 72,  27 }, { 81, 27 }, { 90, 27 }, { 99, 27 }, { 108, 27 }, { 117, 27 }, { 0, 36 }, { 9, 36 }, { 18, 36 },
-	{ 27,  36 }, { 36, 36 }, { 45, 36 }, { 54, 36 }, { 63, 36 }, { 72, 36 }, { 81, 36 }, { 90, 36 }, { 99, 36 },
-	{ 108, 36 }, { 117, 36 }, { 0, 45 }, { 9, 45 }, { 18, 45 }, { 27, 45 }, { 36, 45 }, { 45, 45 }, { 54, 45 },
-	{ 63, 45 }, { 72, 45 }, { 81, 45 }, { 90, 45 }, { 99, 45 }, { 108, 45 }, { 117, 45 }, { 0, 54 }, { 9, 54 }, { 18, 54 },
-	{ 27, 54 }, { 36, 54 }, { 45, 54 }, { 54, 54 }, { 63, 54 },
-	{ 72, 54 }, { 81, 54 }, { 90, 54 }, { 99, 54 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
-	{ 0,  0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
-	{ 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
-	{ 0, 0 }, { 0, 0 }, { 108, 54 }, { 117, 54 }, { 0, 63 }, { 9, 63 }, { 18, 63 }, { 27, 63 }, { 36, 63 }, { 45, 63 },
-	{ 54, 63 }, { 63, 63 }, { 72, 63 }, { 81, 63 }, { 90, 63 }, { 99, 63 }, { 108, 63 }, { 117, 63 }, { 0, 72 }, { 9, 72 },
-	{ 18, 72 }, { 27, 72 }, { 36, 72 }, { 45, 72 }, { 54, 72 }, { 63, 72 }, { 72, 72 }, { 81, 72 }, { 90, 72 }, { 99, 72 },
-	{ 108, 72 }, { 117, 72 }, { 0, 81 }, { 9, 81 }, { 18, 81 }, { 27, 81 }, { 36, 81 }, { 45, 81 }, { 54, 81 }, { 63, 81 },
-	{ 72,  81 }, { 81, 81 }, { 90, 81 }, { 99, 81 }, { 108, 81 }, { 117, 81 }, { 0, 90 }, { 9, 90 }, { 18, 90 },
-	{ 27,  90 }, { 36, 90 }, { 45, 90 }, { 54, 90 }, { 63, 90 }, { 72, 90 }, { 81, 90 }, { 90, 90 }, { 99, 90 },
-	{ 108, 90 }, { 117, 90 }, { 0, 99 }, { 9, 99 }, { 18, 99 }, { 27, 99 }, { 36, 99 }, { 45, 99 }, { 54, 99 }, { 63, 99 },
-	{ 72, 99 }, { 81, 99 }, { 90, 99 }, { 99, 99 }, { 108, 99 }, { 117, 99 }, { 0, 108 }, { 9, 108 }, { 18, 108 },
-	{ 27, 108 }, { 36, 108 }, { 45, 108 }, { 54, 108 }, { 63, 108 }, { 72, 108 }, { 81, 108 }, { 90, 108 }, { 99, 108 },
-	{ 108, 108 }, { 117, 108 }, { 0, 117 }, { 9, 117 }, { 18, 117 }, { 27, 117 }, { 36, 117 }, { 45, 117 }, { 54, 117 },
-	{ 63,  117 }, { 72, 117 }, { 81, 117 },
-}
-
--- Calculate the microknight texture
-local microknight_texture = {} ---@type integer[]
-for _, t in ipairs(microknight_font) do
-	local bits = {} ---@type number[]
-	for b = 8, 1, -1 do
-		bits[b] = math.fmod(t, 2)
-		t = math.floor((t - bits[b]) / 2)
-	end
-
-	microknight_texture[#microknight_texture + 1] = bits[1] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[2] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[3] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[4] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[5] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[6] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[7] == 0 and 0x000000 or 0xffffff
-	microknight_texture[#microknight_texture + 1] = bits[8] == 0 and 0x000000 or 0xffffff
-end
-
--- Define the height/width of each microknight character
-local microknight_size = 8
-
----Draw text using the microknight font (8x8 pixels per character)
----@param window window*
----@param text string
----@param x integer
----@param y integer
-local function draw_text(window, text, x, y)
-	for character in text:gmatch('.') do
-		local index = character:byte() - 31
-		if index > #microknight_layout then
-			index = 0
-		end
-
-		local layout = microknight_layout[index]
-		local texture_offset = (layout[2] * 128) + layout[1]
-
-		for fy = 0, microknight_size do
-			for fx = 0, microknight_size do
-				local texture_index = texture_offset + (fy * 128) + fx
-				window:set(
-					x + fx,
-					y + fy,
-					microknight_texture[texture_index + 1]
-				)
-			end
-		end
-
-		x = x + microknight_size
-	end
-end
+-- Define the height/width of each character of the built-in font
+local font_size = 8
 
 -- Define the key mappings
 local escape_key = 27
@@ -293,105 +84,86 @@ local character_uppercase_map = {
 -- Text settings
 local text_offset_x = 16
 local text_offset_y = 16
-local text_line_height = microknight_size * 2
+local text_line_height = font_size * 2
 local max_text_line_length = 80 -- should be higher than 30
 local max_text_lines = 30
 
 -- Open a window
-local window_width = text_offset_x + microknight_size * max_text_line_length +
+local window_width = text_offset_x + font_size * max_text_line_length +
 	text_offset_x
 local window_height = text_offset_y + text_line_height * (max_text_lines - 1) +
-	microknight_size + text_offset_y
+	font_size + text_offset_y
 local window = fenster.open(window_width, window_height, 'Text Demo')
 
 -- Draw instructions
-draw_text(
-	window,
+window:text(
+	text_offset_x,
+	text_offset_y + text_line_height * 0,
 	'Type anything'
 	.. string.rep(' ', max_text_line_length - 30)
 	.. 'Press ESC to exit',
-	text_offset_x,
-	text_offset_y + text_line_height * 0
+	0xffffff
 )
-draw_text(
-	window,
-	string.rep('-', max_text_line_length),
+window:text(
 	text_offset_x,
-	text_offset_y + text_line_height * 1
+	text_offset_y + text_line_height * 1,
+	string.rep('-', max_text_line_length),
+	0xffffff
 )
 
+-- Map the key codes back to the characters they add
+local character_key_names = {} ---@type table<integer, string>
+for key, code in pairs(character_keys) do
+	character_key_names[code] = key
+end
+
 -- Main loop
 local typed_text_lines = { '' }
 local curr_line = 1
 while window:loop() and not window.keys[escape_key] do
-	local keys = window.keys
-
-	-- Get text input and draw the new text when needed
-	local pressed_key ---@type integer
-	if keys[enter_key] then
-		pressed_key = enter_key
-
-		-- Check if we are under the line limit
-		if curr_line + 1 < max_text_lines - 1 then
-			-- Go to the next line and initialize if needed
-			curr_line = curr_line + 1
-			typed_text_lines[curr_line] = typed_text_lines[curr_line] or ''
-		end
-	elseif keys[backspace_key] then
-		pressed_key = backspace_key
-
-		-- Check if we are at the first position any line under the first
-		if #typed_text_lines[curr_line] == 0 and curr_line > 1 then
-			-- Return to the previous line
-			curr_line = curr_line - 1
-		else
-			-- Remove last character from text
-			typed_text_lines[curr_line] = typed_text_lines[curr_line]:sub(1, -2)
-
-			-- Clear last character from window
-			local start_x = text_offset_x + #typed_text_lines[curr_line] * microknight_size
-			local start_y = text_offset_y + text_line_height * (curr_line + 1)
-			for y = start_y, start_y + microknight_size do
-				for x = start_x, start_x + microknight_size do
-					window:set(x, y, 0x000000)
-				end
+	-- Handle every key press since the last frame, so fast typing isn't lost
+	for event, pressed_key in window:events() do
+		if event ~= 'keydown' then
+			-- Ignore everything except key presses
+		elseif pressed_key == enter_key then
+			-- Check if we are under the line limit
+			if curr_line + 1 < max_text_lines - 1 then
+				-- Go to the next line and initialize if needed
+				curr_line = curr_line + 1
+				typed_text_lines[curr_line] = typed_text_lines[curr_line] or ''
 			end
-		end
-	else
-		-- Loop through all character keys (keys that add text)
-		for key, code in pairs(character_keys) do
-			if keys[code] then
-				pressed_key = code
-
-				-- Check if line is at max length
-				if #typed_text_lines[curr_line] + 1 > max_text_line_length then
-					break
-				end
-
-				-- Get the character to print
-				local character = window.modshift
-					and (character_uppercase_map[key] or key:upper())
-					or key
-
-				-- Draw new character
-				draw_text(
-					window,
-					character,
-					text_offset_x + #typed_text_lines[curr_line] * microknight_size,
-					text_offset_y + text_line_height * (curr_line + 1)
-				)
-
-				-- Add new character to text line
-				typed_text_lines[curr_line] = typed_text_lines[curr_line] .. character
-				break
+		elseif pressed_key == backspace_key then
+			-- Check if we are at the first position any line under the first
+			if #typed_text_lines[curr_line] == 0 and curr_line > 1 then
+				-- Return to the previous line
+				curr_line = curr_line - 1
+			else
+				-- Remove last character from text
+				typed_text_lines[curr_line] = typed_text_lines[curr_line]:sub(1, -2)
+
+				-- Clear last character from window
+				local start_x = text_offset_x + #typed_text_lines[curr_line] * font_size
+				local start_y = text_offset_y + text_line_height * (curr_line + 1)
+				window:fillrect(start_x, start_y, font_size, font_size, 0x000000)
 			end
-		end
-	end
-
-	-- Wait until pressed key was released
-	if pressed_key then
-		while window:loop() and window.keys[pressed_key] do
-			--
+		elseif character_key_names[pressed_key]
+			and #typed_text_lines[curr_line] + 1 <= max_text_line_length then
+			-- Get the character to print
+			local key = character_key_names[pressed_key]
+			local character = window.modshift
+				and (character_uppercase_map[key] or key:upper())
+				or key
+
+			-- Draw new character
+			window:text(
+				text_offset_x + #typed_text_lines[curr_line] * font_size,
+				text_offset_y + text_line_height * (curr_line + 1),
+				character,
+				0xffffff
+			)
+
+			-- Add new character to text line
+			typed_text_lines[curr_line] = typed_text_lines[curr_line] .. character
 		end
 	end
 end
@@ -11,32 +11,60 @@
 #define _DEFAULT_SOURCE 1
 #include <X11/XKBlib.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 #include <X11/keysym.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <time.h>
 #endif
 
 #include <stdint.h>
 #include <stdlib.h>
 
+/* input events passed to the optional event callback */
+enum fenster_event {
+  FENSTER_KEYDOWN = 1, /* code is the key */
+  FENSTER_KEYUP,       /* code is the key */
+  FENSTER_MOUSEDOWN,   /* code is the button (always 1) */
+  FENSTER_MOUSEUP,     /* code is the button (always 1) */
+  FENSTER_MOUSEMOVE,   /* the new position is in x and y */
+  FENSTER_MOD,         /* code is the new mod mask */
+};
+
 struct fenster {
   const char *title;
   const int width;
   const int height;
-  uint32_t *buf;
+  uint32_t *buf; /* if NULL, fenster_open allocates it, fenster_close frees it */
   int keys[256]; /* keys are mostly ASCII, but arrows are 17..20 */
   int mod;       /* mod is 4 bits mask, ctrl=1, shift=2, alt=4, meta=8 */
   int x;
   int y;
   int mouse;
+  /* if not NULL, called for every change of keys, mod, mouse or x/y, with
+   * the time the event happened on the fenster_time clock */
+  void (*event)(struct fenster *f, int type, int code, int64_t time);
+  void *userdata; /* not used by fenster, e.g. for the event callback */
+  int shm;    /* buf is shared with the X server via MIT-SHM (X11 only) */
+  int ownbuf; /* buf was allocated by fenster_open */
 #if defined(__APPLE__)
   id wnd;
 #elif defined(_WIN32)
   HWND hwnd;
 #else
-  Display *dpy;
+  Display *dpy; /* shared by all fensters of the process */
   Window w;
   GC gc;
   XImage *img;
+  XShmSegmentInfo shminfo;
+  int shmbusy; /* the X server might still be reading the segment */
+  /* if set, another thread presents and flushes the fenster, so processing
+   * events doesn't, and Expose only sets exposed for the owner to redraw */
+  int async;
+  int exposed;
 #endif
 };
 
@@ -45,12 +73,60 @@ struct fenster {
 #endif
 FENSTER_API int fenster_open(struct fenster *f);
 FENSTER_API int fenster_loop(struct fenster *f);
+FENSTER_API void fenster_present(struct fenster *f, int x, int y, int w, int h);
+FENSTER_API int fenster_events(struct fenster *f);
+FENSTER_API int fenster_wait(struct fenster *f, int timeout);
 FENSTER_API void fenster_close(struct fenster *f);
 FENSTER_API void fenster_sleep(int64_t ms);
 FENSTER_API int64_t fenster_time(void);
+FENSTER_API int64_t fenster_time_ns(void);
 #define fenster_pixel(f, x, y) ((f)->buf[((y) * (f)->width) + (x)])
 
 #ifndef FENSTER_HEADER
+static int fenster_alloc_buf(struct fenster *f) {
+  if (f->buf) return 0;
+  f->buf = (uint32_t *)calloc((size_t)f->width * f->height, sizeof(uint32_t));
+  if (!f->buf) return -1;
+  f->ownbuf = 1;
+  return 0;
+}
+
+static void fenster_free_buf(struct fenster *f) {
+  if (!f->ownbuf) return;
+  free(f->buf);
+  f->buf = NULL;
+  f->ownbuf = 0;
+}
+
+/* t is when the native event happened, converted to the fenster_time clock */
+static void fenster_emit(struct fenster *f, int type, int code, int64_t t) {
+  if (f->event) f->event(f, type, code, t);
+}
+
+static void fenster_setkey(struct fenster *f, int k, int down, int64_t t) {
+  if (f->keys[k] == down) return; /* ignore auto-repeat */
+  f->keys[k] = down;
+  fenster_emit(f, down ? FENSTER_KEYDOWN : FENSTER_KEYUP, k, t);
+}
+
+static void fenster_setmod(struct fenster *f, int mod, int64_t t) {
+  if (f->mod == mod) return;
+  f->mod = mod;
+  fenster_emit(f, FENSTER_MOD, mod, t);
+}
+
+static void fenster_setmouse(struct fenster *f, int down, int64_t t) {
+  if (f->mouse == down) return;
+  f->mouse = down;
+  fenster_emit(f, down ? FENSTER_MOUSEDOWN : FENSTER_MOUSEUP, 1, t);
+}
+
+static void fenster_setpos(struct fenster *f, int x, int y, int64_t t) {
+  if (f->x == x && f->y == y) return;
+  f->x = x, f->y = y;
+  fenster_emit(f, FENSTER_MOUSEMOVE, 0, t);
+}
+
 #if defined(__APPLE__)
 #define msg(r, o, s) ((r (*)(id, SEL))objc_msgSend)(o, sel_getUid(s))
 #define msg1(r, o, s, A, a) \
@@ -93,6 +169,7 @@ static BOOL fenster_should_close(id v, SEL s, id w) {
 }
 
 FENSTER_API int fenster_open(struct fenster *f) {
+  if (fenster_alloc_buf(f) != 0) return -1;
   msg(id, cls("NSApplication"), "sharedApplication");
   msg1(void, NSApp, "setActivationPolicy:", NSInteger, 0);
   f->wnd = msg4(id, msg(id, cls("NSWindow"), "alloc"),
@@ -125,44 +202,64 @@ FENSTER_API int fenster_open(struct fenster *f) {
 
 FENSTER_API void fenster_close(struct fenster *f) {
   msg(void, f->wnd, "close");
+  fenster_free_buf(f);
 }
 
 // clang-format off
 static const uint8_t FENSTER_KEYCODES[128] = {65,83,68,70,72,71,90,88,67,86,0,66,81,87,69,82,89,84,49,50,51,52,54,53,61,57,55,45,56,48,93,79,85,91,73,80,10,76,74,39,75,59,92,44,47,78,77,46,9,32,96,8,0,27,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,26,2,3,127,0,5,0,4,0,20,19,18,17,0};
 // clang-format on
-FENSTER_API int fenster_loop(struct fenster *f) {
+FENSTER_API void fenster_present(struct fenster *f, int x, int y, int w,
+                                 int h) {
+  (void)x, (void)y, (void)w, (void)h; /* the view is always redrawn fully */
   msg1(void, msg(id, f->wnd, "contentView"), "setNeedsDisplay:", BOOL, YES);
+}
+FENSTER_API int fenster_events(struct fenster *f) {
   id ev = msg4(id, NSApp,
                "nextEventMatchingMask:untilDate:inMode:dequeue:", NSUInteger,
                NSUIntegerMax, id, NULL, id, NSDefaultRunLoopMode, BOOL, YES);
   if (!ev) return 0;
   NSUInteger evtype = msg(NSUInteger, ev, "type");
+  /* event timestamps are seconds since boot, like systemUptime */
+  double uptime = msg(double, msg(id, cls("NSProcessInfo"), "processInfo"),
+                      "systemUptime");
+  int64_t t = fenster_time() -
+              (int64_t)((uptime - msg(double, ev, "timestamp")) * 1000);
   switch (evtype) {
     case 1: /* NSEventTypeMouseDown */
-      f->mouse |= 1;
+      fenster_setmouse(f, 1, t);
       break;
     case 2: /* NSEventTypeMouseUp*/
-      f->mouse &= ~1;
+      fenster_setmouse(f, 0, t);
       break;
     case 5:
     case 6: { /* NSEventTypeMouseMoved */
       CGPoint xy = msg(CGPoint, ev, "locationInWindow");
-      f->x = (int)xy.x;
-      f->y = (int)(f->height - xy.y);
+      fenster_setpos(f, (int)xy.x, (int)(f->height - xy.y), t);
       return 0;
     }
     case 10: /*NSEventTypeKeyDown*/
     case 11: /*NSEventTypeKeyUp:*/ {
       NSUInteger k = msg(NSUInteger, ev, "keyCode");
-      f->keys[k < 127 ? FENSTER_KEYCODES[k] : 0] = evtype == 10;
       NSUInteger mod = msg(NSUInteger, ev, "modifierFlags") >> 17;
-      f->mod = (mod & 0xc) | ((mod & 1) << 1) | ((mod >> 1) & 1);
+      fenster_setmod(f, (mod & 0xc) | ((mod & 1) << 1) | ((mod >> 1) & 1), t);
+      fenster_setkey(f, k < 127 ? FENSTER_KEYCODES[k] : 0, evtype == 10, t);
       return 0;
     }
   }
   msg1(void, NSApp, "sendEvent:", id, ev);
   return 0;
 }
+FENSTER_API int fenster_wait(struct fenster *f, int timeout) {
+  (void)f;
+  id until = timeout < 0 ? msg(id, cls("NSDate"), "distantFuture")
+                         : msg1(id, cls("NSDate"),
+                                "dateWithTimeIntervalSinceNow:", double,
+                                timeout / 1000.0);
+  id ev = msg4(id, NSApp,
+               "nextEventMatchingMask:untilDate:inMode:dequeue:", NSUInteger,
+               NSUIntegerMax, id, until, id, NSDefaultRunLoopMode, BOOL, NO);
+  return ev != NULL;
+}
 #elif defined(_WIN32)
 // clang-format off
 static const uint8_t FENSTER_KEYCODES[] = {0,27,49,50,51,52,53,54,55,56,57,48,45,61,8,9,81,87,69,82,84,89,85,73,79,80,91,93,10,0,65,83,68,70,71,72,74,75,76,59,39,96,0,92,90,88,67,86,66,78,77,44,46,47,0,0,0,32,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,17,3,0,20,0,19,0,5,18,4,26,127};
@@ -174,6 +271,9 @@ typedef struct BINFO {
 static LRESULT CALLBACK fenster_wndproc(HWND hwnd, UINT msg, WPARAM wParam,
                                         LPARAM lParam) {
   struct fenster *f = (struct fenster *)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+  /* message times are milliseconds on the (wrapping) GetTickCount clock */
+  int64_t t =
+      fenster_time() - (DWORD)(GetTickCount() - (DWORD)GetMessageTime());
   switch (msg) {
     case WM_PAINT: {
       PAINTSTRUCT ps;
@@ -198,18 +298,22 @@ static LRESULT CALLBACK fenster_wndproc(HWND hwnd, UINT msg, WPARAM wParam,
       break;
     case WM_LBUTTONDOWN:
     case WM_LBUTTONUP:
-      f->mouse = (msg == WM_LBUTTONDOWN);
+      fenster_setmouse(f, msg == WM_LBUTTONDOWN, t);
       break;
     case WM_MOUSEMOVE:
-      f->y = HIWORD(lParam), f->x = LOWORD(lParam);
+      fenster_setpos(f, LOWORD(lParam), HIWORD(lParam), t);
       break;
     case WM_KEYDOWN:
     case WM_KEYUP: {
-      f->mod = ((GetKeyState(VK_CONTROL) & 0x8000) >> 15) |
-               ((GetKeyState(VK_SHIFT) & 0x8000) >> 14) |
-               ((GetKeyState(VK_MENU) & 0x8000) >> 13) |
-               (((GetKeyState(VK_LWIN) | GetKeyState(VK_RWIN)) & 0x8000) >> 12);
-      f->keys[FENSTER_KEYCODES[HIWORD(lParam) & 0x1ff]] = !((lParam >> 31) & 1);
+      fenster_setmod(
+          f, ((GetKeyState(VK_CONTROL) & 0x8000) >> 15) |
+                 ((GetKeyState(VK_SHIFT) & 0x8000) >> 14) |
+                 ((GetKeyState(VK_MENU) & 0x8000) >> 13) |
+                 (((GetKeyState(VK_LWIN) | GetKeyState(VK_RWIN)) & 0x8000) >>
+                  12),
+          t);
+      fenster_setkey(f, FENSTER_KEYCODES[HIWORD(lParam) & 0x1ff],
+                     !((lParam >> 31) & 1), t);
     } break;
     case WM_DESTROY:
       PostQuitMessage(0);
@@ -221,6 +325,7 @@ static LRESULT CALLBACK fenster_wndproc(HWND hwnd, UINT msg, WPARAM wParam,
 }
 
 FENSTER_API int fenster_open(struct fenster *f) {
+  if (fenster_alloc_buf(f) != 0) return -1;
   HINSTANCE hInstance = GetModuleHandle(NULL);
   WNDCLASSEX wc = {0};
   wc.cbSize = sizeof(WNDCLASSEX);
@@ -233,32 +338,158 @@ FENSTER_API int fenster_open(struct fenster *f) {
                            WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT,
                            f->width, f->height, NULL, NULL, hInstance, NULL);
 
-  if (f->hwnd == NULL) return -1;
+  if (f->hwnd == NULL) {
+    fenster_free_buf(f);
+    return -1;
+  }
   SetWindowLongPtr(f->hwnd, GWLP_USERDATA, (LONG_PTR)f);
   ShowWindow(f->hwnd, SW_NORMAL);
   UpdateWindow(f->hwnd);
   return 0;
 }
 
-FENSTER_API void fenster_close(struct fenster *f) { (void)f; }
+FENSTER_API void fenster_close(struct fenster *f) { fenster_free_buf(f); }
 
-FENSTER_API int fenster_loop(struct fenster *f) {
+FENSTER_API void fenster_present(struct fenster *f, int x, int y, int w,
+                                 int h) {
+  RECT r = {x, y, x + w, y + h};
+  InvalidateRect(f->hwnd, &r, TRUE);
+}
+
+FENSTER_API int fenster_events(struct fenster *f) {
+  (void)f;
   MSG msg;
   while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
     if (msg.message == WM_QUIT) return -1;
     TranslateMessage(&msg);
     DispatchMessage(&msg);
   }
-  InvalidateRect(f->hwnd, NULL, TRUE);
   return 0;
 }
+FENSTER_API int fenster_wait(struct fenster *f, int timeout) {
+  (void)f;
+  DWORD ms = timeout < 0 ? INFINITE : (DWORD)timeout;
+  return MsgWaitForMultipleObjects(0, NULL, FALSE, ms, QS_ALLINPUT) ==
+         WAIT_OBJECT_0;
+}
 #else
 // clang-format off
 static int FENSTER_KEYCODES[124] = {XK_BackSpace,8,XK_Delete,127,XK_Down,18,XK_End,5,XK_Escape,27,XK_Home,2,XK_Insert,26,XK_Left,20,XK_Page_Down,4,XK_Page_Up,3,XK_Return,10,XK_Right,19,XK_Tab,9,XK_Up,17,XK_apostrophe,39,XK_backslash,92,XK_bracketleft,91,XK_bracketright,93,XK_comma,44,XK_equal,61,XK_grave,96,XK_minus,45,XK_period,46,XK_semicolon,59,XK_slash,47,XK_space,32,XK_a,65,XK_b,66,XK_c,67,XK_d,68,XK_e,69,XK_f,70,XK_g,71,XK_h,72,XK_i,73,XK_j,74,XK_k,75,XK_l,76,XK_m,77,XK_n,78,XK_o,79,XK_p,80,XK_q,81,XK_r,82,XK_s,83,XK_t,84,XK_u,85,XK_v,86,XK_w,87,XK_x,88,XK_y,89,XK_z,90,XK_0,48,XK_1,49,XK_2,50,XK_3,51,XK_4,52,XK_5,53,XK_6,54,XK_7,55,XK_8,56,XK_9,57};
 // clang-format on
+/* all fensters share one connection to the X server, events are dispatched to
+ * the fenster of their window, so fenster_events and fenster_wait have to be
+ * called from one thread for all fensters (fenster_open and fenster_close may
+ * be called from any thread, and async fensters are presented and flushed by
+ * their own thread) */
+static Display *fenster_dpy;
+static int fenster_dpy_refs;
+static XContext fenster_context; /* maps a window to its fenster */
+static pthread_mutex_t fenster_dpy_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* a server time and the fenster_time it matches, to convert event times */
+static Time fenster_xtime_base;
+static int64_t fenster_xtime_local;
+static int fenster_xtime_known;
+
+static Display *fenster_open_display(void) {
+  pthread_mutex_lock(&fenster_dpy_mutex);
+  if (fenster_dpy_refs == 0) {
+    fenster_dpy = XOpenDisplay(NULL);
+    if (fenster_dpy) {
+      fenster_context = XUniqueContext();
+      fenster_xtime_known = 0;
+      /* held keys only repeat KeyPress instead of KeyRelease/KeyPress pairs */
+      XkbSetDetectableAutoRepeat(fenster_dpy, True, NULL);
+    }
+  }
+  Display *dpy = fenster_dpy;
+  if (dpy) fenster_dpy_refs++;
+  pthread_mutex_unlock(&fenster_dpy_mutex);
+  return dpy;
+}
+
+/* converts a server time (milliseconds, wrapping at 32 bits) to the
+ * fenster_time clock, assuming the least delayed event arrived right away */
+static int64_t fenster_xtime(Time xtime) {
+  int64_t now = fenster_time();
+  if (xtime == CurrentTime) return now; /* e.g. sent by another client */
+  int64_t t = fenster_xtime_local +
+              (int32_t)((uint32_t)xtime - (uint32_t)fenster_xtime_base);
+  if (!fenster_xtime_known || t > now) {
+    t = now;
+  }
+  /* move the base along, so the difference never wraps */
+  fenster_xtime_base = xtime, fenster_xtime_local = t;
+  fenster_xtime_known = 1;
+  return t;
+}
+
+static void fenster_close_display(void) {
+  pthread_mutex_lock(&fenster_dpy_mutex);
+  if (--fenster_dpy_refs == 0) {
+    XCloseDisplay(fenster_dpy);
+    fenster_dpy = NULL;
+  }
+  pthread_mutex_unlock(&fenster_dpy_mutex);
+}
+
+static int fenster_shm_failed;
+static int fenster_shm_error(Display *dpy, XErrorEvent *ev) {
+  (void)dpy, (void)ev;
+  fenster_shm_failed = 1;
+  return 0;
+}
+
+/* try to put the buffer into a shared memory segment the X server can read
+ * directly, this fails on remote displays or when MIT-SHM is missing */
+static int fenster_shm_open(struct fenster *f, Visual *vis) {
+  if (f->buf || !XShmQueryExtension(f->dpy)) return -1;
+  f->img = XShmCreateImage(f->dpy, vis, 24, ZPixmap, NULL, &f->shminfo,
+                           f->width, f->height);
+  if (!f->img) return -1;
+  if (f->img->bytes_per_line != f->width * 4) goto fail_img;
+  f->shminfo.shmid = shmget(IPC_PRIVATE, (size_t)f->width * f->height * 4,
+                            IPC_CREAT | 0600);
+  if (f->shminfo.shmid < 0) goto fail_img;
+  f->shminfo.shmaddr = f->img->data = shmat(f->shminfo.shmid, NULL, 0);
+  if (f->shminfo.shmaddr == (char *)-1) {
+    shmctl(f->shminfo.shmid, IPC_RMID, NULL);
+    goto fail_img;
+  }
+  f->shminfo.readOnly = False;
+  fenster_shm_failed = 0;
+  XErrorHandler handler = XSetErrorHandler(fenster_shm_error);
+  XShmAttach(f->dpy, &f->shminfo);
+  XSync(f->dpy, False);
+  XSetErrorHandler(handler);
+  /* the segment is destroyed as soon as both sides have detached */
+  shmctl(f->shminfo.shmid, IPC_RMID, NULL);
+  if (fenster_shm_failed) {
+    shmdt(f->shminfo.shmaddr);
+    goto fail_img;
+  }
+  f->buf = (uint32_t *)f->shminfo.shmaddr;
+  f->shm = 1;
+  return 0;
+fail_img:
+  f->img->data = NULL;
+  XDestroyImage(f->img);
+  f->img = NULL;
+  return -1;
+}
+
 FENSTER_API int fenster_open(struct fenster *f) {
-  f->dpy = XOpenDisplay(NULL);
+  f->dpy = fenster_open_display();
+  if (!f->dpy) return -1;
   int screen = DefaultScreen(f->dpy);
+  Visual *vis = DefaultVisual(f->dpy, screen);
+  if (fenster_shm_open(f, vis) != 0) {
+    if (fenster_alloc_buf(f) != 0) {
+      fenster_close_display();
+      return -1;
+    }
+    f->img = XCreateImage(f->dpy, vis, 24, ZPixmap, 0, (char *)f->buf,
+                          f->width, f->height, 32, 0);
+  }
   f->w = XCreateSimpleWindow(f->dpy, RootWindow(f->dpy, screen), 0, 0, f->width,
                              f->height, 0, BlackPixel(f->dpy, screen),
                              WhitePixel(f->dpy, screen));
@@ -266,54 +497,129 @@ FENSTER_API int fenster_open(struct fenster *f) {
   XSelectInput(f->dpy, f->w,
                ExposureMask | KeyPressMask | KeyReleaseMask | ButtonPressMask |
                    ButtonReleaseMask | PointerMotionMask);
+  XSaveContext(f->dpy, f->w, fenster_context, (XPointer)f);
   XStoreName(f->dpy, f->w, f->title);
   XMapWindow(f->dpy, f->w);
-  XSync(f->dpy, f->w);
-  f->img = XCreateImage(f->dpy, DefaultVisual(f->dpy, 0), 24, ZPixmap, 0,
-                        (char *)f->buf, f->width, f->height, 32, 0);
+  XSync(f->dpy, False);
   return 0;
 }
-FENSTER_API void fenster_close(struct fenster *f) { XCloseDisplay(f->dpy); }
-FENSTER_API int fenster_loop(struct fenster *f) {
-  XEvent ev;
-  XPutImage(f->dpy, f->w, f->gc, f->img, 0, 0, 0, 0, f->width, f->height);
+FENSTER_API void fenster_close(struct fenster *f) {
+  if (f->shm) {
+    XShmDetach(f->dpy, &f->shminfo);
+    XSync(f->dpy, False);
+    shmdt(f->shminfo.shmaddr);
+    f->buf = NULL;
+    f->shm = 0;
+  }
+  f->img->data = NULL; /* the buffer is not owned by the image */
+  XDestroyImage(f->img);
+  f->img = NULL;
+  XDeleteContext(f->dpy, f->w, fenster_context);
+  XFreeGC(f->dpy, f->gc);
+  XDestroyWindow(f->dpy, f->w);
   XFlush(f->dpy);
+  fenster_close_display();
+  f->dpy = NULL;
+  fenster_free_buf(f);
+}
+FENSTER_API void fenster_present(struct fenster *f, int x, int y, int w,
+                                 int h) {
+  if (f->shm) {
+    XShmPutImage(f->dpy, f->w, f->gc, f->img, x, y, x, y, w, h, False);
+    f->shmbusy = 1;
+  } else {
+    XPutImage(f->dpy, f->w, f->gc, f->img, x, y, x, y, w, h);
+  }
+}
+static void fenster_flush(struct fenster *f) {
+  if (f->shmbusy) {
+    /* wait until the server has read the segment before it is drawn again */
+    XSync(f->dpy, False);
+    f->shmbusy = 0;
+  } else {
+    XFlush(f->dpy);
+  }
+}
+/* processes the pending events of all fensters, not just of f */
+FENSTER_API int fenster_events(struct fenster *f) {
+  XEvent ev;
+  if (!f->async) fenster_flush(f);
+  struct fenster *target = f;
+  XPointer data;
   while (XPending(f->dpy)) {
     XNextEvent(f->dpy, &ev);
+    if (ev.xany.window != target->w) {
+      /* events of closed windows might still be queued */
+      if (XFindContext(f->dpy, ev.xany.window, fenster_context, &data) != 0)
+        continue;
+      target = (struct fenster *)data;
+    }
     switch (ev.type) {
+      case Expose: /* redraw the uncovered area from the last frame */
+        if (target->async) {
+          target->exposed = 1;
+        } else {
+          fenster_present(target, ev.xexpose.x, ev.xexpose.y,
+                          ev.xexpose.width, ev.xexpose.height);
+          /* only f is synced below, but the segment of target might be
+           * drawn into before target processes events again */
+          if (target != f) fenster_flush(target);
+        }
+        break;
       case ButtonPress:
       case ButtonRelease:
-        f->mouse = (ev.type == ButtonPress);
+        fenster_setmouse(target, ev.type == ButtonPress,
+                         fenster_xtime(ev.xbutton.time));
         break;
       case MotionNotify:
-        f->x = ev.xmotion.x, f->y = ev.xmotion.y;
+        fenster_setpos(target, ev.xmotion.x, ev.xmotion.y,
+                       fenster_xtime(ev.xmotion.time));
         break;
       case KeyPress:
       case KeyRelease: {
         int m = ev.xkey.state;
         int k = XkbKeycodeToKeysym(f->dpy, ev.xkey.keycode, 0, 0);
+        int64_t t = fenster_xtime(ev.xkey.time);
+        fenster_setmod(target,
+                       (!!(m & ControlMask)) | (!!(m & ShiftMask) << 1) |
+                           (!!(m & Mod1Mask) << 2) | (!!(m & Mod4Mask) << 3),
+                       t);
         for (unsigned int i = 0; i < 124; i += 2) {
           if (FENSTER_KEYCODES[i] == k) {
-            f->keys[FENSTER_KEYCODES[i + 1]] = (ev.type == KeyPress);
+            fenster_setkey(target, FENSTER_KEYCODES[i + 1],
+                           ev.type == KeyPress, t);
             break;
           }
         }
-        f->mod = (!!(m & ControlMask)) | (!!(m & ShiftMask) << 1) |
-                 (!!(m & Mod1Mask) << 2) | (!!(m & Mod4Mask) << 3);
       } break;
     }
   }
+  if (!f->async) fenster_flush(f);
   return 0;
 }
+FENSTER_API int fenster_wait(struct fenster *f, int timeout) {
+  /* events might already be queued by Xlib, so the socket could stay silent */
+  if (!f->async) fenster_flush(f);
+  if (XPending(f->dpy)) return 1;
+  struct pollfd pfd = {ConnectionNumber(f->dpy), POLLIN, 0};
+  return poll(&pfd, 1, timeout) > 0;
+}
 #endif
 
+FENSTER_API int fenster_loop(struct fenster *f) {
+  fenster_present(f, 0, 0, f->width, f->height);
+  return fenster_events(f);
+}
+
 #ifdef _WIN32
 FENSTER_API void fenster_sleep(int64_t ms) { Sleep(ms); }
-FENSTER_API int64_t fenster_time() {
+FENSTER_API int64_t fenster_time_ns(void) {
   LARGE_INTEGER freq, count;
   QueryPerformanceFrequency(&freq);
   QueryPerformanceCounter(&count);
-  return (int64_t)(count.QuadPart * 1000.0 / freq.QuadPart);
+  /* split the conversion, count * 1e9 overflows after a few hours */
+  return count.QuadPart / freq.QuadPart * 1000000000 +
+         count.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart;
 }
 #else
 FENSTER_API void fenster_sleep(int64_t ms) {
@@ -322,12 +628,13 @@ FENSTER_API void fenster_sleep(int64_t ms) {
   ts.tv_nsec = (ms % 1000) * 1000000;
   nanosleep(&ts, NULL);
 }
-FENSTER_API int64_t fenster_time(void) {
+FENSTER_API int64_t fenster_time_ns(void) {
   struct timespec time;
   clock_gettime(CLOCK_MONOTONIC, &time);
-  return time.tv_sec * 1000 + (time.tv_nsec / 1000000);
+  return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
 }
 #endif
+FENSTER_API int64_t fenster_time(void) { return fenster_time_ns() / 1000000; }
 
 #ifdef __cplusplus
 class Fenster {
@@ -0,0 +1,72 @@
+--- Golden image helper for the specs. Compares what a window or surface shows
+--- against a PPM image in spec/golden, so the specs can check rendered output
+--- bit by bit, in headless mode as well as under Xvfb.
+--- Usage:
+---   local golden = dofile('spec/golden.lua')
+---   golden.check(window, 'shapes')
+--- Run the specs with FENSTER_UPDATE_GOLDEN=1 to create missing golden images
+--- or to replace them after an intended change of the rendering.
+
+local fenster = require('fenster')
+
+local M = {}
+
+--- Directory of the golden images
+M.directory = 'spec/golden'
+
+--- Whether the golden images are written instead of compared
+M.update = (os.getenv('FENSTER_UPDATE_GOLDEN') or '0'):match('^0?$') == nil
+
+--- Compare a window or surface against a golden image. On a mismatch, the
+--- actual image and a diff image (differing pixels in red) are saved next to
+--- the golden image as <name>.actual.ppm and <name>.diff.ppm, and an error
+--- describing the difference is thrown.
+--- @param canvas userdata The window or surface
+--- @param name string The name of the golden image, without extension
+function M.check(canvas, name)
+	local path = ('%s/%s.ppm'):format(M.directory, name)
+	if M.update then
+		assert(canvas:save(path))
+		return
+	end
+
+	local expected, message = fenster.loadimage(path)
+	if expected == nil then
+		error(('%s (run with FENSTER_UPDATE_GOLDEN=1 to create it)'):format(message), 2)
+	end
+	if expected.width ~= canvas.width or expected.height ~= canvas.height then
+		error(
+			('golden image %s is %dx%d, but the image is %dx%d'):format(
+				path,
+				expected.width,
+				expected.height,
+				canvas.width,
+				canvas.height
+			),
+			2
+		)
+	end
+
+	local count, box, image = fenster.diff(canvas, expected, true)
+	if count > 0 then
+		local actual_path = ('%s/%s.actual.ppm'):format(M.directory, name)
+		local diff_path = ('%s/%s.diff.ppm'):format(M.directory, name)
+		canvas:save(actual_path)
+		image:save(diff_path)
+		error(
+			('%d pixels differ from golden image %s within %dx%d at %d,%d (see %s and %s)'):format(
+				count,
+				path,
+				box.width,
+				box.height,
+				box.x,
+				box.y,
+				actual_path,
+				diff_path
+			),
+			2
+		)
+	end
+end
+
+return M
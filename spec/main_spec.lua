@@ -86,9 +86,18 @@ describe('fenster', function()
 			assert.has_error(function() fenster.open(256, 144, 'Test', 2.5) end)
 		end)
 
-		it('should throw when scale is not a power of 2', function()
+		it('should throw when scale is out of range', function()
 			assert.has_error(function() fenster.open(256, 144, 'Test', -4) end)
-			assert.has_error(function() fenster.open(256, 144, 'Test', 3) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 0) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 30000) end)
+		end)
+
+		it('should allow scales that are not a power of 2', function()
+			local window = fenster.open(256, 144, 'Test', 3, 60, { headless = true })
+			finally(function() window:close() end)
+			assert.are_equal(window.scale, 3)
+			window:set(255, 143, 0xbeef99)
+			assert.are_equal(window:get(255, 143), 0xbeef99)
 		end)
 
 		it('should set the scale #needsdisplay', function()
@@ -130,6 +139,118 @@ describe('fenster', function()
 			assert.are_equal(window.targetfps, 30.0)
 			assert.are_equal(window2.targetfps, 0.0)
 		end)
+
+		it('should throw when options is not a table', function()
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, 'ERROR') end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, true) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, 25) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, function() end) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, io.stdout) end)
+		end)
+
+		it('should throw when headless option is not a boolean', function()
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = 'ERROR' }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = 1 }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = {} }) end)
+		end)
+
+		it('should throw when catchup option is not a boolean', function()
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, catchup = 'ERROR' }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, catchup = 1 }) end)
+		end)
+
+		it('should throw when buffer options are invalid', function()
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, buffers = 'ERROR' }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, buffers = 4 }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, buffers = -1 }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, preserve = 1 }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, dropframes = 1 }) end)
+		end)
+
+		it('should keep the buffer contents when presenting asynchronously', function()
+			local window = fenster.open(256, 144, 'Test', 2, 0, { headless = true, buffers = 3 })
+			finally(function() window:close() end)
+			window:set(10, 10, 0xff0000)
+			for _ = 1, 5 do
+				assert.is_true(window:loop())
+				assert.are_equal(window:get(10, 10), 0xff0000)
+			end
+			window:set(11, 10, 0x00ff00)
+			window:loop()
+			assert.are_equal(window.damage, 1)
+			assert.are_equal(window:get(11, 10), 0x00ff00)
+		end)
+
+		it('should swap the buffers without preserving when presenting asynchronously', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true, buffers = 2, preserve = false })
+			finally(function() window:close() end)
+			window:set(10, 10, 0xff0000)
+			window:loop()
+			assert.are_equal(window:get(10, 10), 0)
+			window:set(11, 10, 0x00ff00)
+			window:loop()
+			assert.are_equal(window:get(10, 10), 0xff0000)
+		end)
+
+		it('should not hand off frames when nothing changed when presenting asynchronously', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true, buffers = 2, preserve = false })
+			finally(function() window:close() end)
+			window:loop()
+			window:set(10, 10, 0xff0000)
+			window:loop()
+			assert.are_equal(window:get(10, 10), 0)
+			-- idle frames keep drawing into the same buffer
+			for _ = 1, 3 do
+				window:loop()
+				assert.are_equal(window.damage, 0)
+				assert.are_equal(window:get(10, 10), 0)
+			end
+			window:wait(0)
+			assert.are_equal(window:get(10, 10), 0)
+			window:set(11, 10, 0x00ff00)
+			window:loop()
+			assert.are_equal(window:get(10, 10), 0xff0000)
+		end)
+
+		it('should drop frames instead of waiting when presenting asynchronously', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true, buffers = 2, dropframes = true })
+			finally(function() window:close() end)
+			for i = 1, 10 do
+				window:set(i, 0, 0x123456)
+				assert.is_true(window:loop())
+			end
+			-- the latest frame is never dropped, and what dropped frames drew is kept
+			local stats = window:stats()
+			assert.are_equal(stats.frames, 10)
+			assert.is_true(stats.dropped <= 9)
+			assert.are_equal(stats.bytes, 0)
+			for i = 1, 10 do
+				assert.are_equal(window:get(i, 0), 0x123456)
+			end
+		end)
+
+		it('should not drop frames when waiting for the present thread', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true, buffers = 2 })
+			finally(function() window:close() end)
+			for i = 1, 10 do
+				window:set(i, 0, 0x123456)
+				assert.is_true(window:loop())
+			end
+			local stats = window:stats()
+			assert.are_equal(stats.frames, 10)
+			assert.are_equal(stats.dropped, 0)
+		end)
+
+		it('should open a headless window', function()
+			local window = fenster.open(256, 144, 'Test', 2, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.is_userdata(window)
+			assert.is_true(window.headless)
+			assert.is_false(window.shm)
+			assert.is_true(window:loop())
+			window:set(255, 143, 0xbeef99)
+			assert.are_equal(window:get(255, 143), 0xbeef99)
+		end)
 	end)
 
 	describe('fenster.sleep(...)', function()
@@ -161,6 +282,62 @@ describe('fenster', function()
 		end)
 	end)
 
+	describe('fenster.timens(...)', function()
+		it('should return a monotonic time in nanoseconds', function()
+			local start = fenster.timens()
+			assert.is_number(start)
+			fenster.sleep(2)
+			assert.is_true(fenster.timens() - start >= 2 * 1000000)
+		end)
+	end)
+
+	describe('fenster.setthreads(...)', function()
+		after_each(function()
+			fenster.setthreads(1)
+		end)
+
+		it('should throw when count is invalid', function()
+			assert.has_error(function() fenster.setthreads('ERROR') end)
+			assert.has_error(function() fenster.setthreads(2.5) end)
+			assert.has_error(function() fenster.setthreads(0) end)
+			assert.has_error(function() fenster.setthreads(65) end)
+		end)
+
+		it('should return the number of threads', function()
+			assert.are_equal(fenster.setthreads(3), 3)
+			assert.are_equal(fenster.setthreads(1), 1)
+			assert.is_true(fenster.setthreads() >= 1)
+		end)
+
+		it('should produce the same pixels with several threads', function()
+			local src = fenster.surface(1024, 1024)
+			src:clear(0x123456)
+			src:fillrect(100, 200, 800, 600, 0xabcdef)
+
+			fenster.setthreads(4)
+			local multi = fenster.surface(1024, 1024)
+			multi:clear(0xff0000)
+			src:blit(multi, 3, 5)
+			multi:fillrect(0, 500, 1024, 400, 0x00ff00)
+
+			fenster.setthreads(1)
+			local single = fenster.surface(1024, 1024)
+			single:clear(0xff0000)
+			src:blit(single, 3, 5)
+			single:fillrect(0, 500, 1024, 400, 0x00ff00)
+
+			for y = 0, 1023, 7 do
+				for x = 0, 1023, 5 do
+					assert.are_equal(multi:get(x, y), single:get(x, y))
+				end
+			end
+			assert.are_equal(multi:get(0, 0), 0xff0000)
+			assert.are_equal(multi:get(3, 5), 0x123456)
+			assert.are_equal(multi:get(103, 205), 0xabcdef)
+			assert.are_equal(multi:get(1023, 899), 0x00ff00)
+		end)
+	end)
+
 	describe('fenster.rgb(...)', function()
 		it('should throw when no arguments were given', function()
 			assert.has_error(function() fenster.rgb() end)
@@ -239,6 +416,233 @@ describe('fenster', function()
 		end)
 	end)
 
+	describe('fenster.rgba(...)', function()
+		it('should throw when arguments are invalid', function()
+			assert.has_error(function() fenster.rgba() end)
+			assert.has_error(function() fenster.rgba(-1) end)
+			assert.has_error(function() fenster.rgba(0x100000000) end)
+			assert.has_error(function() fenster.rgba(0, 0, 0, 256) end)
+			assert.has_error(function() fenster.rgba(0, 0, 0, 2.5) end)
+		end)
+
+		it('should convert between a color and r/g/b/a', function()
+			assert.are_same({ fenster.rgba(0x80beef99) }, { 190, 239, 153, 128 })
+			assert.are_same({ fenster.rgba(0xbeef99) }, { 190, 239, 153, 0 })
+			assert.are_equal(fenster.rgba(190, 239, 153, 128), 0x80beef99)
+			assert.are_equal(fenster.rgba(255, 255, 255, 255), 0xffffffff)
+		end)
+	end)
+
+	describe('fenster.surface(...)', function()
+		it('should throw when width/height are not integers or out of range', function()
+			assert.has_error(function() fenster.surface() end)
+			assert.has_error(function() fenster.surface(16) end)
+			assert.has_error(function() fenster.surface('ERROR', 16) end)
+			assert.has_error(function() fenster.surface(16, 2.5) end)
+			assert.has_error(function() fenster.surface(0, 16) end)
+			assert.has_error(function() fenster.surface(16, 30000) end)
+		end)
+
+		it('should return a black surface userdata', function()
+			local surface = fenster.surface(16, 8)
+			assert.is_userdata(surface)
+			assert.are_equal(surface.width, 16)
+			assert.are_equal(surface.height, 8)
+			assert.are_equal(surface:get(0, 0), 0x000000)
+			assert.are_equal(surface:get(15, 7), 0x000000)
+		end)
+	end)
+
+	describe('fenster.loadimage(...)', function()
+		---Write the given contents to a temporary file and return its path
+		---@param contents string
+		---@return string
+		local function write_temp_file(contents)
+			local path = os.tmpname()
+			local file = assert(io.open(path, 'wb'))
+			file:write(contents)
+			file:close()
+			return path
+		end
+
+		---Encode an integer as 4 little-endian bytes
+		---@param n integer
+		---@return string
+		local function u32le(n)
+			return string.char(
+				n % 256,
+				math.floor(n / 0x100) % 256,
+				math.floor(n / 0x10000) % 256,
+				math.floor(n / 0x1000000) % 256
+			)
+		end
+
+		it('should throw when path is not a string', function()
+			assert.has_error(function() fenster.loadimage() end)
+			assert.has_error(function() fenster.loadimage({}) end)
+		end)
+
+		it('should return nil and an error message for missing files', function()
+			local image, err = fenster.loadimage('/this/file/does/not/exist.ppm')
+			assert.is_nil(image)
+			assert.is_string(err)
+		end)
+
+		it('should return nil and an error message for invalid images', function()
+			local paths = {
+				write_temp_file('not an image'),
+				write_temp_file('P6\n2 2\n255\n\0\0\0'),
+				write_temp_file('P3\n1 1\n255\n256 0 0\n'),
+				write_temp_file('P6\n0 1\n255\n'),
+				write_temp_file('qoif\0\0\0\1'),
+				write_temp_file('BM'),
+			}
+			finally(function()
+				for _, path in ipairs(paths) do os.remove(path) end
+			end)
+
+			for _, path in ipairs(paths) do
+				local image, err = fenster.loadimage(path)
+				assert.is_nil(image)
+				assert.is_string(err)
+			end
+		end)
+
+		it('should reject huge images before allocating when the file is too short', function()
+			local paths = {
+				write_temp_file('P6\n15360 15360\n255\n\0\0\0'),
+				write_temp_file('P3\n15360 15360\n255\n0 0 0\n'),
+				write_temp_file('qoif\0\0\60\0\0\0\60\0\3\0\254\0\0\0' .. ('\0'):rep(7) .. '\1'),
+				write_temp_file('BM' .. u32le(54 + 4) .. u32le(0) .. u32le(54)
+					.. u32le(40) .. u32le(15360) .. u32le(15360) .. '\1\0\24\0' .. u32le(0) .. u32le(4)
+					.. u32le(0) .. u32le(0) .. u32le(0) .. u32le(0) .. '\0\0\0\0'),
+			}
+			collectgarbage('stop')
+			finally(function()
+				collectgarbage('restart')
+				for _, path in ipairs(paths) do os.remove(path) end
+			end)
+
+			for _, path in ipairs(paths) do
+				local before = collectgarbage('count')
+				local image, err = fenster.loadimage(path)
+				assert.is_nil(image)
+				assert.is_true(err:find('unexpected end of file while reading pixel data', 1, true) ~= nil)
+				assert.is_true(collectgarbage('count') - before < 1024)
+			end
+		end)
+
+		it('should load PPM images', function()
+			local p6 = write_temp_file('P6\n# comment\n2 1\n255\n\255\0\0\1\2\3')
+			local p3 = write_temp_file('P3\n2 1\n15\n15 0 0 0 15 0\n')
+			finally(function()
+				os.remove(p6)
+				os.remove(p3)
+			end)
+
+			local image = assert(fenster.loadimage(p6))
+			assert.are_equal(image.width, 2)
+			assert.are_equal(image.height, 1)
+			assert.are_equal(image:get(0, 0), 0xff0000)
+			assert.are_equal(image:get(1, 0), 0x010203)
+
+			image = assert(fenster.loadimage(p3))
+			assert.are_equal(image:get(0, 0), 0xff0000)
+			assert.are_equal(image:get(1, 0), 0x00ff00)
+		end)
+
+		it('should load QOI images', function()
+			local path = write_temp_file(
+				'qoif\0\0\0\3\0\0\0\1\3\0'
+					.. '\254\255\0\0' -- QOI_OP_RGB
+					.. '\193' -- QOI_OP_RUN (2 pixels)
+					.. '\0\0\0\0\0\0\0\1'
+			)
+			finally(function() os.remove(path) end)
+
+			local image = assert(fenster.loadimage(path))
+			assert.are_equal(image.width, 3)
+			assert.are_equal(image.height, 1)
+			assert.are_equal(image:get(0, 0), 0xff0000)
+			assert.are_equal(image:get(2, 0), 0xff0000)
+		end)
+
+		it('should load BMP images', function()
+			local path = write_temp_file(
+				'BM' .. u32le(70) .. u32le(0) .. u32le(54)
+					.. u32le(40) .. u32le(2) .. u32le(2) .. '\1\0\24\0' .. u32le(0)
+					.. u32le(16) .. u32le(0) .. u32le(0) .. u32le(0) .. u32le(0)
+					-- rows are stored bottom to top as blue, green and red bytes
+					.. '\255\0\0\0\255\0\0\0'
+					.. '\0\0\255\1\2\3\0\0'
+			)
+			finally(function() os.remove(path) end)
+
+			local image = assert(fenster.loadimage(path))
+			assert.are_equal(image.width, 2)
+			assert.are_equal(image.height, 2)
+			assert.are_equal(image:get(0, 0), 0xff0000)
+			assert.are_equal(image:get(1, 0), 0x030201)
+			assert.are_equal(image:get(0, 1), 0x0000ff)
+			assert.are_equal(image:get(1, 1), 0x00ff00)
+		end)
+
+		it('should keep the alpha of RGBA images for blending', function()
+			local qoi = write_temp_file(
+				'qoif\0\0\0\2\0\0\0\1\4\0'
+					.. '\255\255\0\0\255' -- QOI_OP_RGBA, opaque red
+					.. '\255\0\0\255\128' -- QOI_OP_RGBA, half transparent blue
+					.. '\0\0\0\0\0\0\0\1'
+			)
+			local bmp = write_temp_file(
+				'BM' .. u32le(78) .. u32le(0) .. u32le(70)
+					.. u32le(56) .. u32le(2) .. u32le(1) .. '\1\0\32\0' .. u32le(3)
+					.. u32le(8) .. u32le(0) .. u32le(0) .. u32le(0) .. u32le(0)
+					.. u32le(0xff0000) .. u32le(0xff00) .. u32le(0xff) .. u32le(0xff000000)
+					-- blue, green, red and alpha bytes
+					.. '\0\0\255\255\255\0\0\128'
+			)
+			finally(function()
+				os.remove(qoi)
+				os.remove(bmp)
+			end)
+
+			for _, path in ipairs({ qoi, bmp }) do
+				local image = assert(fenster.loadimage(path))
+				assert.are_equal(image:get(0, 0), 0xffff0000)
+				assert.are_equal(image:get(1, 0), 0x800000ff)
+
+				local dst = fenster.surface(2, 1)
+				dst:clear(0xff00ff00)
+				dst:setblend('alpha')
+				image:blit(dst, 0, 0)
+				assert.are_equal(dst:get(0, 0), 0xffff0000)
+				assert.are_equal(dst:get(1, 0), 0xff007f80)
+			end
+		end)
+	end)
+
+	describe('fenster.font(...)', function()
+		it('should throw when arguments are invalid', function()
+			assert.has_error(function() fenster.font() end)
+			assert.has_error(function() fenster.font({}, 8, 1) end)
+			assert.has_error(function() fenster.font('', 8, 1) end)
+			assert.has_error(function() fenster.font('abc', 8, 2) end)
+			assert.has_error(function() fenster.font('a', 0, 1) end)
+			assert.has_error(function() fenster.font('abcde', 33, 1) end)
+			assert.has_error(function() fenster.font('a', 8, 0) end)
+			assert.has_error(function() fenster.font('a', 8, 1, 256) end)
+			assert.has_error(function() fenster.font('ab', 8, 1, 255) end)
+		end)
+
+		it('should return a font userdata', function()
+			local font = fenster.font(string.rep('\0', 16 * 2), 8, 16)
+			assert.is_userdata(font)
+			assert.are_equal(font.width, 8)
+			assert.are_equal(font.height, 16)
+		end)
+	end)
+
 	describe('window:close(...) / fenster.close(...)', function()
 		it('should throw when no arguments were given when not using as method', function()
 			assert.has_error(function() fenster.close() end)
@@ -262,6 +666,7 @@ describe('fenster', function()
 			assert.has_error(function() fenster.set(window, 0, 0, 0xffffff) end)
 			assert.has_error(function() fenster.get(window, 0, 0) end)
 			assert.has_error(function() fenster.clear(window) end)
+			assert.has_error(function() fenster.setregion(window, 0, 0, 1, 1, { 0 }) end)
 
 			local window2 = fenster.open(256, 144)
 			window2:close()
@@ -270,6 +675,7 @@ describe('fenster', function()
 			assert.has_error(function() window2:set(0, 0, 0xffffff) end)
 			assert.has_error(function() window2:get(0, 0) end)
 			assert.has_error(function() window2:clear() end)
+			assert.has_error(function() window2:setregion(0, 0, 1, 1, { 0 }) end)
 		end)
 	end)
 
@@ -300,6 +706,420 @@ describe('fenster', function()
 		end)
 	end)
 
+	describe('fenster.loopall(...)', function()
+		it('should throw when windows is not a non-empty table of open windows', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			local closed = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+			closed:close()
+			assert.has_error(function() fenster.loopall() end)
+			assert.has_error(function() fenster.loopall(window) end)
+			assert.has_error(function() fenster.loopall({}) end)
+			assert.has_error(function() fenster.loopall({ window, 'ERROR' }) end)
+			assert.has_error(function() fenster.loopall({ window, fenster.surface(1, 1) }) end)
+			assert.has_error(function() fenster.loopall({ window, closed }) end)
+		end)
+
+		it('should sleep once for all windows', function()
+			local windows = {}
+			for i = 1, 4 do
+				windows[i] = fenster.open(64, 36, 'Test', 1, 50, { headless = true })
+			end
+			finally(function()
+				for _, window in ipairs(windows) do
+					window:close()
+				end
+			end)
+			assert.is_true(fenster.loopall(windows))
+			local start = fenster.time()
+			for _ = 1, 5 do
+				assert.is_true(fenster.loopall(windows))
+			end
+			-- five frames at 50 fps, instead of twenty with one loop per window
+			local elapsed = fenster.time() - start
+			assert.is_true(elapsed >= 90)
+			assert.is_true(elapsed < 200)
+			for _, window in ipairs(windows) do
+				assert.are_equal(window:stats().frames, 6)
+				assert.is_true(window.delta > 0.015)
+				assert.is_true(window.delta < 0.04)
+			end
+		end)
+
+		it('should present all windows', function()
+			local window1 = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			local window2 = fenster.open(128, 72, 'Test', 1, 0, { headless = true })
+			finally(function()
+				window1:close()
+				window2:close()
+			end)
+			fenster.loopall({ window1, window2 })
+			assert.are_equal(window1.damage, 256 * 144)
+			assert.are_equal(window2.damage, 128 * 72)
+			window2:set(1, 1, 0xffffff)
+			fenster.loopall({ window1, window2 })
+			assert.are_equal(window1.damage, 0)
+			assert.are_equal(window2.damage, 1)
+		end)
+
+		it('should pass the right window to the budget callbacks', function()
+			local window1 = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			local window2 = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window1:close() end)
+			local calls = {}
+			local function budget(w)
+				calls[#calls + 1] = w
+				if w == window1 then
+					window2:close()
+				end
+			end
+			window1:setbudget(5, budget)
+			window2:setbudget(5, budget)
+			fenster.loopall({ window1, window2 })
+			fenster.sleep(10)
+			fenster.loopall({ window1, window2 })
+			assert.are_same(calls, { window1 })
+			assert.are_equal(tostring(window2), 'window (closed)')
+		end)
+
+		it('should not count waiting for slower windows as missed frames', function()
+			local window1 = fenster.open(64, 36, 'Test', 1, 100, { headless = true })
+			local window2 = fenster.open(64, 36, 'Test', 1, 100, { headless = true, catchup = true })
+			local window3 = fenster.open(64, 36, 'Test', 1, 25, { headless = true })
+			finally(function()
+				window1:close()
+				window2:close()
+				window3:close()
+			end)
+			local windows = { window1, window2, window3 }
+			fenster.loopall(windows)
+			for _ = 1, 3 do
+				fenster.loopall(windows)
+				assert.are_equal(window1.missed, 0)
+				assert.are_equal(window2.missed, 0)
+				assert.are_equal(window3.missed, 0)
+			end
+			-- the catchup window did not fall behind, so it waits for the next frame
+			local start = fenster.timens()
+			window2:loop()
+			assert.are_equal(window2.missed, 0)
+			assert.is_true(fenster.timens() - start >= 2 * 1000000)
+		end)
+
+		it('should not finish the frames of windows a budget callback removed', function()
+			local windows = {
+				fenster.open(64, 36, 'Test', 1, 0, { headless = true }),
+				fenster.open(64, 36, 'Test', 1, 0, { headless = true }),
+			}
+			local window1 = windows[1]
+			finally(function() window1:close() end)
+			local calls = 0
+			window1:setbudget(5, function()
+				windows[2]:close()
+				windows[2] = nil
+				collectgarbage()
+			end)
+			windows[2]:setbudget(5, function() calls = calls + 1 end)
+			fenster.loopall(windows)
+			fenster.sleep(10)
+			fenster.loopall(windows)
+			assert.are_equal(calls, 0)
+			assert.are_equal(#windows, 1)
+			assert.are_equal(window1:stats().frames, 2)
+		end)
+
+		it('should update all windows #needsdisplay', function()
+			local window1 = fenster.open(256, 144)
+			local window2 = fenster.open(256, 144, 'Test', 2)
+			finally(function()
+				window1:close()
+				window2:close()
+			end)
+			assert.is_true(fenster.loopall({ window1, window2 }))
+			assert.is_true(fenster.loopall({ window1, window2 }))
+			assert.is_true(window1:loop())
+			assert.is_true(window2:loop())
+		end)
+	end)
+
+	describe('window:wait(...) / fenster.wait(...)', function()
+		it('should throw when no arguments were given when not using as method', function()
+			assert.has_error(function() fenster.wait() end)
+		end)
+
+		it('should throw when window is not a window userdata when not using as method', function()
+			assert.has_error(function() fenster.wait(25) end)
+			assert.has_error(function() fenster.wait(2.5) end)
+			assert.has_error(function() fenster.wait('ERROR') end)
+			assert.has_error(function() fenster.wait(true) end)
+			assert.has_error(function() fenster.wait({}) end)
+			assert.has_error(function() fenster.wait(function() end) end)
+			assert.has_error(function() fenster.wait(io.stdout) end)
+		end)
+
+		it('should throw when timeout is invalid', function()
+			local window = fenster.open(256, 144, nil, nil, nil, { headless = true })
+			finally(function() window:close() end)
+			assert.has_error(function() window:wait(2.5) end)
+			assert.has_error(function() window:wait('ERROR') end)
+			assert.has_error(function() window:wait(-1) end)
+		end)
+
+		it('should present the window and wait for the timeout', function()
+			local window = fenster.open(256, 144, nil, nil, nil, { headless = true })
+			finally(function() window:close() end)
+			window:set(10, 10, 0xffffff)
+			local start = fenster.time()
+			assert.is_true(window:wait(20))
+			assert.is_true(fenster.time() - start >= 20)
+			assert.are_equal(window.damage, 256 * 144)
+			assert.is_true(fenster.wait(window, 0))
+			assert.are_equal(window.damage, 0)
+		end)
+
+		it('should return when the timeout expires #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_true(window:wait(10))
+			assert.is_true(fenster.wait(window, 0))
+		end)
+	end)
+
+	describe('window:stats(...) / fenster.stats(...)', function()
+		it('should throw when window is not a window userdata when not using as method', function()
+			assert.has_error(function() fenster.stats() end)
+			assert.has_error(function() fenster.stats(25) end)
+			assert.has_error(function() fenster.stats({}) end)
+		end)
+
+		it('should throw when statsframes option is invalid', function()
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, statsframes = 'ERROR' }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, statsframes = 2.5 }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, statsframes = 0 }) end)
+			assert.has_error(function() fenster.open(256, 144, 'Test', 1, 60, { headless = true, statsframes = 1025 }) end)
+		end)
+
+		it('should return empty statistics before the first frame', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local stats = window:stats()
+			assert.are_equal(stats.frames, 0)
+			assert.are_equal(stats.missed, 0)
+			assert.are_equal(stats.bytes, 0)
+			assert.are_same(stats.frame, {})
+			assert.are_same(stats.work, {})
+		end)
+
+		it('should measure the phases and rolling statistics of the frames', function()
+			local window = fenster.open(256, 144, 'Test', 1, 200, { headless = true, statsframes = 4 })
+			finally(function() window:close() end)
+			for _ = 1, 6 do
+				fenster.sleep(1)
+				window:loop()
+			end
+			local stats = window:stats()
+			assert.are_equal(stats.frames, 6)
+			assert.is_true(stats.last.work >= 1)
+			assert.is_true(stats.last.sleep > 0)
+			assert.is_true(stats.last.frame >= stats.last.work + stats.last.sleep)
+			assert.is_true(stats.frame.min <= stats.frame.p50)
+			assert.is_true(stats.frame.p50 <= stats.frame.p95)
+			assert.is_true(stats.frame.p95 <= stats.frame.p99)
+			assert.is_true(stats.frame.p99 <= stats.frame.max)
+			assert.is_true(stats.frame.avg >= stats.frame.min)
+			assert.is_true(stats.frame.avg <= stats.frame.max)
+			assert.is_true(stats.work.min >= 1)
+		end)
+	end)
+
+	describe('window:setbudget(...) / fenster.setbudget(...)', function()
+		it('should throw when arguments are invalid', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.has_error(function() fenster.setbudget() end)
+			assert.has_error(function() window:setbudget('ERROR', function() end) end)
+			assert.has_error(function() window:setbudget(0, function() end) end)
+			assert.has_error(function() window:setbudget(10) end)
+			assert.has_error(function() window:setbudget(10, 'ERROR') end)
+		end)
+
+		it('should call the callback when a frame exceeds the budget', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local calls = {}
+			window:setbudget(5, function(w, busy)
+				calls[#calls + 1] = { w, busy }
+			end)
+			window:loop()
+			window:loop()
+			assert.are_equal(#calls, 0)
+			fenster.sleep(10)
+			window:loop()
+			assert.are_equal(#calls, 1)
+			assert.are_equal(calls[1][1], window)
+			assert.is_true(calls[1][2] >= 10)
+			window:setbudget()
+			fenster.sleep(10)
+			window:loop()
+			assert.are_equal(#calls, 1)
+		end)
+	end)
+
+	describe('window:buffer(...) / fenster.buffer(...)', function()
+		it('should throw when window is not a window userdata', function()
+			assert.has_error(function() fenster.buffer() end)
+			assert.has_error(function() fenster.buffer('ERROR') end)
+		end)
+
+		it('should return the buffer and its dimensions', function()
+			local window = fenster.open(256, 144, 'Test', 2, 0, { headless = true })
+			finally(function() window:close() end)
+			local pointer, width, height, stride, scale = window:buffer()
+			assert.are_equal(type(pointer), 'userdata')
+			assert.are_equal(width, 256)
+			assert.are_equal(height, 144)
+			assert.are_equal(stride, 256)
+			assert.are_equal(scale, 2)
+		end)
+
+		it('should present the whole window every frame afterwards', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			window:loop()
+			assert.are_equal(window.damage, 0)
+			window:buffer()
+			window:loop()
+			assert.are_equal(window.damage, 256 * 144)
+			window:loop()
+			assert.are_equal(window.damage, 256 * 144)
+		end)
+
+		it('should allow writing pixels through the FFI', function()
+			if not jit then
+				return -- only LuaJIT has an FFI
+			end
+			local buffer = dofile('src/ffi.lua').buffer -- installed as fenster.ffi
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local pixels, _, _, stride = buffer(window)
+			pixels[10 * stride + 20] = 0x123456
+			assert.are_equal(window:get(20, 10), 0x123456)
+		end)
+
+		it('should allow writing palette indices through the FFI', function()
+			if not jit then
+				return -- only LuaJIT has an FFI
+			end
+			local ffi = require('ffi')
+			local buffer = dofile('src/ffi.lua').buffer -- installed as fenster.ffi
+			local window = fenster.open(16, 8, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			window:setpalette(42, 0x123456)
+			local pixels, width, height, stride = buffer(window)
+			assert.is_true(ffi.istype('uint8_t *', pixels))
+			pixels[(height - 1) * stride + width - 1] = 42
+			assert.are_equal(pixels[(height - 1) * stride + width - 2], 0)
+			window:loop()
+			assert.are_equal(window:get(width - 1, height - 1), 42)
+			assert.are_equal(window:get(width - 2, height - 1), 0)
+		end)
+	end)
+
+	describe('window:record(...) / fenster.record(...)', function()
+		---Read the whole contents of a file and remove it
+		---@param path string
+		---@return string
+		local function read_and_remove(path)
+			local file = assert(io.open(path, 'rb'))
+			local contents = file:read('*a')
+			file:close()
+			os.remove(path)
+			return contents
+		end
+
+		it('should throw when window is not a window userdata', function()
+			assert.has_error(function() fenster.record() end)
+			assert.has_error(function() fenster.record('ERROR') end)
+		end)
+
+		it('should throw when options are invalid', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local path = os.tmpname()
+			finally(function() os.remove(path) end)
+			assert.has_error(function() window:record(path, 'ERROR') end)
+			assert.has_error(function() window:record(path, { format = 'ERROR' }) end)
+			assert.has_error(function() window:record(path, { slots = 0 }) end)
+			assert.has_error(function() window:record(path, { slots = 65 }) end)
+			assert.has_error(function() window:record(path, { fps = 0 }) end)
+			assert.is_true(window:record(path))
+			assert.has_error(function() window:record(path) end)
+			window:record()
+		end)
+
+		it('should return nil and an error message if the file cannot be opened', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local result, message = window:record('/nonexistent/directory/test.y4m')
+			assert.is_nil(result)
+			assert.are_equal(type(message), 'string')
+		end)
+
+		it('should return nothing when stopping without recording', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.are_equal(select('#', window:record()), 0)
+		end)
+
+		it('should write every presented frame as Y4M', function()
+			local window = fenster.open(5, 3, 'Test', 2, 30, { headless = true })
+			finally(function() window:close() end)
+			local path = os.tmpname()
+			assert.is_true(window:record(path, { slots = 64 }))
+			window:clear(0xffffff)
+			for _ = 1, 3 do
+				window:loop()
+			end
+			assert.are_equal(type(window:stats().recording), 'table')
+			local frames, dropped = window:record()
+			assert.are_equal(frames, 3)
+			assert.are_equal(dropped, 0)
+			assert.is_nil(window:stats().recording)
+
+			local header = 'YUV4MPEG2 W5 H3 F30:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n'
+			local frame = 'FRAME\n' .. ('\255'):rep(5 * 3) .. ('\128'):rep(2 * 3 * 2)
+			assert.are_equal(read_and_remove(path), header .. frame:rep(3))
+		end)
+
+		it('should write raw RGB and count dropped frames', function()
+			local window = fenster.open(2, 2, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local path = os.tmpname()
+			assert.is_true(window:record(path, { format = 'rgb', slots = 1 }))
+			window:set(0, 0, 0x123456)
+			window:set(1, 1, 0xabcdef)
+			for _ = 1, 5 do
+				window:loop()
+			end
+			local frames, dropped = window:record()
+			assert.are_equal(frames + dropped, 5)
+			assert.is_true(frames >= 1)
+
+			local frame = '\018\052\086' .. ('\0'):rep(6) .. '\171\205\239'
+			assert.are_equal(read_and_remove(path), frame:rep(frames))
+		end)
+
+		it('should finish the recording when the window is closed', function()
+			local window = fenster.open(4, 4, 'Test', 1, 0, { headless = true })
+			local path = os.tmpname()
+			assert.is_true(window:record(path, { format = 'rgb' }))
+			window:loop()
+			window:close()
+			assert.are_equal(#read_and_remove(path), 4 * 4 * 3)
+		end)
+	end)
+
 	describe('window:set(...) / fenster.set(...)', function()
 		it('should throw when no arguments were given when not using as method', function()
 			assert.has_error(function() fenster.set() end)
@@ -385,10 +1205,10 @@ describe('fenster', function()
 			finally(function() window:close() end)
 
 			assert.has_error(function() fenster.set(window, 0, 0, -1) end)
-			assert.has_error(function() fenster.set(window, 0, 0, 0x1000000) end)
+			assert.has_error(function() fenster.set(window, 0, 0, 0x100000000) end)
 
 			assert.has_error(function() window:set(0, 0, -1) end)
-			assert.has_error(function() window:set(0, 0, 0x1000000) end)
+			assert.has_error(function() window:set(0, 0, 0x100000000) end)
 		end)
 
 		it('should set a pixel successfully #needsdisplay', function()
@@ -532,10 +1352,10 @@ describe('fenster', function()
 			finally(function() window:close() end)
 
 			assert.has_error(function() fenster.clear(window, -1) end)
-			assert.has_error(function() fenster.clear(window, 0x1000000) end)
+			assert.has_error(function() fenster.clear(window, 0x100000000) end)
 
 			assert.has_error(function() window:clear(-1) end)
-			assert.has_error(function() window:clear(0x1000000) end)
+			assert.has_error(function() window:clear(0x100000000) end)
 		end)
 
 		it('should clear the window with a color successfully #needsdisplay', function()
@@ -556,63 +1376,1064 @@ describe('fenster', function()
 		end)
 	end)
 
-	describe('window.keys', function()
-		it('should be a table of 256 booleans #needsdisplay', function()
-			local window = fenster.open(256, 144)
-			finally(function() window:close() end)
-			assert.is_table(window.keys)
+	describe('window:setregion(...) / fenster.setregion(...)', function()
+		it('should throw when no arguments were given when not using as method', function()
+			assert.has_error(function() fenster.setregion() end)
+		end)
 
-			local index = 0
-			while window.keys[index] ~= nil do
-				assert.is_boolean(window.keys[index])
-				assert.is_false(window.keys[index])
-				index = index + 1 ---@type integer
-			end
-			assert.are_equal(index, 256)
+		it('should throw when window is not a window userdata when not using as method', function()
+			assert.has_error(function() fenster.setregion(25, 0, 0, 1, 1, { 0 }) end)
+			assert.has_error(function() fenster.setregion('ERROR', 0, 0, 1, 1, { 0 }) end)
+			assert.has_error(function() fenster.setregion({}, 0, 0, 1, 1, { 0 }) end)
+			assert.has_error(function() fenster.setregion(io.stdout, 0, 0, 1, 1, { 0 }) end)
 		end)
-	end)
 
-	describe('window.delta', function()
-		it('should be a number and be zero before the second frame #needsdisplay', function()
-			local window = fenster.open(256, 144)
+		it('should throw when x/y/width/height are not integers', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
 			finally(function() window:close() end)
-			assert.is_number(window.delta)
-			assert.are_equal(window.delta, 0)
-			window:loop()
-			assert.are_equal(window.delta, 0)
+
+			assert.has_error(function() window:setregion('ERROR', 0, 1, 1, { 0 }) end)
+			assert.has_error(function() window:setregion(0, true, 1, 1, { 0 }) end)
+			assert.has_error(function() window:setregion(0, 0, {}, 1, { 0 }) end)
+			assert.has_error(function() window:setregion(0, 0, 1, 2.5, { 0 }) end)
 		end)
-	end)
 
-	describe('window.mousex', function()
-		it('should be a integer and be zero before the first frame #needsdisplay', function()
-			local window = fenster.open(256, 144)
+		it('should throw when x/y are out of range', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
 			finally(function() window:close() end)
-			assert.is_number(window.mousex)
-			assert.are_equal(window.mousex, 0)
+
+			assert.has_error(function() window:setregion(-2 ^ 40, 0, 1, 1, { 1 }) end)
+			assert.has_error(function() window:setregion(0, 2 ^ 40, 1, 1, { 1 }) end)
+			assert.has_error(function() window:setregion(-2147483648, 0, 1, 1, { 1 }) end)
+			window:setregion(-2147483647, 2147483647, 1, 1, { 1 })
 		end)
-	end)
 
-	describe('window.mousey', function()
-		it('should be a integer and be zero before the first frame #needsdisplay', function()
-			local window = fenster.open(256, 144)
+		it('should throw when width/height are out of range', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
 			finally(function() window:close() end)
-			assert.is_number(window.mousey)
-			assert.are_equal(window.mousey, 0)
+
+			assert.has_error(function() window:setregion(0, 0, 0, 1, {}) end)
+			assert.has_error(function() window:setregion(0, 0, 1, -1, {}) end)
+			assert.has_error(function() window:setregion(0, 0, 30000, 1, {}) end)
 		end)
-	end)
 
-	describe('window.mousedown', function()
-		it('should be a boolean and be false before the first frame #needsdisplay', function()
-			local window = fenster.open(256, 144)
+		it('should throw when data has the wrong type or size', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
 			finally(function() window:close() end)
-			assert.is_boolean(window.mousedown)
-			assert.is_false(window.mousedown)
+
+			assert.has_error(function() window:setregion(0, 0, 2, 2, true) end)
+			assert.has_error(function() window:setregion(0, 0, 2, 2, 25) end)
+			assert.has_error(function() window:setregion(0, 0, 2, 2, { 0, 0, 0 }) end)
+			assert.has_error(function() window:setregion(0, 0, 2, 2, '\0\0\0\0\0') end)
 		end)
-	end)
 
-	describe('window.modcontrol', function()
-		it('should be a boolean and be false before the first frame #needsdisplay', function()
-			local window = fenster.open(256, 144)
+		it('should throw when a color in the table is invalid', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:setregion(0, 0, 2, 1, { 0, 'ERROR' }) end)
+			assert.has_error(function() window:setregion(0, 0, 2, 1, { 0, 2.5 }) end)
+			assert.has_error(function() window:setregion(0, 0, 2, 1, { -1, 0 }) end)
+			assert.has_error(function() window:setregion(0, 0, 2, 1, { 0, 0x100000000 }) end)
+		end)
+
+		it('should set a region from a table successfully', function()
+			local window = fenster.open(256, 144, 'Test', 2, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:setregion(10, 20, 2, 2, { 0x010203, 0x040506, 0x070809, 0x800a0b0c })
+			assert.are_equal(window:get(10, 20), 0x010203)
+			assert.are_equal(window:get(11, 20), 0x040506)
+			assert.are_equal(window:get(10, 21), 0x070809)
+			assert.are_equal(window:get(11, 21), 0x800a0b0c)
+		end)
+
+		it('should replace pixels including their alpha regardless of the blend mode', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:clear(0xff00ff00)
+			window:setblend('alpha')
+			window:setregion(0, 0, 2, 1, { 0x80ff0000, 0 })
+			assert.are_equal(window:get(0, 0), 0x80ff0000)
+			assert.are_equal(window:get(1, 0), 0)
+			window:fillrect(2, 0, 1, 1, 0x80ff0000)
+			assert.are_not_equal(window:get(2, 0), 0x80ff0000)
+		end)
+
+		it('should set a region from a string successfully', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:setregion(0, 0, 2, 1, '\255\0\0\0\0\255')
+			assert.are_equal(window:get(0, 0), 0xff0000)
+			assert.are_equal(window:get(1, 0), 0x0000ff)
+
+			if string.pack then
+				window:setregion(0, 1, 2, 1, string.pack('=I4I4', 0xbeef99, 0xff00ff00))
+				assert.are_equal(window:get(0, 1), 0xbeef99)
+				assert.are_equal(window:get(1, 1), 0xff00ff00)
+			end
+		end)
+
+		it('should clip regions outside of the window', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:setregion(-1, -1, 2, 2, { 1, 2, 3, 4 })
+			assert.are_equal(window:get(0, 0), 4)
+			window:setregion(255, 143, 2, 2, { 5, 6, 7, 8 })
+			assert.are_equal(window:get(255, 143), 5)
+			window:setregion(1000, 1000, 1, 1, { 9 })
+			window:setregion(-1000, -1000, 1, 1, { 9 })
+		end)
+	end)
+
+	describe('window:fillrect(...) / fenster.fillrect(...)', function()
+		it('should throw when no arguments were given when not using as method', function()
+			assert.has_error(function() fenster.fillrect() end)
+		end)
+
+		it('should throw when window is not a window userdata when not using as method', function()
+			assert.has_error(function() fenster.fillrect(25, 0, 0, 1, 1, 0) end)
+			assert.has_error(function() fenster.fillrect('ERROR', 0, 0, 1, 1, 0) end)
+			assert.has_error(function() fenster.fillrect({}, 0, 0, 1, 1, 0) end)
+			assert.has_error(function() fenster.fillrect(io.stdout, 0, 0, 1, 1, 0) end)
+		end)
+
+		it('should throw when x/y/width/height/color are not integers', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:fillrect('ERROR', 0, 1, 1, 0) end)
+			assert.has_error(function() window:fillrect(0, true, 1, 1, 0) end)
+			assert.has_error(function() window:fillrect(0, 0, {}, 1, 0) end)
+			assert.has_error(function() window:fillrect(0, 0, 1, 2.5, 0) end)
+			assert.has_error(function() window:fillrect(0, 0, 1, 1) end)
+		end)
+
+		it('should throw when width/height/color are out of range', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:fillrect(0, 0, 0, 1, 0) end)
+			assert.has_error(function() window:fillrect(0, 0, 1, -1, 0) end)
+			assert.has_error(function() window:fillrect(0, 0, 30000, 1, 0) end)
+			assert.has_error(function() window:fillrect(0, 0, 1, 1, -1) end)
+			assert.has_error(function() window:fillrect(0, 0, 1, 1, 0x100000000) end)
+		end)
+
+		it('should fill a rectangle successfully', function()
+			local window = fenster.open(256, 144, 'Test', 2, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:fillrect(10, 20, 30, 2, 0xbeef99)
+			assert.are_equal(window:get(9, 20), 0x000000)
+			assert.are_equal(window:get(10, 20), 0xbeef99)
+			assert.are_equal(window:get(39, 21), 0xbeef99)
+			assert.are_equal(window:get(40, 21), 0x000000)
+			assert.are_equal(window:get(10, 22), 0x000000)
+
+			fenster.fillrect(window, 0, 100, 256, 44, 0xf00f00)
+			assert.are_equal(window:get(0, 99), 0x000000)
+			assert.are_equal(window:get(0, 100), 0xf00f00)
+			assert.are_equal(window:get(255, 143), 0xf00f00)
+		end)
+
+		it('should clip rectangles outside of the window', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:fillrect(-1, -1, 2, 2, 0x00ff00)
+			assert.are_equal(window:get(0, 0), 0x00ff00)
+			assert.are_equal(window:get(1, 0), 0x000000)
+			window:fillrect(255, 143, 2, 2, 0x0000ff)
+			assert.are_equal(window:get(255, 143), 0x0000ff)
+			window:fillrect(1000, 1000, 1, 1, 0xffffff)
+			window:fillrect(-1000, -1000, 1, 1, 0xffffff)
+		end)
+	end)
+
+	describe('window:hline(...) / window:vline(...)', function()
+		it('should throw when length/color are out of range', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:hline(0, 0, 0, 0) end)
+			assert.has_error(function() window:hline(0, 0, 1, 0x100000000) end)
+			assert.has_error(function() window:vline(0, 0, -1, 0) end)
+			assert.has_error(function() window:vline(0, 0, 1, -1) end)
+		end)
+
+		it('should draw lines successfully', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:hline(-5, 10, 10, 0xff0000)
+			assert.are_equal(window:get(0, 10), 0xff0000)
+			assert.are_equal(window:get(4, 10), 0xff0000)
+			assert.are_equal(window:get(5, 10), 0x000000)
+			assert.are_equal(window:get(0, 11), 0x000000)
+
+			fenster.vline(window, 20, 140, 10, 0x00ff00)
+			assert.are_equal(window:get(20, 139), 0x000000)
+			assert.are_equal(window:get(20, 140), 0x00ff00)
+			assert.are_equal(window:get(20, 143), 0x00ff00)
+			assert.are_equal(window:get(21, 143), 0x000000)
+		end)
+	end)
+
+	describe('window:line(...) / window:rect(...)', function()
+		it('should throw when arguments are invalid', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:line(0, 0, 10, 'ERROR', 0) end)
+			assert.has_error(function() window:line(0, 0, 10, 10, 0x100000000) end)
+			assert.has_error(function() window:line(0, 0, 10, 10, 0, 0) end)
+			assert.has_error(function() window:line(0, 0, 10, 10, 0, 2.5) end)
+			assert.has_error(function() window:rect(0, 0, 0, 10, 0) end)
+			assert.has_error(function() window:rect(0, 0, 10, 10) end)
+		end)
+
+		it('should draw lines including both endpoints', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:line(10, 10, 20, 15, 0xffffff)
+			assert.are_equal(window:get(10, 10), 0xffffff)
+			assert.are_equal(window:get(20, 15), 0xffffff)
+			assert.are_equal(window:get(21, 15), 0x000000)
+
+			fenster.line(window, 30, 30, 30, 30, 0xff0000)
+			assert.are_equal(window:get(30, 30), 0xff0000)
+
+			window:line(-1000, 50, 1000, 50, 0x00ff00)
+			assert.are_equal(window:get(0, 50), 0x00ff00)
+			assert.are_equal(window:get(255, 50), 0x00ff00)
+		end)
+
+		it('should draw thick lines', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+
+			window:loop()
+			window:line(10, 20, 19, 20, 0xffffff, 3)
+			window:loop()
+			assert.are_equal(window.damage, 10 * 3)
+			assert.are_equal(window:get(10, 19), 0xffffff)
+			assert.are_equal(window:get(19, 21), 0xffffff)
+			assert.are_equal(window:get(10, 22), 0x000000)
+		end)
+
+		it('should only draw the outline of rectangles', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:rect(10, 10, 5, 4, 0xffffff)
+			assert.are_equal(window:get(10, 10), 0xffffff)
+			assert.are_equal(window:get(14, 13), 0xffffff)
+			assert.are_equal(window:get(14, 11), 0xffffff)
+			assert.are_equal(window:get(11, 11), 0x000000)
+			assert.are_equal(window:get(15, 13), 0x000000)
+		end)
+	end)
+
+	describe('window:circle(...) / window:ellipse(...)', function()
+		it('should throw when the radius is out of range', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:circle(0, 0, -1, 0) end)
+			assert.has_error(function() window:fillcircle(0, 0, 30000, 0) end)
+			assert.has_error(function() window:ellipse(0, 0, 1, -1, 0) end)
+			assert.has_error(function() window:fillellipse(0, 0, 1, 2.5, 0) end)
+		end)
+
+		it('should fill circles and ellipses', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:fillcircle(50, 50, 10, 0xffffff)
+			assert.are_equal(window:get(50, 50), 0xffffff)
+			assert.are_equal(window:get(40, 50), 0xffffff)
+			assert.are_equal(window:get(50, 60), 0xffffff)
+			assert.are_equal(window:get(39, 50), 0x000000)
+			assert.are_equal(window:get(42, 42), 0x000000)
+
+			window:fillellipse(150, 50, 20, 5, 0xff0000)
+			assert.are_equal(window:get(130, 50), 0xff0000)
+			assert.are_equal(window:get(150, 45), 0xff0000)
+			assert.are_equal(window:get(150, 44), 0x000000)
+			assert.are_equal(window:get(129, 50), 0x000000)
+
+			window:fillcircle(0, 0, 0, 0x00ff00)
+			assert.are_equal(window:get(0, 0), 0x00ff00)
+			window:fillcircle(-100, -100, 10, 0x00ff00)
+		end)
+
+		it('should only draw the outline of circles and ellipses', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:circle(50, 50, 10, 0xffffff)
+			assert.are_equal(window:get(40, 50), 0xffffff)
+			assert.are_equal(window:get(60, 50), 0xffffff)
+			assert.are_equal(window:get(50, 40), 0xffffff)
+			assert.are_equal(window:get(50, 60), 0xffffff)
+			assert.are_equal(window:get(50, 50), 0x000000)
+
+			window:ellipse(150, 50, 20, 5, 0xff0000)
+			assert.are_equal(window:get(130, 50), 0xff0000)
+			assert.are_equal(window:get(150, 45), 0xff0000)
+			assert.are_equal(window:get(150, 50), 0x000000)
+		end)
+	end)
+
+	describe('window:filltriangle(...) / window:fillpolygon(...)', function()
+		it('should throw when arguments are invalid', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:filltriangle(0, 0, 10, 0, 0, 'ERROR', 0) end)
+			assert.has_error(function() window:filltriangle(0, 0, 10, 0, 0, 10) end)
+			assert.has_error(function() window:fillpolygon(25, 0) end)
+			assert.has_error(function() window:fillpolygon({ 0, 0, 10, 0 }, 0) end)
+			assert.has_error(function() window:fillpolygon({ 0, 0, 10, 0, 0 }, 0) end)
+			assert.has_error(function() window:fillpolygon({ 0, 0, 10, 0, 0, 'ERROR' }, 0) end)
+			assert.has_error(function() window:fillpolygon({ 0, 0, 10, 0, 0, 10 }, -1) end)
+		end)
+
+		it('should fill triangles without the right and bottom edges', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+
+			window:loop()
+			window:filltriangle(0, 0, 10, 0, 0, 10, 0xffffff)
+			window:loop()
+			assert.are_equal(window.damage, 10 * 10)
+			assert.are_equal(window:get(0, 0), 0xffffff)
+			assert.are_equal(window:get(9, 0), 0xffffff)
+			assert.are_equal(window:get(0, 9), 0xffffff)
+			assert.are_equal(window:get(10, 0), 0x000000)
+			assert.are_equal(window:get(0, 10), 0x000000)
+		end)
+
+		it('should fill polygons with the even-odd rule', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			window:fillpolygon({ 10, 10, 20, 10, 20, 20, 10, 20 }, 0xffffff)
+			assert.are_equal(window:get(10, 10), 0xffffff)
+			assert.are_equal(window:get(19, 19), 0xffffff)
+			assert.are_equal(window:get(20, 20), 0x000000)
+
+			-- two overlapping squares drawn as one self-intersecting polygon
+			window:fillpolygon({ 50, 50, 70, 50, 70, 70, 60, 70, 60, 60, 80, 60, 80, 80, 50, 80 }, 0xff0000)
+			assert.are_equal(window:get(55, 55), 0xff0000)
+		end)
+	end)
+
+	describe('window:text(...)', function()
+		it('should throw when arguments are invalid', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.has_error(function() window:text(0, 0) end)
+			assert.has_error(function() window:text(0, 0, 'A') end)
+			assert.has_error(function() window:text(0, 0, 'A', -1) end)
+			assert.has_error(function() window:text(0, 0, 'A', 0xffffff, 'ERROR') end)
+		end)
+
+		it('should draw text with the built-in font', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+
+			window:loop()
+			window:text(0, 0, 'A\nA', 0xffffff)
+			window:loop()
+			assert.are_equal(window.damage, 8 * 16)
+			assert.are_equal(window:get(0, 0), 0x000000)
+			assert.are_equal(window:get(1, 0), 0xffffff)
+			assert.are_equal(window:get(0, 3), 0xffffff)
+			assert.are_equal(window:get(7, 3), 0x000000)
+			assert.are_equal(window:get(1, 8), 0xffffff)
+
+			-- text partly outside of the window is clipped
+			window:text(250, 140, 'AAA', 0xffffff)
+			window:text(-5, -4, 'A', 0xffffff)
+			assert.are_equal(window:get(0, 0), 0xffffff)
+		end)
+
+		it('should draw text with custom fonts', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			local font = fenster.font('\128\255', 8, 1, 65)
+			window:text(0, 0, 'AB?', 0xff0000, font)
+			assert.are_equal(window:get(0, 0), 0xff0000)
+			assert.are_equal(window:get(1, 0), 0x000000)
+			assert.are_equal(window:get(8, 0), 0xff0000)
+			assert.are_equal(window:get(15, 0), 0xff0000)
+			assert.are_equal(window:get(16, 0), 0x000000)
+
+			local wide_font = fenster.font('\255\1', 16, 1, 32)
+			window:text(0, 10, ' ', 0x00ff00, wide_font)
+			assert.are_equal(window:get(7, 10), 0x00ff00)
+			assert.are_equal(window:get(8, 10), 0x000000)
+			assert.are_equal(window:get(15, 10), 0x00ff00)
+		end)
+	end)
+
+	describe('window:encode(...) / window:save(...)', function()
+		---Load an encoded image through a temporary file
+		---@param image string
+		---@return userdata
+		local function load_encoded(image)
+			local path = os.tmpname()
+			local file = assert(io.open(path, 'wb'))
+			file:write(image)
+			file:close()
+			local surface, message = fenster.loadimage(path)
+			os.remove(path)
+			return assert(surface, message)
+		end
+
+		it('should throw when arguments are invalid', function()
+			assert.has_error(function() fenster.encode() end)
+			assert.has_error(function() fenster.encode('ERROR', 'ppm') end)
+			local window = fenster.open(8, 8, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.has_error(function() window:encode() end)
+			assert.has_error(function() window:encode('ERROR') end)
+			assert.has_error(function() window:save() end)
+			assert.has_error(function() window:save('test.png') end)
+			assert.has_error(function() window:save('test.ppm', 'ERROR') end)
+		end)
+
+		it('should encode binary PPM', function()
+			local window = fenster.open(2, 1, 'Test', 3, 0, { headless = true })
+			finally(function() window:close() end)
+			window:set(0, 0, 0x123456)
+			window:set(1, 0, 0xabcdef)
+			assert.are_equal(window:encode('ppm'), 'P6\n2 1\n255\n\018\052\086\171\205\239')
+		end)
+
+		it('should encode bottom-up BMP with padded rows', function()
+			local window = fenster.open(1, 2, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:set(0, 0, 0x123456)
+			window:set(0, 1, 0xabcdef)
+			local image = window:encode('bmp')
+			assert.are_equal(#image, 54 + 2 * 4)
+			assert.are_equal(image:sub(1, 2), 'BM')
+			assert.are_equal(image:sub(55), '\239\205\171\0\086\052\018\0')
+		end)
+
+		it('should encode images that load again unchanged', function()
+			local window = fenster.open(37, 19, 'Test', 2, 0, { headless = true })
+			finally(function() window:close() end)
+			math.randomseed(42)
+			for y = 0, 18 do
+				for x = 0, 36 do
+					local color = math.random(0, 3) == 0 and 0x102030 or math.random(0, 0xffffff)
+					window:set(x, y, color)
+				end
+			end
+			for _, format in ipairs({ 'ppm', 'qoi', 'bmp' }) do
+				local surface = load_encoded(window:encode(format))
+				assert.are_equal(surface.width, 37)
+				assert.are_equal(surface.height, 19)
+				for y = 0, 18 do
+					for x = 0, 36 do
+						assert.are_equal(surface:get(x, y), window:get(x, y))
+					end
+				end
+			end
+		end)
+
+		it('should compress runs of the same color in QOI', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:clear(0x336699)
+			assert.is_true(#window:encode('qoi') < 1000)
+		end)
+
+		it('should encode the palette colors of indexed windows', function()
+			local window = fenster.open(2, 2, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			window:setpalette(1, 0xff8000)
+			window:clear(1)
+			local surface = load_encoded(window:encode('qoi'))
+			assert.are_equal(surface:get(1, 1), 0xff8000)
+		end)
+
+		it('should encode surfaces', function()
+			local surface = fenster.surface(3, 2)
+			surface:clear(0x00ff00)
+			assert.are_equal(load_encoded(surface:encode('bmp')):get(2, 1), 0x00ff00)
+		end)
+
+		it('should save files in the format of their extension', function()
+			local window = fenster.open(4, 4, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:clear(0x0000ff)
+			local base = os.tmpname()
+			local path = base .. '.QOI'
+			finally(function()
+				os.remove(base)
+				os.remove(path)
+			end)
+			assert.is_true(window:save(path))
+			local file = assert(io.open(path, 'rb'))
+			local contents = file:read('*a')
+			file:close()
+			assert.are_equal(contents, window:encode('qoi'))
+
+			local other = os.tmpname()
+			finally(function() os.remove(other) end)
+			assert.is_true(window:save(other, 'ppm'))
+			assert.are_equal(fenster.loadimage(other):get(3, 3), 0x0000ff)
+		end)
+
+		it('should return nil and an error message if the file cannot be written', function()
+			local window = fenster.open(4, 4, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local result, message = window:save('/nonexistent/directory/test.ppm')
+			assert.is_nil(result)
+			assert.are_equal(type(message), 'string')
+		end)
+	end)
+
+	describe('window:hash(...) / fenster.diff(...)', function()
+		it('should hash the pixels as XXH64', function()
+			local surface = fenster.surface(1, 1)
+			assert.are_equal(surface:hash(), '3aefa6fd5cf2deb4') -- XXH64 of 4 zero bytes
+			surface:set(0, 0, 0x123456)
+			assert.are_not_equal(surface:hash(), '3aefa6fd5cf2deb4')
+		end)
+
+		it('should hash the unscaled window', function()
+			local window = fenster.open(37, 19, 'Test', 3, 0, { headless = true })
+			finally(function() window:close() end)
+			local surface = fenster.surface(37, 19)
+			window:clear(0x336699)
+			surface:clear(0x336699)
+			assert.are_equal(window:hash(), surface:hash())
+			window:set(36, 18, 0)
+			assert.are_not_equal(window:hash(), surface:hash())
+		end)
+
+		it('should throw when images are invalid', function()
+			assert.has_error(function() fenster.diff() end)
+			assert.has_error(function() fenster.diff(fenster.surface(2, 2)) end)
+			assert.has_error(function() fenster.diff(fenster.surface(2, 2), fenster.surface(2, 3)) end)
+		end)
+
+		it('should return 0 for equal images', function()
+			local a = fenster.surface(16, 16)
+			local b = fenster.surface(16, 16)
+			a:clear(0x123456)
+			b:clear(0x123456)
+			local count, box = fenster.diff(a, b)
+			assert.are_equal(count, 0)
+			assert.is_nil(box)
+		end)
+
+		it('should count differing pixels and their bounding box', function()
+			local window = fenster.open(37, 19, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			local surface = fenster.surface(37, 19)
+			window:set(3, 5, 0xffffff)
+			window:set(30, 2, 0x010000)
+			window:set(10, 17, 0x000001)
+			local count, box, image = fenster.diff(window, surface, true)
+			assert.are_equal(count, 3)
+			assert.are_same(box, { x = 3, y = 2, width = 28, height = 16 })
+			assert.are_equal(image:get(30, 2), 0xff0000)
+			assert.are_equal(image:get(0, 0), 0)
+		end)
+
+		it('should ignore alpha', function()
+			local a = fenster.surface(5, 1)
+			local b = fenster.surface(5, 1)
+			a:set(4, 0, 0x80ffffff)
+			b:set(4, 0, 0xffffff)
+			assert.are_equal(fenster.diff(a, b), 0)
+		end)
+	end)
+
+	describe('golden images', function()
+		local golden = dofile('spec/golden.lua')
+
+		it('should draw shapes bit-exactly', function()
+			local window = fenster.open(64, 48, 'Test', 2, 0, { headless = true })
+			finally(function() window:close() end)
+			window:clear(0x203040)
+			window:fillrect(4, 4, 20, 10, 0xff0000)
+			window:fillrect(40, 30, 40, 40, 0x00ff00)
+			window:hline(0, 24, 64, 0xffffff)
+			window:vline(32, 0, 48, 0x0000ff)
+			window:set(1, 1, 0xffff00)
+			golden.check(window, 'shapes')
+		end)
+
+		it('should expand palette indices bit-exactly', function()
+			local window = fenster.open(16, 16, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			window:setpalette({ 0x000000, 0xff0000, 0x00ff00, 0x0000ff })
+			window:fillrect(0, 0, 8, 8, 1)
+			window:fillrect(8, 0, 8, 8, 2)
+			window:fillrect(0, 8, 16, 8, 3)
+			window:setpalette(3, 0xffffff)
+			golden.check(window, 'palette')
+		end)
+
+		it('should report differences from the golden image', function()
+			local window = fenster.open(64, 48, 'Test', 1, 0, { headless = true })
+			local update = golden.update
+			finally(function()
+				window:close()
+				golden.update = update
+				os.remove('spec/golden/shapes.actual.ppm')
+				os.remove('spec/golden/shapes.diff.ppm')
+			end)
+			golden.update = false
+			assert.has_error(function() golden.check(window, 'shapes') end)
+		end)
+	end)
+
+	describe('surface drawing methods', function()
+		it('should draw into surfaces', function()
+			local surface = fenster.surface(32, 32)
+			surface:fillrect(0, 0, 4, 4, 0xff0000)
+			surface:hline(0, 10, 32, 0x00ff00)
+			surface:vline(10, 0, 32, 0x0000ff)
+			surface:line(0, 31, 31, 0, 0xffffff)
+			surface:fillcircle(20, 20, 3, 0xffff00)
+			surface:filltriangle(0, 20, 5, 20, 0, 25, 0xff00ff)
+			surface:text(24, 0, 'A', 0x00ffff)
+			assert.are_equal(surface:get(3, 3), 0xff0000)
+			assert.are_equal(surface:get(31, 10), 0x00ff00)
+			assert.are_equal(surface:get(10, 31), 0x0000ff)
+			assert.are_equal(surface:get(31, 0), 0xffffff)
+			assert.are_equal(surface:get(20, 23), 0xffff00)
+			assert.are_equal(surface:get(0, 20), 0xff00ff)
+			assert.are_equal(surface:get(25, 0), 0x00ffff)
+		end)
+	end)
+
+	describe('surface:set(...) / surface:get(...) / surface:clear(...)', function()
+		it('should throw when x/y/color are invalid', function()
+			local surface = fenster.surface(16, 8)
+			assert.has_error(function() surface:set('ERROR', 0, 0) end)
+			assert.has_error(function() surface:set(0, 2.5, 0) end)
+			assert.has_error(function() surface:set(16, 0, 0) end)
+			assert.has_error(function() surface:set(0, 8, 0) end)
+			assert.has_error(function() surface:set(0, 0, 0x100000000) end)
+			assert.has_error(function() surface:get(-1, 0) end)
+			assert.has_error(function() surface:get(0, 8) end)
+			assert.has_error(function() surface:clear(-1) end)
+			assert.has_error(function() surface:clear('ERROR') end)
+		end)
+
+		it('should set, get and clear pixels successfully', function()
+			local surface = fenster.surface(16, 8)
+			surface:set(15, 7, 0xbeef99)
+			assert.are_equal(surface:get(15, 7), 0xbeef99)
+			surface:clear(0x00ff00)
+			assert.are_equal(surface:get(0, 0), 0x00ff00)
+			assert.are_equal(surface:get(15, 7), 0x00ff00)
+			surface:clear()
+			assert.are_equal(surface:get(15, 7), 0x000000)
+		end)
+	end)
+
+	describe('surface:blit(...)', function()
+		it('should throw when destination is not a surface or window', function()
+			local surface = fenster.surface(16, 8)
+			assert.has_error(function() surface:blit(nil, 0, 0) end)
+			assert.has_error(function() surface:blit(25, 0, 0) end)
+			assert.has_error(function() surface:blit({}, 0, 0) end)
+			assert.has_error(function() surface:blit(io.stdout, 0, 0) end)
+		end)
+
+		it('should throw when destination is a closed window', function()
+			local surface = fenster.surface(16, 8)
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			window:close()
+			assert.has_error(function() surface:blit(window, 0, 0) end)
+		end)
+
+		it('should throw when coordinates or size are invalid', function()
+			local surface = fenster.surface(16, 8)
+			local surface2 = fenster.surface(16, 8)
+			assert.has_error(function() surface:blit(surface2) end)
+			assert.has_error(function() surface:blit(surface2, 'ERROR', 0) end)
+			assert.has_error(function() surface:blit(surface2, 0, 2.5) end)
+			assert.has_error(function() surface:blit(surface2, 0, 0, 0, 0, 0, 8) end)
+			assert.has_error(function() surface:blit(surface2, 0, 0, 0, 0, 16, -1) end)
+		end)
+
+		it('should copy a surface into another surface', function()
+			local surface = fenster.surface(2, 2)
+			surface:set(0, 0, 0x010203)
+			surface:set(1, 1, 0x040506)
+			local surface2 = fenster.surface(4, 4)
+			surface:blit(surface2, 1, 1)
+			assert.are_equal(surface2:get(1, 1), 0x010203)
+			assert.are_equal(surface2:get(2, 2), 0x040506)
+			assert.are_equal(surface2:get(0, 0), 0x000000)
+			surface:blit(surface2, 3, 0, 1, 1, 1, 1)
+			assert.are_equal(surface2:get(3, 0), 0x040506)
+		end)
+
+		it('should clip the copied area', function()
+			local surface = fenster.surface(2, 2)
+			surface:set(1, 1, 0x040506)
+			local surface2 = fenster.surface(4, 4)
+			surface:blit(surface2, -1, -1)
+			assert.are_equal(surface2:get(0, 0), 0x040506)
+			surface:blit(surface2, 3, 3, -1, -1)
+			assert.are_equal(surface2:get(3, 3), 0x000000)
+			surface:blit(surface2, 100, 100)
+			surface:blit(surface2, -100, -100)
+		end)
+
+		it('should copy overlapping areas within the same surface', function()
+			local surface = fenster.surface(4, 4)
+			surface:set(0, 0, 1)
+			surface:set(0, 1, 2)
+			surface:blit(surface, 0, 1, 0, 0, 1, 2)
+			assert.are_equal(surface:get(0, 1), 1)
+			assert.are_equal(surface:get(0, 2), 2)
+		end)
+
+		it('should copy a surface into a window', function()
+			local surface = fenster.surface(2, 2)
+			surface:clear(0xbeef99)
+			local window = fenster.open(256, 144, 'Test', 2, 60, { headless = true })
+			finally(function() window:close() end)
+			surface:blit(window, 255, 143)
+			assert.are_equal(window:get(255, 143), 0xbeef99)
+			assert.are_equal(window:get(254, 143), 0x000000)
+		end)
+	end)
+
+	describe('window:setblend(...) / surface:setblend(...)', function()
+		it('should throw when the mode is invalid', function()
+			local surface = fenster.surface(4, 4)
+			assert.has_error(function() surface:setblend('ERROR') end)
+			assert.has_error(function() surface:setblend(1) end)
+			assert.has_error(function() fenster.setblend('ERROR', 'alpha') end)
+		end)
+
+		it('should default to replacing pixels', function()
+			local surface = fenster.surface(4, 4)
+			assert.are_equal(surface.blend, 'replace')
+			surface:setblend('alpha')
+			assert.are_equal(surface.blend, 'alpha')
+			surface:setblend()
+			assert.are_equal(surface.blend, 'replace')
+			surface:set(0, 0, 0x80ff0000)
+			assert.are_equal(surface:get(0, 0), 0x80ff0000)
+		end)
+
+		it('should blend set pixels and fills', function()
+			local surface = fenster.surface(64, 4)
+			surface:setblend('alpha')
+			surface:set(0, 0, 0x80ff0000)
+			assert.are_equal(surface:get(0, 0), 0x80800000)
+			surface:fillrect(0, 1, 64, 1, 0xff00ff00)
+			assert.are_equal(surface:get(63, 1), 0xff00ff00)
+
+			surface:setblend('alphapre')
+			surface:clear(0xffffff)
+			surface:fillrect(0, 0, 64, 4, 0x80400000)
+			for x = 0, 63 do
+				assert.are_equal(surface:get(x, 3), 0x80bf7f7f)
+			end
+
+			surface:setblend('add')
+			surface:clear(0x404040)
+			surface:hline(0, 0, 64, 0xff808080)
+			assert.are_equal(surface:get(10, 0), 0xffc0c0c0)
+			surface:hline(0, 0, 64, 0xff808080)
+			assert.are_equal(surface:get(10, 0), 0xffffffff)
+
+			surface:setblend('multiply')
+			surface:clear(0xffffff)
+			surface:line(0, 0, 63, 0, 0xff808080)
+			assert.are_equal(surface:get(63, 0), 0x808080)
+		end)
+
+		it('should blend blits with the alpha of the source', function()
+			local src = fenster.surface(32, 32)
+			src:clear(0x80ff0000)
+			local dst = fenster.surface(32, 32)
+			dst:clear(0x0000ff)
+			dst:setblend('alpha')
+			src:blit(dst, 0, 0)
+			assert.are_equal(dst:get(0, 0), 0x8080007f)
+			assert.are_equal(dst:get(31, 31), 0x8080007f)
+
+			-- blending within the same surface reads the pixels before blending
+			src:setblend('add')
+			src:blit(src, 1, 0)
+			assert.are_equal(src:get(0, 0), 0x80ff0000)
+			assert.are_equal(src:get(1, 0), 0xffff0000)
+			assert.are_equal(src:get(31, 0), 0xffff0000)
+		end)
+
+		it('should blend into a window', function()
+			local window = fenster.open(64, 64, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.are_equal(window.blend, 'replace')
+			window:setblend('alpha')
+			assert.are_equal(window.blend, 'alpha')
+			window:set(0, 0, 0x80ff0000)
+			assert.are_equal(window:get(0, 0), 0x80800000)
+		end)
+	end)
+
+	describe('indexed windows / window:setpalette(...)', function()
+		it('should only be indexed with the indexed option', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.is_false(window.indexed)
+			assert.has_error(function() window:setpalette(0, 0xff0000) end)
+
+			local indexed = fenster.open(64, 32, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() indexed:close() end)
+			assert.is_true(indexed.indexed)
+			assert.has_error(function() fenster.open(64, 32, 'Test', 1, 0, { indexed = 'ERROR' }) end)
+		end)
+
+		it('should draw palette indices', function()
+			local window = fenster.open(64, 32, 'Test', 2, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			assert.are_equal(window:get(0, 0), 0)
+			window:clear(3)
+			assert.are_equal(window:get(63, 31), 3)
+			window:set(1, 2, 255)
+			assert.are_equal(window:get(1, 2), 255)
+			window:fillrect(10, 10, 5, 5, 7)
+			assert.are_equal(window:get(14, 14), 7)
+			window:line(0, 31, 63, 31, 9)
+			assert.are_equal(window:get(40, 31), 9)
+			assert.has_error(function() window:set(0, 0, 256) end)
+			assert.has_error(function() window:clear(-1) end)
+			assert.has_error(function() window:fillrect(0, 0, 1, 1, 0xff0000) end)
+		end)
+
+		it('should not support blending, blits or setregion', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			assert.has_error(function() window:setblend('alpha') end)
+			window:setblend('replace')
+			assert.has_error(function() fenster.surface(4, 4):blit(window, 0, 0) end)
+			assert.has_error(function() window:setregion(0, 0, 1, 1, { 0 }) end)
+		end)
+
+		it('should throw when palette arguments are invalid', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			assert.has_error(function() window:setpalette() end)
+			assert.has_error(function() window:setpalette(256, 0) end)
+			assert.has_error(function() window:setpalette(0, -1) end)
+			assert.has_error(function() window:setpalette({ 0, 'ERROR' }) end)
+			assert.has_error(function() window:setpalette({ 0, 0 }, 255) end)
+		end)
+
+		it('should present the whole window after a palette change', function()
+			local window = fenster.open(64, 32, 'Test', 1, 0, { headless = true, indexed = true })
+			finally(function() window:close() end)
+			window:loop()
+			window:set(0, 0, 1)
+			window:loop()
+			assert.are_equal(window.damage, 1)
+			window:setpalette(1, 0xff0000)
+			window:loop()
+			assert.are_equal(window.damage, 64 * 32)
+			window:setpalette({ 0x000000, 0x00ff00 }, 254)
+			window:loop()
+			assert.are_equal(window.damage, 64 * 32)
+		end)
+	end)
+
+	describe('window:events(...) / window:pressed(...) / window:released(...)', function()
+		it('should throw when arguments are invalid', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			assert.has_error(function() fenster.events() end)
+			assert.has_error(function() fenster.events(25) end)
+			assert.has_error(function() window:pressed() end)
+			assert.has_error(function() window:pressed('ERROR') end)
+			assert.has_error(function() window:pressed(-1) end)
+			assert.has_error(function() window:released(256) end)
+			assert.has_error(function() window:released(2.5) end)
+			window:close()
+			assert.has_error(function() window:events() end)
+			assert.has_error(function() window:pressed(65) end)
+		end)
+
+		it('should have no events and no pressed or released keys without input', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+
+			assert.is_true(window:loop())
+			local count = 0
+			for event in window:events() do
+				assert.is_string(event)
+				count = count + 1
+			end
+			assert.are_equal(count, 0)
+			for key = 0, 255 do
+				assert.is_false(window:pressed(key))
+				assert.is_false(window:released(key))
+				assert.is_false(window.keys[key])
+			end
+		end)
+
+		it('should keep pending input when another window is opened #needsdisplay', function()
+			if not jit then
+				return -- moves the pointer through the FFI, only LuaJIT has one
+			end
+			local ffi = require('ffi')
+			pcall(ffi.cdef, [[
+				typedef struct _XDisplay Display;
+				Display *XOpenDisplay(const char *name);
+				int XCloseDisplay(Display *display);
+				unsigned long XDefaultRootWindow(Display *display);
+				int XWarpPointer(Display *display, unsigned long src_w, unsigned long dest_w, int src_x, int src_y,
+					unsigned int src_width, unsigned int src_height, int dest_x, int dest_y);
+				int XSync(Display *display, int discard);
+			]])
+			local x11 = ffi.load('X11')
+			local display = x11.XOpenDisplay(nil)
+			assert.is_not_nil(display)
+			finally(function() x11.XCloseDisplay(display) end)
+
+			-- windows are opened at the top left corner of the screen
+			local window1 = fenster.open(256, 144)
+			finally(function() window1:close() end)
+			window1:loop()
+			local root = x11.XDefaultRootWindow(display)
+			x11.XWarpPointer(display, 0, root, 0, 0, 0, 0, 40, 50)
+			x11.XWarpPointer(display, 0, root, 0, 0, 0, 0, 60, 70)
+			x11.XSync(display, 0)
+			fenster.sleep(50)
+
+			local window2 = fenster.open(256, 144)
+			finally(function() window2:close() end)
+			window1:loop()
+			local moved = false
+			for event in window1:events() do
+				moved = moved or event == 'mousemove'
+			end
+			assert.is_true(moved)
+			assert.are_equal(window1.mousex, 60)
+			assert.are_equal(window1.mousey, 70)
+		end)
+
+		it('should report when the input happened instead of when it was processed #needsdisplay', function()
+			if not jit then
+				return -- moves the pointer through the FFI, only LuaJIT has one
+			end
+			local ffi = require('ffi')
+			pcall(ffi.cdef, [[
+				typedef struct _XDisplay Display;
+				Display *XOpenDisplay(const char *name);
+				int XCloseDisplay(Display *display);
+				unsigned long XDefaultRootWindow(Display *display);
+				int XWarpPointer(Display *display, unsigned long src_w, unsigned long dest_w, int src_x, int src_y,
+					unsigned int src_width, unsigned int src_height, int dest_x, int dest_y);
+				int XSync(Display *display, int discard);
+			]])
+			local x11 = ffi.load('X11')
+			local display = x11.XOpenDisplay(nil)
+			assert.is_not_nil(display)
+			finally(function() x11.XCloseDisplay(display) end)
+
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			local root = x11.XDefaultRootWindow(display)
+			window:loop()
+			x11.XWarpPointer(display, 0, root, 0, 0, 0, 0, 40, 50)
+			x11.XSync(display, 0)
+			window:loop()
+
+			x11.XWarpPointer(display, 0, root, 0, 0, 0, 0, 60, 70)
+			x11.XSync(display, 0)
+			local moved = fenster.time()
+			fenster.sleep(50)
+			window:loop()
+			local count = 0
+			for event, _, _, _, time in window:events() do
+				assert.are_equal(event, 'mousemove')
+				assert.is_true(time <= moved + 10)
+				count = count + 1
+			end
+			assert.are_equal(count, 1)
+		end)
+	end)
+
+	describe('window.keys', function()
+		it('should be a table of 256 booleans #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_table(window.keys)
+
+			local index = 0
+			while window.keys[index] ~= nil do
+				assert.is_boolean(window.keys[index])
+				assert.is_false(window.keys[index])
+				index = index + 1 ---@type integer
+			end
+			assert.are_equal(index, 256)
+		end)
+	end)
+
+	describe('window.delta', function()
+		it('should be a number and be zero before the second frame #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_number(window.delta)
+			assert.are_equal(window.delta, 0)
+			window:loop()
+			assert.are_equal(window.delta, 0)
+		end)
+	end)
+
+	describe('window.mousex', function()
+		it('should be a integer and be zero before the first frame #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_number(window.mousex)
+			assert.are_equal(window.mousex, 0)
+		end)
+	end)
+
+	describe('window.mousey', function()
+		it('should be a integer and be zero before the first frame #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_number(window.mousey)
+			assert.are_equal(window.mousey, 0)
+		end)
+	end)
+
+	describe('window.mousedown', function()
+		it('should be a boolean and be false before the first frame #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_boolean(window.mousedown)
+			assert.is_false(window.mousedown)
+		end)
+	end)
+
+	describe('window.modcontrol', function()
+		it('should be a boolean and be false before the first frame #needsdisplay', function()
+			local window = fenster.open(256, 144)
 			finally(function() window:close() end)
 			assert.is_boolean(window.modcontrol)
 			assert.is_false(window.modcontrol)
@@ -646,6 +2467,75 @@ describe('fenster', function()
 		end)
 	end)
 
+	describe('window:mouse()', function()
+		it('should return the same as the mouse properties', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+			local x, y, down = window:mouse()
+			assert.are_equal(x, window.mousex)
+			assert.are_equal(y, window.mousey)
+			assert.are_equal(down, window.mousedown)
+			assert.are_equal(x, 0)
+			assert.are_equal(y, 0)
+			assert.is_false(down)
+		end)
+
+		it('should throw when the window is closed', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			window:close()
+			assert.has_error(function() window:mouse() end)
+		end)
+	end)
+
+	describe('window:mods()', function()
+		it('should return the same as the modifier properties', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+			local control, shift, alt, gui = window:mods()
+			assert.are_equal(control, window.modcontrol)
+			assert.are_equal(shift, window.modshift)
+			assert.are_equal(alt, window.modalt)
+			assert.are_equal(gui, window.modgui)
+			assert.is_false(control)
+			assert.is_false(shift)
+			assert.is_false(alt)
+			assert.is_false(gui)
+		end)
+	end)
+
+	describe('window properties', function()
+		it('should resolve methods and properties and return nil for unknown keys', function()
+			local window = fenster.open(256, 144, 'Test', 2, 30, { headless = true })
+			finally(function() window:close() end)
+			assert.is_function(window.close)
+			assert.is_function(window.mouse)
+			assert.are_same({ window:mouse() }, { fenster.mouse(window) })
+			assert.are_equal(window.width, 256)
+			assert.are_equal(window.height, 144)
+			assert.are_equal(window.scale, 2)
+			assert.are_equal(window.targetfps, 30)
+			assert.are_equal(window.title, 'Test')
+			assert.are_equal(window.blend, 'replace')
+			assert.is_true(window.headless)
+			assert.is_nil(window.unknown)
+			assert.is_nil(window[1])
+		end)
+
+		it('should throw when the window is closed', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			window:close()
+			assert.has_error(function() return window.width end)
+		end)
+
+		it('should throw when called with something other than a window', function()
+			local window = fenster.open(256, 144, 'Test', 1, 60, { headless = true })
+			finally(function() window:close() end)
+			local index = getmetatable(window).__index
+			assert.has_error(function() index(fenster.surface(1, 1), 'width') end)
+			assert.has_error(function() index({}, 'width') end)
+		end)
+	end)
+
 	describe('window.width', function()
 		it('should be an integer and be the same as passed to open #needsdisplay', function()
 			local window = fenster.open(256, 144)
@@ -690,4 +2580,116 @@ describe('fenster', function()
 			assert.are_equal(window.targetfps, 30)
 		end)
 	end)
+
+	describe('window.shm', function()
+		it('should be a boolean #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_boolean(window.shm)
+		end)
+	end)
+
+	describe('window.headless', function()
+		it('should be false for a normal window #needsdisplay', function()
+			local window = fenster.open(256, 144)
+			finally(function() window:close() end)
+			assert.is_false(window.headless)
+		end)
+
+		it('should keep the frame pacing of a headless window', function()
+			local window = fenster.open(256, 144, 'Test', 1, 100, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			window:loop()
+			assert.is_true(window.delta >= 0.009)
+		end)
+	end)
+
+	describe('window.damage', function()
+		it('should count the whole window in the first frame', function()
+			local window = fenster.open(256, 144, 'Test', 2, 0, { headless = true })
+			finally(function() window:close() end)
+			assert.are_equal(window.damage, 0)
+			window:loop()
+			assert.are_equal(window.damage, 256 * 144)
+		end)
+
+		it('should be 0 if nothing changed', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			window:loop()
+			assert.are_equal(window.damage, 0)
+		end)
+
+		it('should only count the changed pixels', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			window:set(10, 10, 0xffffff)
+			window:set(11, 10, 0xffffff)
+			window:set(100, 100, 0xffffff)
+			window:loop()
+			assert.are_equal(window.damage, 3)
+			window:setregion(250, 140, 10, 10, string.rep('\0', 10 * 10 * 3))
+			window:loop()
+			assert.are_equal(window.damage, 6 * 4)
+			local surface = fenster.surface(8, 8)
+			surface:blit(window, -4, 0)
+			window:loop()
+			assert.are_equal(window.damage, 4 * 8)
+			window:clear()
+			window:set(0, 0, 0xffffff)
+			window:loop()
+			assert.are_equal(window.damage, 256 * 144)
+		end)
+
+		it('should merge many small changes into a bounded area', function()
+			local window = fenster.open(256, 144, 'Test', 1, 0, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			for i = 0, 99 do
+				window:set(i * 2, i, 0xffffff)
+			end
+			window:loop()
+			assert.is_true(window.damage >= 100)
+			assert.is_true(window.damage <= 200 * 100)
+		end)
+	end)
+
+	describe('window.missed', function()
+		it('should be 0 if the target fps is met', function()
+			local window = fenster.open(256, 144, 'Test', 1, 100, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			window:loop()
+			assert.are_equal(window.missed, 0)
+		end)
+
+		it('should count the missed frames and skip them', function()
+			local window = fenster.open(256, 144, 'Test', 1, 100, { headless = true })
+			finally(function() window:close() end)
+			window:loop()
+			fenster.sleep(32)
+			window:loop()
+			assert.is_true(window.missed >= 2)
+			local start = fenster.timens()
+			window:loop()
+			assert.are_equal(window.missed, 0)
+			assert.is_true(fenster.timens() - start >= 2 * 1000000)
+		end)
+
+		it('should catch up on missed frames with the catchup option', function()
+			local window = fenster.open(256, 144, 'Test', 1, 100, { headless = true, catchup = true })
+			finally(function() window:close() end)
+			window:loop()
+			fenster.sleep(35)
+			window:loop()
+			assert.is_true(window.missed >= 2)
+			local start = fenster.timens()
+			window:loop()
+			assert.is_true(window.missed >= 1)
+			assert.is_true(fenster.timens() - start < 5 * 1000000)
+		end)
+	end)
 end)
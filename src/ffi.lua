@@ -0,0 +1,29 @@
+--- LuaJIT FFI helper for writing pixels directly into the window buffer.
+--- Usage:
+---   local buffer = require('fenster.ffi').buffer
+---   local pixels, width, height, stride = buffer(window)
+---   pixels[y * stride + x] = 0xff0000
+--- With the 'buffers' option of fenster.open(...) the window buffer changes
+--- every frame, so get it again after every window:loop() or window:wait().
+--- Indexed windows hand out their palette indices instead, one byte per pixel:
+---   pixels[y * stride + x] = 42
+
+local ffi = require('ffi')
+
+local M = {}
+
+--- Get the window buffer as a uint32_t pointer, or as a uint8_t pointer to the
+--- palette indices for indexed windows.
+--- @param window userdata The open window
+--- @return ffi.cdata* pixels The first pixel of the window buffer
+--- @return integer width The width of the window in (unscaled) pixels
+--- @return integer height The height of the window in (unscaled) pixels
+--- @return integer stride The number of pixels from one row to the next
+--- @return integer scale The scale of the window
+function M.buffer(window)
+	local pointer, width, height, stride, scale = window:buffer()
+	local pointer_type = window.indexed and 'uint8_t *' or 'uint32_t *'
+	return ffi.cast(pointer_type, pointer), width, height, stride, scale
+end
+
+return M
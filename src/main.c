@@ -1,16 +1,89 @@
 #include "../include/main.h"
 
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <lauxlib.h>
 #include <lua.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../lib/compat-5.3/compat-5.3.h"
 #include "../lib/fenster/fenster.h"
 
+// threads for presenting asynchronously and for running the pixel kernels on
+// several cores, on Windows through the Win32 API (windows.h is already
+// included by fenster)
+#ifdef _WIN32
+typedef HANDLE thread_handle;
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+#define THREAD_MAIN(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN 0
+#define thread_start(p_thread, main, arg)                            \
+  ((*(p_thread) = CreateThread(NULL, 0, main, arg, 0, NULL)) == NULL \
+       ? (int)GetLastError()                                         \
+       : 0)
+#define thread_join(p_thread) \
+  (WaitForSingleObject(*(p_thread), INFINITE), CloseHandle(*(p_thread)))
+#define mutex_init(p_mutex) (InitializeCriticalSection(p_mutex), 0)
+#define mutex_destroy(p_mutex) DeleteCriticalSection(p_mutex)
+#define mutex_lock(p_mutex) EnterCriticalSection(p_mutex)
+#define mutex_unlock(p_mutex) LeaveCriticalSection(p_mutex)
+#define cond_init(p_cond) (InitializeConditionVariable(p_cond), 0)
+#define cond_destroy(p_cond) ((void)(p_cond))
+#define cond_wait(p_cond, p_mutex) \
+  SleepConditionVariableCS(p_cond, p_mutex, INFINITE)
+#define cond_signal(p_cond) WakeConditionVariable(p_cond)
+#define cond_broadcast(p_cond) WakeAllConditionVariable(p_cond)
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t thread_handle;
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+#define THREAD_MAIN(name, arg) static void *name(void *arg)
+#define THREAD_RETURN NULL
+#define thread_start(p_thread, main, arg) \
+  pthread_create(p_thread, NULL, main, arg)
+#define thread_join(p_thread) pthread_join(*(p_thread), NULL)
+#define mutex_init(p_mutex) pthread_mutex_init(p_mutex, NULL)
+#define mutex_destroy(p_mutex) pthread_mutex_destroy(p_mutex)
+#define mutex_lock(p_mutex) pthread_mutex_lock(p_mutex)
+#define mutex_unlock(p_mutex) pthread_mutex_unlock(p_mutex)
+#define cond_init(p_cond) pthread_cond_init(p_cond, NULL)
+#define cond_destroy(p_cond) pthread_cond_destroy(p_cond)
+#define cond_wait(p_cond, p_mutex) pthread_cond_wait(p_cond, p_mutex)
+#define cond_signal(p_cond) pthread_cond_signal(p_cond)
+#define cond_broadcast(p_cond) pthread_cond_broadcast(p_cond)
+#endif
+
+// AppKit only allows drawing from the main thread, so real windows on macOS
+// always present synchronously
+#if defined(__APPLE__)
+#define CAN_PRESENT_ASYNC(headless) (headless)
+#else
+#define CAN_PRESENT_ASYNC(headless) 1
+#endif
+
+// SSE2 is always available on x86-64, so we only need the scalar fallbacks
+// on other architectures
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is only used if the compiler is allowed to use it everywhere
+// (e.g. with -mavx2 or -march=native), since we don't detect it at runtime
+#if defined(__AVX2__)
+#define USE_AVX2
+#include <immintrin.h>
+#endif
+
 // Macros that ensure the same integer argument behavior in Lua 5.1/5.2
 // and 5.3/5.4. In Lua 5.1/5.2 luaL_checkinteger/luaL_optinteger normally floor
 // decimal numbers, while in Lua 5.3/5.4 they throw an error. These macros make
@@ -35,12 +108,23 @@ static const lua_Integer DEFAULT_SCALE = 1;
 /** Default target frames per second */
 static const lua_Number DEFAULT_TARGET_FPS = 60.0;
 
-/** Number of milliseconds per second */
-static const lua_Number MS_PER_SEC = 1000.0;
+/** Number of nanoseconds per second */
+static const lua_Number NS_PER_SEC = 1000000000.0;
+
+/** Number of nanoseconds per millisecond */
+static const int64_t NS_PER_MS = 1000000;
+
+/**
+ * Time before a frame deadline from which the frame pacing busy-waits instead
+ * of sleeping, since sleeping can overshoot by about a millisecond
+ */
+static const int64_t SPIN_NS = 1000000;
 
 /** Length of the fenster->keys array */
-static const int KEYS_LENGTH = sizeof(((struct fenster *)0)->keys) /
-                               sizeof(((struct fenster *)0)->keys[0]);
+enum {
+  KEYS_LENGTH = sizeof(((struct fenster *)0)->keys) /
+                sizeof(((struct fenster *)0)->keys[0])
+};
 
 /** Maximum width/height of the window */
 static const lua_Integer MAX_DIMENSION = 15360;
@@ -48,26 +132,306 @@ static const lua_Integer MAX_DIMENSION = 15360;
 /** Maximum color value */
 static const lua_Integer MAX_COLOR = 0xffffff;
 
+/** Maximum color value including the alpha component */
+static const lua_Integer MAX_ALPHA_COLOR = 0xffffffff;
+
 /** Maximum value of a color component (r, g or b) */
 static const lua_Integer MAX_COLOR_COMPONENT = 0xff;
 
+/** Bit offset of the alpha component in a color value */
+static const lua_Integer COLOR_ALPHA_OFFSET = 24;
+
 /** Bit offset of the red color component in a color value */
 static const lua_Integer COLOR_RED_OFFSET = 16;
 
 /** Bit offset of the green color component in a color value */
 static const lua_Integer COLOR_GREEN_OFFSET = 8;
 
+/** Size of a packed native-endian color in a string */
+static const size_t PACKED_COLOR_SIZE = sizeof(uint32_t);
+
+/** Size of a packed RGB color in a string */
+static const size_t PACKED_RGB_SIZE = 3;
+
 /** Name of the window userdata and metatable */
 static const char *WINDOW_METATABLE = "window*";
 
+/** Name of the surface userdata and metatable */
+static const char *SURFACE_METATABLE = "surface*";
+
+/** Name of the font userdata and metatable */
+static const char *FONT_METATABLE = "font*";
+
+/** Maximum width of a font glyph (a glyph row has to fit into a bit mask) */
+static const lua_Integer MAX_GLYPH_WIDTH = 32;
+
+/** Maximum height of a font glyph */
+static const lua_Integer MAX_GLYPH_HEIGHT = 128;
+
+/** Number of different characters (bytes) in a string */
+static const lua_Integer CHARACTERS = 256;
+
+/** Maximum absolute value of a coordinate that may be outside of bounds */
+static const lua_Integer MAX_COORDINATE = 0x7fffffff;
+
+/** Number of pixels from which fills bypass the cache (4 MiB) */
+static const size_t STREAM_FILL_PIXELS = (size_t)1 << 20;
+
+/** Number of bytes from which the pixel kernels are split across threads */
+static const size_t PARALLEL_MIN_BYTES = (size_t)1 << 20;
+
+/** Maximum number of threads running the pixel kernels */
+enum { MAX_THREADS = 64 };
+
+/** Registry key of the userdata that stops the worker threads when closed */
+static const char *THREADS_REGISTRY_KEY = "fenster.threads";
+
+/** Environment variable that makes all windows headless by default */
+static const char *HEADLESS_ENV = "FENSTER_HEADLESS";
+
+/** Maximum number of separate damaged rectangles tracked per frame */
+enum { MAX_DAMAGE_RECTS = 16 };
+
+/** Maximum number of input events queued per frame */
+enum { MAX_QUEUED_EVENTS = 256 };
+
+/** Maximum number of window buffers when presenting asynchronously */
+enum { MAX_BUFFERS = 3 };
+
+/** What a window buffer is currently used for */
+enum buffer_state {
+  BUFFER_FREE,        // can be drawn into next
+  BUFFER_DRAWING,     // Lua draws into it
+  BUFFER_QUEUED,      // waits for the present thread
+  BUFFER_PRESENTING,  // the present thread reads it
+};
+
+/** Number of colors in the palette of an indexed window */
+enum { PALETTE_SIZE = 256 };
+
+/** Maximum number of frames the rolling frame statistics can cover */
+enum { MAX_STATS_FRAMES = 1024 };
+
+/** Default number of frames the rolling frame statistics cover */
+static const lua_Integer DEFAULT_STATS_FRAMES = 120;
+
+/** Maximum number of frame slots of a recording */
+enum { MAX_RECORD_SLOTS = 64 };
+
+/** Default number of frame slots of a recording */
+static const lua_Integer DEFAULT_RECORD_SLOTS = 8;
+
+/** Maximum frame rate written into the header of a recording */
+static const lua_Integer MAX_RECORD_FPS = 1000;
+
+/** How drawn colors are combined with the pixels they are drawn over */
+enum blend_mode {
+  BLEND_REPLACE,       // overwrite the pixels, including their alpha
+  BLEND_ALPHA,         // alpha-over
+  BLEND_ADD,           // add the color weighted by its alpha
+  BLEND_MULTIPLY,      // multiply with the color weighted by its alpha
+  BLEND_ALPHA_PRE,     // like BLEND_ALPHA, but the color is premultiplied
+  BLEND_ADD_PRE,       // like BLEND_ADD, but the color is premultiplied
+  BLEND_MULTIPLY_PRE,  // like BLEND_MULTIPLY, but the color is premultiplied
+};
+
+/** Names of the blend modes, indexed by the blend mode */
+static const char *const BLEND_MODE_NAMES[] = {
+    "replace",  "alpha",   "add",         "multiply",
+    "alphapre", "addpre",  "multiplypre", NULL,
+};
+
+/** File formats a window can be recorded to */
+enum record_format {
+  RECORD_Y4M,  // YUV4MPEG2, full range YCbCr with 4:2:0 chroma subsampling
+  RECORD_RGB,  // raw 8-bit RGB without any header
+};
+
+/** Names of the recording formats, indexed by the recording format */
+static const char *const RECORD_FORMAT_NAMES[] = {"y4m", "rgb", NULL};
+
+/** File formats a window or surface can be saved as */
+enum image_format {
+  IMAGE_PPM,  // binary PPM (P6)
+  IMAGE_QOI,  // QOI with 3 channels
+  IMAGE_BMP,  // uncompressed 24-bit BMP
+};
+
+/** Names of the image formats, indexed by the image format */
+static const char *const IMAGE_FORMAT_NAMES[] = {"ppm", "qoi", "bmp", NULL};
+
+/** Names of the input events, indexed by the fenster event type */
+static const char *EVENT_NAMES[] = {
+    [FENSTER_KEYDOWN] = "keydown",     [FENSTER_KEYUP] = "keyup",
+    [FENSTER_MOUSEDOWN] = "mousedown", [FENSTER_MOUSEUP] = "mouseup",
+    [FENSTER_MOUSEMOVE] = "mousemove", [FENSTER_MOD] = "mod",
+};
+
+/** Properties of the window userdata */
+enum window_property {
+  WINDOW_KEYS,
+  WINDOW_DELTA,
+  WINDOW_MOUSE_X,
+  WINDOW_MOUSE_Y,
+  WINDOW_MOUSE_DOWN,
+  WINDOW_MOD_CONTROL,
+  WINDOW_MOD_SHIFT,
+  WINDOW_MOD_ALT,
+  WINDOW_MOD_GUI,
+  WINDOW_WIDTH,
+  WINDOW_HEIGHT,
+  WINDOW_TITLE,
+  WINDOW_SCALE,
+  WINDOW_TARGET_FPS,
+  WINDOW_SHM,
+  WINDOW_HEADLESS,
+  WINDOW_DAMAGE,
+  WINDOW_MISSED,
+  WINDOW_BLEND,
+  WINDOW_INDEXED,
+};
+
+/** Names of the window properties, indexed by the window property */
+static const char *const WINDOW_PROPERTY_NAMES[] = {
+    "keys",        "delta",       "mousex",      "mousey",      "mousedown",
+    "modcontrol",  "modshift",    "modalt",      "modgui",      "width",
+    "height",      "title",       "scale",       "targetfps",   "shm",
+    "headless",    "damage",      "missed",      "blend",       "indexed",
+    NULL,
+};
+
+/** Input event that happened during the last frame */
+typedef struct input_event {
+  int type;       // one of the fenster event types
+  int code;       // key, mouse button or modifier mask
+  lua_Integer x;  // scaled mouse position at the time of the event
+  lua_Integer y;
+  int64_t time;  // milliseconds, same clock as fenster.time()
+} input_event;
+
+/** Time spent in each phase of a frame, in nanoseconds */
+typedef struct frame_timing {
+  int64_t work;     // between the previous and this frame, i.e. Lua code
+  int64_t sleep;    // pacing the frame or waiting for events
+  int64_t present;  // scaling and sending the damaged rectangles
+  int64_t events;   // processing the pending events
+} frame_timing;
+
+/** Rectangle of the window that changed since the last frame */
+typedef struct damage_rect {
+  lua_Integer left;
+  lua_Integer top;
+  lua_Integer right;   // exclusive
+  lua_Integer bottom;  // exclusive
+} damage_rect;
+
+/** Finished window buffer waiting for the present thread */
+typedef struct present_frame {
+  int buffer;  // index into the buffers of the presenter
+  damage_rect damage[MAX_DAMAGE_RECTS];
+  int damage_count;
+} present_frame;
+
+/** State shared between a window and its present thread */
+typedef struct presenter {
+  thread_handle thread;
+  thread_mutex mutex;
+  thread_cond frame_queued;  // a frame was queued or the thread should stop
+  thread_cond buffer_freed;  // the present thread is done with a buffer
+  uint32_t *buffers[MAX_BUFFERS];
+  enum buffer_state buffer_states[MAX_BUFFERS];
+  int buffer_count;
+  present_frame queue[MAX_BUFFERS];  // ring buffer, oldest frame first
+  int queue_first;
+  int queue_count;
+  int preserve;  // copy the finished buffer into the next one
+  int drop;      // drop queued frames instead of waiting for a free buffer
+  int stop;
+  lua_Integer presented_bytes;  // since the window last collected them
+} presenter;
+
+/** State shared between a window and its recording thread */
+typedef struct recorder {
+  thread_handle thread;
+  thread_mutex mutex;
+  thread_cond frame_queued;  // a frame was queued or the thread should stop
+  FILE *file;
+  int format;
+  lua_Integer width;
+  lua_Integer height;
+  uint32_t *slots;  // slot_count snapshots of the window buffer
+  int slot_count;
+  int queue_first;  // ring buffer of slots, oldest frame first
+  int queue_count;  // including the frame that is being written
+  int stop;
+  int error;  // of the first failed write, nothing is written afterwards
+  lua_Integer written_frames;
+  lua_Integer dropped_frames;
+  uint8_t *encoded;  // one encoded frame, only used by the recording thread
+  size_t encoded_size;
+} recorder;
+
+/** Pixel kernel that processes the rows from first to last (exclusive) */
+typedef void (*row_kernel)(void *p_args, lua_Integer first, lua_Integer last);
+
+/** Worker threads that run the pixel kernels in bands of rows */
+typedef struct thread_pool {
+  thread_mutex dispatch_mutex;  // only one kernel runs on the pool at a time
+  thread_mutex mutex;
+  thread_cond work_queued;  // a kernel was dispatched or the workers stop
+  thread_cond work_done;    // the last band of a kernel is finished
+  thread_handle workers[MAX_THREADS - 1];
+  unsigned worker_generations[MAX_THREADS - 1];  // last kernel of each worker
+  int thread_count;  // including the thread that dispatches a kernel
+  unsigned generation;  // incremented for every dispatched kernel
+  row_kernel kernel;
+  void *p_args;
+  lua_Integer rows;
+  int bands;    // number of threads working on the current kernel
+  int pending;  // bands of the current kernel the workers haven't finished
+  int stop;
+} thread_pool;
+
 /** Userdata representing the fenster window */
 typedef struct window {
   // "private" members
   struct fenster *p_fenster;
+  presenter *p_presenter;  // NULL if presenting synchronously
+  recorder *p_recorder;    // NULL if not recording
   int keys_ref;
-  int64_t target_frame_time;
-  int64_t start_frame_time;
-  size_t scaled_pixels;
+  int headless;
+  int catchup;
+  int64_t target_frame_time;  // nanoseconds, 0 if not limited
+  int64_t start_frame_time;   // nanoseconds, 0 before the first frame
+  int64_t frame_deadline;     // nanoseconds, when the next frame should start
+  uint32_t *pixels;  // unscaled, might be the fenster buffer if not scaled
+  size_t pixels_length;
+  uint8_t *indices;  // what indexed windows draw into, NULL otherwise
+  uint32_t palette[PALETTE_SIZE];  // expands the indices into the pixels
+  damage_rect damage[MAX_DAMAGE_RECTS];  // never overlapping or touching
+  int damage_count;
+  input_event events[MAX_QUEUED_EVENTS];  // events of the last frame
+  int event_count;
+  uint8_t keys[KEYS_LENGTH];      // state of the keys table in the registry
+  uint8_t pressed[KEYS_LENGTH];   // keys pressed during the last frame
+  uint8_t released[KEYS_LENGTH];  // keys released during the last frame
+  // input received since the last frame, not visible to Lua yet (the events
+  // of all windows are processed together, so this can fill up while other
+  // windows process their events)
+  input_event pending_events[MAX_QUEUED_EVENTS];
+  int pending_event_count;
+  uint8_t pending_pressed[KEYS_LENGTH];
+  uint8_t pending_released[KEYS_LENGTH];
+  frame_timing timing;            // phases of the last frame
+  int64_t frame_end_time;         // nanoseconds, when the last frame ended
+  int64_t frame_history[MAX_STATS_FRAMES];  // ring buffer of frame times
+  int64_t work_history[MAX_STATS_FRAMES];   // ring buffer of work times
+  int history_length;                       // number of frames to keep
+  int history_count;
+  int history_next;
+  int64_t budget;  // nanoseconds, 0 if there is no budget callback
+  int budget_ref;
+  int direct_access;  // the buffer was handed out, present all of it
 
   // "public" members
   lua_Number delta;
@@ -81,8 +445,38 @@ typedef struct window {
   lua_Integer height;
   lua_Integer scale;
   lua_Number target_fps;
+  lua_Integer damaged_pixels;
+  lua_Integer missed_frames;
+  lua_Integer total_frames;
+  lua_Integer total_missed_frames;
+  lua_Integer total_presented_bytes;
+  lua_Integer total_dropped_frames;
+  int blend;  // blend mode of everything drawn into the window
 } window;
 
+/** Userdata representing an offscreen surface */
+typedef struct surface {
+  // "private" members
+  uint32_t *pixels;  // points right behind the struct in the same userdata
+
+  // "public" members
+  lua_Integer width;
+  lua_Integer height;
+  int blend;  // blend mode of everything drawn into the surface
+} surface;
+
+/** Userdata representing a bitmap font */
+typedef struct font {
+  // "private" members
+  const uint32_t *rows;  // one bit mask per glyph row, lowest bit is leftmost
+  lua_Integer first;     // character of the first glyph
+  lua_Integer count;     // number of glyphs
+
+  // "public" members
+  lua_Integer width;
+  lua_Integer height;
+} font;
+
 /*
 // Utility function to dump the Lua stack for debugging
 static void _dumpstack(lua_State *L) {
@@ -119,424 +513,5208 @@ static lua_Integer check_dimension(lua_State *L, int index) {
   return dimension;
 }
 
+/** Options for opening a window, read from the options table */
+typedef struct window_options {
+  int headless;
+  int catchup;
+  lua_Integer stats_frames;
+  lua_Integer buffers;
+  int preserve;
+  int drop_frames;
+  int indexed;
+} window_options;
+
 /**
- * Opens a window with the given width, height, title, scale and target FPS.
- * Returns a userdata representing the window with all the methods and
- * properties we defined on the metatable.
+ * Utility function to get an optional boolean field from the options table on
+ * the Lua stack.
  * @param L Lua state
- * @return Number of return values on the Lua stack
+ * @param index Index of the options table on the Lua stack
+ * @param field Name of the field
+ * @param def Default value if the field is nil
+ * @return The boolean value of the field
  */
-static int lfenster_open(lua_State *L) {
-  const lua_Integer width = check_dimension(L, 1);
-  const lua_Integer height = check_dimension(L, 2);
-  const char *title = luaL_optstring(L, 3, DEFAULT_TITLE);
-  const lua_Integer scale = luaL_optinteger(L, 4, DEFAULT_SCALE);
-  luaL_argcheck(L, (scale & (scale - 1)) == 0, 4, "scale must be a power of 2");
-  const lua_Number target_fps = luaL_optnumber(L, 5, DEFAULT_TARGET_FPS);
-  luaL_argcheck(L, target_fps >= 0.0, 5, "target fps must be non-negative");
+static int opt_boolean_field(lua_State *L, int index, const char *field,
+                             int def) {
+  lua_getfield(L, index, field);
+  int value = def;
+  if (!lua_isnil(L, -1)) {
+    if (!lua_isboolean(L, -1)) {
+      luaL_argerror(L, index,
+                    lua_pushfstring(L, "%s option must be a boolean", field));
+    }
+    value = lua_toboolean(L, -1);
+  }
+  lua_pop(L, 1);
+  return value;
+}
 
-  // calculate the scaled width, scaled height and amount of pixels
-  const size_t scaled_width = width * scale;
-  const size_t scaled_height = height * scale;
-  const size_t scaled_pixels = scaled_width * scaled_height;
+/**
+ * Utility function to get an optional integer field from the options table on
+ * the Lua stack and check if it's within the given range.
+ * @param L Lua state
+ * @param index Index of the options table on the Lua stack
+ * @param field Name of the field
+ * @param def Default value if the field is nil
+ * @param min Minimum allowed value
+ * @param max Maximum allowed value
+ * @return The integer value of the field
+ */
+static lua_Integer opt_integer_field(lua_State *L, int index,
+                                     const char *field, lua_Integer def,
+                                     lua_Integer min, lua_Integer max) {
+  lua_getfield(L, index, field);
+  lua_Integer value = def;
+  if (!lua_isnil(L, -1)) {
+    int is_integer = 0;
+    value = lua_tointegerx(L, -1, &is_integer);
+    if (!is_integer || value < min || value > max) {
+      luaL_argerror(
+          L, index,
+          lua_pushfstring(L, "%s option must be an integer in range %d-%d",
+                          field, (int)min, (int)max));
+    }
+  }
+  lua_pop(L, 1);
+  return value;
+}
 
-  // allocate memory for the window buffer
-  uint32_t *buffer = calloc(scaled_pixels, sizeof(uint32_t));
-  if (buffer == NULL) {
-    const int error = errno;
-    return luaL_error(
-        L, "failed to allocate memory of size %d for window buffer (%d)",
-        scaled_pixels * sizeof(uint32_t), error);
+/**
+ * Utility function to read the optional options table from the Lua stack.
+ * Options that are not set in the table fall back to their defaults, which
+ * might come from environment variables.
+ * @param L Lua state
+ * @param index Index of the options table on the Lua stack
+ * @param p_options The options struct to fill
+ */
+static void check_options(lua_State *L, int index, window_options *p_options) {
+  // the FENSTER_HEADLESS environment variable can be set to anything other
+  // than an empty string or "0" to make windows headless by default
+  const char *headless_env = getenv(HEADLESS_ENV);
+  p_options->headless = headless_env != NULL && headless_env[0] != '\0' &&
+                        strcmp(headless_env, "0") != 0;
+  p_options->catchup = 0;
+  p_options->stats_frames = DEFAULT_STATS_FRAMES;
+  p_options->buffers = 0;
+  p_options->preserve = 1;
+  p_options->drop_frames = 0;
+  p_options->indexed = 0;
+
+  if (lua_isnoneornil(L, index)) {
+    return;
   }
+  luaL_checktype(L, index, LUA_TTABLE);
+  p_options->headless =
+      opt_boolean_field(L, index, "headless", p_options->headless);
+  p_options->catchup =
+      opt_boolean_field(L, index, "catchup", p_options->catchup);
+  p_options->stats_frames =
+      opt_integer_field(L, index, "statsframes", p_options->stats_frames, 1,
+                        MAX_STATS_FRAMES);
+  p_options->buffers = opt_integer_field(L, index, "buffers",
+                                         p_options->buffers, 0, MAX_BUFFERS);
+  p_options->preserve =
+      opt_boolean_field(L, index, "preserve", p_options->preserve);
+  p_options->drop_frames =
+      opt_boolean_field(L, index, "dropframes", p_options->drop_frames);
+  p_options->indexed =
+      opt_boolean_field(L, index, "indexed", p_options->indexed);
+}
 
-  // use a temporary fenster struct to copy into the "real" one later
-  // (width and height use narrow casts to int, but we made sure it's in range)
-  struct fenster temp_fenster = {
-      .title = title,
-      .width = (int)scaled_width,
-      .height = (int)scaled_height,
-      .buf = buffer,
-  };
+/**
+ * Utility function to close the fenster window. Headless windows don't have a
+ * real window, so there is nothing to close.
+ * @param p_fenster The fenster struct
+ * @param headless Whether the window is headless
+ */
+static void close_fenster(struct fenster *p_fenster, int headless) {
+  if (!headless) {
+    fenster_close(p_fenster);  // also frees the fenster buffer
+  }
+}
 
-  // allocate memory for the "real" fenster struct
-  struct fenster *p_fenster = malloc(sizeof(struct fenster));
-  if (p_fenster == NULL) {
-    const int error = errno;
-    free(buffer);
-    buffer = NULL;
-    return luaL_error(L, "failed to allocate memory of size %d for window (%d)",
-                      sizeof(struct fenster), error);
+/**
+ * Event callback for fenster. Remembers pressed and released keys and queues
+ * the event, so several changes of the same key within one frame are not lost.
+ * Events beyond the queue length are dropped, but still update the key state.
+ * Everything goes into the pending input of the window, which becomes visible
+ * with its next frame.
+ * @param p_fenster The fenster struct, the window is stored as its userdata
+ * @param type The fenster event type
+ * @param code The key, mouse button or modifier mask
+ * @param time When the event happened, in milliseconds (fenster_time clock)
+ */
+static void queue_event(struct fenster *p_fenster, int type, int code,
+                        int64_t time) {
+  window *p_window = p_fenster->userdata;
+  if (type == FENSTER_KEYDOWN) {
+    p_window->pending_pressed[code] = 1;
+  } else if (type == FENSTER_KEYUP) {
+    p_window->pending_released[code] = 1;
   }
 
-  // copy temporary fenster struct into the "real" one
-  // (we have to do it this way because width and height are const)
-  memcpy(p_fenster, &temp_fenster, sizeof(struct fenster));
+  if (p_window->pending_event_count < MAX_QUEUED_EVENTS) {
+    input_event *p_event =
+        &p_window->pending_events[p_window->pending_event_count++];
+    p_event->type = type;
+    p_event->code = code;
+    p_event->x = p_fenster->x / p_window->scale;
+    p_event->y = p_fenster->y / p_window->scale;
+    p_event->time = time;
+  }
+}
 
-  // open window and check success
-  const int result = fenster_open(p_fenster);
+/** Worker threads shared by all windows and surfaces, initialized once */
+static thread_pool pool = {.thread_count = 1};
+static int pool_initialized = 0;
+
+/**
+ * Utility function to get the first row of a band when splitting rows into
+ * equally large bands.
+ * @param rows Number of rows
+ * @param band Index of the band
+ * @param bands Number of bands
+ * @return The first row of the band, or rows for band == bands
+ */
+static lua_Integer band_start(lua_Integer rows, int band, int bands) {
+  return rows * band / bands;
+}
+
+/**
+ * Main function of a worker thread. Waits for kernels and runs its band of
+ * each until the pool stops. The thread index is passed as the argument.
+ * @param p_index Pointer-sized index of the worker, starting at 1
+ */
+THREAD_MAIN(worker_thread_main, p_index) {
+  const int index = (int)(intptr_t)p_index;
+  mutex_lock(&pool.mutex);
+  unsigned seen = pool.worker_generations[index - 1];
+  for (;;) {
+    while (!pool.stop && pool.generation == seen) {
+      cond_wait(&pool.work_queued, &pool.mutex);
+    }
+    if (pool.stop) {
+      break;
+    }
+    seen = pool.generation;
+    if (index >= pool.bands) {
+      continue;  // the kernel has fewer rows than there are threads
+    }
+
+    const row_kernel kernel = pool.kernel;
+    void *p_args = pool.p_args;
+    const lua_Integer first = band_start(pool.rows, index, pool.bands);
+    const lua_Integer last = band_start(pool.rows, index + 1, pool.bands);
+    mutex_unlock(&pool.mutex);
+    kernel(p_args, first, last);
+    mutex_lock(&pool.mutex);
+    if (--pool.pending == 0) {
+      cond_signal(&pool.work_done);
+    }
+  }
+  mutex_unlock(&pool.mutex);
+  return THREAD_RETURN;
+}
+
+/**
+ * Utility function to stop all worker threads of the pool. The caller has to
+ * hold the dispatch mutex.
+ */
+static void stop_workers(void) {
+  mutex_lock(&pool.mutex);
+  pool.stop = 1;
+  cond_broadcast(&pool.work_queued);
+  mutex_unlock(&pool.mutex);
+  for (int i = 1; i < pool.thread_count; i++) {
+    thread_join(&pool.workers[i - 1]);
+  }
+  pool.stop = 0;
+  pool.thread_count = 1;
+}
+
+/**
+ * Utility function to change the number of threads running the pixel
+ * kernels. Waits for a running kernel and replaces all worker threads.
+ * @param thread_count The new number of threads, including the caller
+ * @return 0 on success, otherwise an error code (only 1 thread is left then)
+ */
+static int set_thread_count(int thread_count) {
+  mutex_lock(&pool.dispatch_mutex);
+  stop_workers();
+  int result = 0;
+  for (int i = 1; i < thread_count; i++) {
+    pool.worker_generations[i - 1] = pool.generation;
+    result = thread_start(&pool.workers[i - 1], worker_thread_main,
+                          (void *)(intptr_t)i);
+    if (result != 0) {
+      break;
+    }
+    pool.thread_count = i + 1;
+  }
   if (result != 0) {
-    free(buffer);
-    buffer = NULL;
-    free(p_fenster);
-    p_fenster = NULL;
-    return luaL_error(L, "failed to open window (%d)", result);
+    stop_workers();
   }
+  mutex_unlock(&pool.dispatch_mutex);
+  return result;
+}
 
-  // initialize the keys table and put it in the registry
-  lua_createtable(L, KEYS_LENGTH, 0);
-  for (int i = 0; i < KEYS_LENGTH; i++) {
-    lua_pushboolean(L, 0);
-    lua_rawseti(L, -2, i);
+/**
+ * Utility function to run a pixel kernel over the given number of rows. Large
+ * kernels are split into one band of rows per thread, the calling thread
+ * processes the first band itself. Small kernels run on the calling thread
+ * only, since waking the workers would take longer than the work itself.
+ * @param kernel The kernel, has to write disjoint memory for different rows
+ * @param p_args The arguments of the kernel
+ * @param rows Number of rows
+ * @param bytes Number of bytes the kernel writes in total
+ */
+static void parallel_rows(row_kernel kernel, void *p_args, lua_Integer rows,
+                          size_t bytes) {
+  // (reading the thread count without the lock is fine, it is only a hint)
+  if (pool.thread_count == 1 || rows < 2 || bytes < PARALLEL_MIN_BYTES) {
+    kernel(p_args, 0, rows);
+    return;
   }
-  lua_pushvalue(L, -1);  // copy the keys table since luaL_ref pops it
-  const int keys_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-  if (keys_ref == LUA_REFNIL || keys_ref == LUA_NOREF) {
-    fenster_close(p_fenster);
-    free(buffer);
-    buffer = NULL;
-    free(p_fenster);
-    p_fenster = NULL;
-    return luaL_error(L, "failed to create keys table (%d)", keys_ref);
+
+  mutex_lock(&pool.dispatch_mutex);
+  const int bands =
+      rows < pool.thread_count ? (int)rows : pool.thread_count;
+  mutex_lock(&pool.mutex);
+  pool.kernel = kernel;
+  pool.p_args = p_args;
+  pool.rows = rows;
+  pool.bands = bands;
+  pool.pending = bands - 1;
+  pool.generation++;
+  cond_broadcast(&pool.work_queued);
+  mutex_unlock(&pool.mutex);
+
+  kernel(p_args, 0, band_start(rows, 1, bands));
+
+  mutex_lock(&pool.mutex);
+  while (pool.pending > 0) {
+    cond_wait(&pool.work_done, &pool.mutex);
   }
-  lua_rawseti(L, LUA_REGISTRYINDEX, keys_ref);
+  mutex_unlock(&pool.mutex);
+  mutex_unlock(&pool.dispatch_mutex);
+}
 
-  // create the window userdata and initialize it
-  window *p_window = lua_newuserdata(L, sizeof(window));
-  p_window->p_fenster = p_fenster;
-  p_window->keys_ref = keys_ref;
-  p_window->target_frame_time =
-      target_fps ? llroundl(MS_PER_SEC / target_fps) : 0;
-  p_window->start_frame_time = 0;
-  p_window->scaled_pixels = scaled_pixels;
-  p_window->delta = 0.0;
-  p_window->scaled_mouse_x = 0;
-  p_window->scaled_mouse_y = 0;
-  p_window->mod_control = 0;
-  p_window->mod_shift = 0;
-  p_window->mod_alt = 0;
-  p_window->mod_gui = 0;
-  p_window->width = width;
-  p_window->height = height;
-  p_window->scale = scale;
-  p_window->target_fps = target_fps;
-  luaL_setmetatable(L, WINDOW_METATABLE);
-  return 1;
+/**
+ * Utility function to divide by 255 with rounding, exact for x <= 255 * 255.
+ * @param x The dividend
+ * @return The quotient
+ */
+static uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
 }
 
 /**
- * Pauses for a given number of milliseconds.
- * @param L Lua state
- * @return Number of return values on the Lua stack
+ * Utility function to blend a color over a pixel. All four components
+ * (including alpha) go through the same operation on the premultiplied color:
+ * alpha-over computes color + pixel * (1 - alpha), add computes color + pixel
+ * and multiply computes pixel * (color + 1 - alpha), which keeps the alpha of
+ * the pixel. Results are clamped to 255.
+ * @param dst The pixel
+ * @param src The color (0xAARRGGBB)
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ * @return The blended pixel
  */
-static int lfenster_sleep(lua_State *L) {
-  const lua_Integer milliseconds = luaL_checkinteger(L, 1);
+static uint32_t blend_pixel(uint32_t dst, uint32_t src, int mode) {
+  const uint32_t alpha = src >> COLOR_ALPHA_OFFSET;
+  if (mode < BLEND_ALPHA_PRE) {
+    src = (alpha << COLOR_ALPHA_OFFSET) |
+          (div255(((src >> COLOR_RED_OFFSET) & 0xff) * alpha)
+           << COLOR_RED_OFFSET) |
+          (div255(((src >> COLOR_GREEN_OFFSET) & 0xff) * alpha)
+           << COLOR_GREEN_OFFSET) |
+          div255((src & 0xff) * alpha);
+  } else {
+    mode -= BLEND_ALPHA_PRE - BLEND_ALPHA;
+  }
 
-  fenster_sleep(milliseconds);
+  uint32_t result = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    const uint32_t s = (src >> shift) & 0xff;
+    const uint32_t d = (dst >> shift) & 0xff;
+    uint32_t component;
+    if (mode == BLEND_ALPHA) {
+      component = s + div255(d * (255 - alpha));
+    } else if (mode == BLEND_ADD) {
+      component = s + d;
+    } else {
+      const uint32_t factor = s + 255 - alpha;
+      component = div255(d * (factor > 255 ? 255 : factor));
+    }
+    result |= (component > 255 ? 255 : component) << shift;
+  }
+  return result;
+}
 
-  return 0;
+#ifdef USE_SSE2
+/**
+ * Utility function to divide eight 16-bit lanes by 255 with rounding.
+ * @param x The dividends, each <= 255 * 255
+ * @return The quotients
+ */
+static __m128i div255_epi16(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
 }
 
 /**
- * Returns the current time in milliseconds.
- * @param L Lua state
- * @return Number of return values on the Lua stack
+ * Utility function to blend two colors over two pixels, widened to one 16-bit
+ * lane per component. Same operations as blend_pixel.
+ * @param dst The pixels
+ * @param src The colors
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ * @return The blended pixels, might exceed 255 (pack with saturation)
  */
-static int lfenster_time(lua_State *L) {
-  lua_pushinteger(L, fenster_time());
-  return 1;
+static __m128i blend_epi16(__m128i dst, __m128i src, int mode) {
+  const __m128i max = _mm_set1_epi16(255);
+  // (the alpha is the highest component of each pixel, lanes 3 and 7)
+  const __m128i alpha =
+      _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+  if (mode < BLEND_ALPHA_PRE) {
+    const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    src = _mm_or_si128(
+        _mm_and_si128(alpha_lanes, alpha),
+        _mm_andnot_si128(alpha_lanes,
+                         div255_epi16(_mm_mullo_epi16(src, alpha))));
+  } else {
+    mode -= BLEND_ALPHA_PRE - BLEND_ALPHA;
+  }
+
+  if (mode == BLEND_ALPHA) {
+    return _mm_add_epi16(
+        src, div255_epi16(_mm_mullo_epi16(dst, _mm_sub_epi16(max, alpha))));
+  }
+  if (mode == BLEND_ADD) {
+    return _mm_add_epi16(src, dst);
+  }
+  const __m128i factor =
+      _mm_min_epi16(_mm_add_epi16(src, _mm_sub_epi16(max, alpha)), max);
+  return div255_epi16(_mm_mullo_epi16(dst, factor));
+}
+
+/**
+ * Utility function to blend four colors over four pixels.
+ * @param dst The pixels
+ * @param src The colors
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ * @return The blended pixels
+ */
+static __m128i blend_epi32(__m128i dst, __m128i src, int mode) {
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_packus_epi16(blend_epi16(_mm_unpacklo_epi8(dst, zero),
+                                      _mm_unpacklo_epi8(src, zero), mode),
+                          blend_epi16(_mm_unpackhi_epi8(dst, zero),
+                                      _mm_unpackhi_epi8(src, zero), mode));
+}
+#endif
+
+#ifdef USE_AVX2
+/**
+ * Utility function to divide sixteen 16-bit lanes by 255 with rounding.
+ * @param x The dividends, each <= 255 * 255
+ * @return The quotients
+ */
+static __m256i div255_epi16_avx2(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+/**
+ * Utility function to blend four colors over four pixels, widened to one
+ * 16-bit lane per component. Same operations as blend_pixel.
+ * @param dst The pixels
+ * @param src The colors
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ * @return The blended pixels, might exceed 255 (pack with saturation)
+ */
+static __m256i blend_epi16_avx2(__m256i dst, __m256i src, int mode) {
+  const __m256i max = _mm256_set1_epi16(255);
+  const __m256i alpha =
+      _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xff), 0xff);
+  if (mode < BLEND_ALPHA_PRE) {
+    const __m256i alpha_lanes = _mm256_set_epi16(
+        -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+    src = _mm256_or_si256(
+        _mm256_and_si256(alpha_lanes, alpha),
+        _mm256_andnot_si256(alpha_lanes,
+                            div255_epi16_avx2(_mm256_mullo_epi16(src, alpha))));
+  } else {
+    mode -= BLEND_ALPHA_PRE - BLEND_ALPHA;
+  }
+
+  if (mode == BLEND_ALPHA) {
+    return _mm256_add_epi16(
+        src, div255_epi16_avx2(
+                 _mm256_mullo_epi16(dst, _mm256_sub_epi16(max, alpha))));
+  }
+  if (mode == BLEND_ADD) {
+    return _mm256_add_epi16(src, dst);
+  }
+  const __m256i factor = _mm256_min_epi16(
+      _mm256_add_epi16(src, _mm256_sub_epi16(max, alpha)), max);
+  return div255_epi16_avx2(_mm256_mullo_epi16(dst, factor));
+}
+
+/**
+ * Utility function to blend eight colors over eight pixels.
+ * @param dst The pixels
+ * @param src The colors
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ * @return The blended pixels
+ */
+static __m256i blend_epi32_avx2(__m256i dst, __m256i src, int mode) {
+  const __m256i zero = _mm256_setzero_si256();
+  // (unpacking and packing both work within 128-bit lanes, so the pixels
+  // end up in their original order)
+  return _mm256_packus_epi16(
+      blend_epi16_avx2(_mm256_unpacklo_epi8(dst, zero),
+                       _mm256_unpacklo_epi8(src, zero), mode),
+      blend_epi16_avx2(_mm256_unpackhi_epi8(dst, zero),
+                       _mm256_unpackhi_epi8(src, zero), mode));
+}
+#endif
+
+/**
+ * Utility function to blend a row of colors over a row of pixels. The rows
+ * must not overlap.
+ * @param dst The first pixel
+ * @param src The first color
+ * @param length Number of pixels
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ */
+static void blend_row(uint32_t *dst, const uint32_t *src, size_t length,
+                      int mode) {
+  size_t i = 0;
+#if defined(USE_AVX2)
+  for (; i + 8 <= length; i += 8) {
+    const __m256i pixels = _mm256_loadu_si256((const __m256i *)(dst + i));
+    const __m256i colors = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        blend_epi32_avx2(pixels, colors, mode));
+  }
+#elif defined(USE_SSE2)
+  for (; i + 4 <= length; i += 4) {
+    const __m128i pixels = _mm_loadu_si128((const __m128i *)(dst + i));
+    const __m128i colors = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), blend_epi32(pixels, colors, mode));
+  }
+#endif
+  for (; i < length; i++) {
+    dst[i] = blend_pixel(dst[i], src[i], mode);
+  }
+}
+
+/**
+ * Utility function to blend a single color over a span of pixels.
+ * @param span The first pixel of the span
+ * @param length Number of pixels in the span
+ * @param color The color
+ * @param mode The blend mode, anything but BLEND_REPLACE
+ */
+static void blend_span(uint32_t *span, size_t length, uint32_t color,
+                       int mode) {
+  size_t i = 0;
+#if defined(USE_AVX2)
+  const __m256i colors = _mm256_set1_epi32((int)color);
+  for (; i + 8 <= length; i += 8) {
+    const __m256i pixels = _mm256_loadu_si256((const __m256i *)(span + i));
+    _mm256_storeu_si256((__m256i *)(span + i),
+                        blend_epi32_avx2(pixels, colors, mode));
+  }
+#elif defined(USE_SSE2)
+  const __m128i colors = _mm_set1_epi32((int)color);
+  for (; i + 4 <= length; i += 4) {
+    const __m128i pixels = _mm_loadu_si128((const __m128i *)(span + i));
+    _mm_storeu_si128((__m128i *)(span + i), blend_epi32(pixels, colors, mode));
+  }
+#endif
+  for (; i < length; i++) {
+    span[i] = blend_pixel(span[i], color, mode);
+  }
+}
+
+/**
+ * Utility function to expand a row of palette indices into colors. With AVX2,
+ * 8 colors are looked up at once by a gather.
+ * @param dst The first pixel
+ * @param src The first index
+ * @param length Number of pixels
+ * @param palette The colors of all 256 indices
+ */
+static void expand_row(uint32_t *dst, const uint8_t *src, size_t length,
+                       const uint32_t *palette) {
+  size_t i = 0;
+#ifdef USE_AVX2
+  for (; i + 8 <= length; i += 8) {
+    const __m256i indices =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+    _mm256_storeu_si256(
+        (__m256i *)(dst + i),
+        _mm256_i32gather_epi32((const int *)palette, indices, 4));
+  }
+#endif
+  for (; i + 4 <= length; i += 4) {
+    dst[i] = palette[src[i]];
+    dst[i + 1] = palette[src[i + 1]];
+    dst[i + 2] = palette[src[i + 2]];
+    dst[i + 3] = palette[src[i + 3]];
+  }
+  for (; i < length; i++) {
+    dst[i] = palette[src[i]];
+  }
+}
+
+/** Arguments of the expand_rows kernel */
+typedef struct expand_args {
+  uint32_t *dst;       // first pixel of the first row
+  const uint8_t *src;  // first index of the first row
+  lua_Integer stride;  // of both buffers
+  lua_Integer width;   // pixels per row
+  const uint32_t *palette;
+} expand_args;
+
+/**
+ * Pixel kernel that expands rows of palette indices into colors.
+ * @param p_args The expand_args
+ * @param first The first row
+ * @param last The row after the last row
+ */
+static void expand_rows(void *p_args, lua_Integer first, lua_Integer last) {
+  const expand_args *p_expand = p_args;
+  for (lua_Integer y = first; y < last; y++) {
+    expand_row(p_expand->dst + (y * p_expand->stride),
+               p_expand->src + (y * p_expand->stride), p_expand->width,
+               p_expand->palette);
+  }
+}
+
+/** Arguments of the copy_rows kernel */
+typedef struct copy_args {
+  uint32_t *dst;  // first pixel of the first destination row
+  lua_Integer dst_stride;
+  const uint32_t *src;  // first pixel of the first source row
+  lua_Integer src_stride;
+  size_t row_size;  // bytes per row
+  int mode;         // blend mode
+} copy_args;
+
+/**
+ * Pixel kernel that copies or blends rows between two buffers that don't
+ * overlap.
+ * @param p_args The copy_args
+ * @param first The first row
+ * @param last The row after the last row
+ */
+static void copy_rows(void *p_args, lua_Integer first, lua_Integer last) {
+  const copy_args *p_copy = p_args;
+  for (lua_Integer y = first; y < last; y++) {
+    uint32_t *dst = p_copy->dst + (y * p_copy->dst_stride);
+    const uint32_t *src = p_copy->src + (y * p_copy->src_stride);
+    if (p_copy->mode == BLEND_REPLACE) {
+      memcpy(dst, src, p_copy->row_size);
+    } else {
+      blend_row(dst, src, p_copy->row_size / sizeof(uint32_t), p_copy->mode);
+    }
+  }
+}
+
+/**
+ * Utility function to repeat each pixel of a row a given number of times
+ * (nearest-neighbour upscaling of a single row).
+ * @param scaled_row Destination row, must fit length * scale pixels
+ * @param row Source row
+ * @param length Number of pixels in the source row
+ * @param scale How often each pixel is repeated
+ */
+static void upscale_row(uint32_t *scaled_row, const uint32_t *row,
+                        size_t length, lua_Integer scale) {
+  size_t i = 0;
+#ifdef USE_SSE2
+  // fast paths for the most common scales, 4 pixels at a time
+  if (scale == 2) {
+    for (; i + 4 <= length; i += 4, scaled_row += 8) {
+      const __m128i pixels = _mm_loadu_si128((const __m128i *)(row + i));
+      _mm_storeu_si128((__m128i *)scaled_row,
+                       _mm_unpacklo_epi32(pixels, pixels));
+      _mm_storeu_si128((__m128i *)(scaled_row + 4),
+                       _mm_unpackhi_epi32(pixels, pixels));
+    }
+  } else if (scale == 4) {
+    for (; i + 4 <= length; i += 4, scaled_row += 16) {
+      const __m128i pixels = _mm_loadu_si128((const __m128i *)(row + i));
+      _mm_storeu_si128((__m128i *)scaled_row,
+                       _mm_shuffle_epi32(pixels, 0x00));
+      _mm_storeu_si128((__m128i *)(scaled_row + 4),
+                       _mm_shuffle_epi32(pixels, 0x55));
+      _mm_storeu_si128((__m128i *)(scaled_row + 8),
+                       _mm_shuffle_epi32(pixels, 0xaa));
+      _mm_storeu_si128((__m128i *)(scaled_row + 12),
+                       _mm_shuffle_epi32(pixels, 0xff));
+    }
+  }
+#endif
+  for (; i < length; i++) {
+    for (lua_Integer j = 0; j < scale; j++) {
+      *scaled_row++ = row[i];
+    }
+  }
+}
+
+/** Arguments of the upscale_rows kernel */
+typedef struct upscale_args {
+  uint32_t *dst;  // first pixel of the first scaled row
+  lua_Integer dst_stride;
+  const uint32_t *src;  // first pixel of the first unscaled row
+  lua_Integer src_stride;
+  lua_Integer width;  // unscaled pixels per row
+  lua_Integer scale;
+} upscale_args;
+
+/**
+ * Pixel kernel that upscales rows, every unscaled row becomes scale rows.
+ * @param p_args The upscale_args
+ * @param first The first unscaled row
+ * @param last The unscaled row after the last row
+ */
+static void upscale_rows(void *p_args, lua_Integer first, lua_Integer last) {
+  const upscale_args *p_upscale = p_args;
+  const lua_Integer scale = p_upscale->scale;
+  const size_t scaled_row_size = p_upscale->width * scale * sizeof(uint32_t);
+  for (lua_Integer y = first; y < last; y++) {
+    uint32_t *scaled_row = p_upscale->dst + (y * scale * p_upscale->dst_stride);
+    upscale_row(scaled_row, p_upscale->src + (y * p_upscale->src_stride),
+                p_upscale->width, scale);
+    for (lua_Integer j = 1; j < scale; j++) {
+      memcpy(scaled_row + (j * p_upscale->dst_stride), scaled_row,
+             scaled_row_size);
+    }
+  }
+}
+
+/**
+ * Utility function to average two pixels per channel, rounding up like the
+ * SSE2 average instruction.
+ * @param a The first pixel
+ * @param b The second pixel
+ * @return The average pixel
+ */
+static uint32_t average_pixel(uint32_t a, uint32_t b) {
+  return (a | b) - (((a ^ b) & 0xfefefefe) >> 1);
+}
+
+/**
+ * Utility function to compute a weighted sum of the red, green and blue
+ * channels of a pixel for the YCbCr conversion. The sum is offset, so it is
+ * never negative.
+ * @param pixel The pixel
+ * @param red The weight of the red channel
+ * @param green The weight of the green channel
+ * @param blue The weight of the blue channel
+ * @param offset Added to the sum, including rounding
+ * @return The channel, at most 255
+ */
+static uint8_t weigh_pixel(uint32_t pixel, int32_t red, int32_t green,
+                           int32_t blue, int32_t offset) {
+  const int32_t sum = (red * (int32_t)((pixel >> 16) & 0xff)) +
+                      (green * (int32_t)((pixel >> 8) & 0xff)) +
+                      (blue * (int32_t)(pixel & 0xff)) + offset;
+  const int32_t channel = sum >> 8;
+  return (uint8_t)(channel > 255 ? 255 : channel);
+}
+
+/** Macros to compute full range YCbCr (BT.601, scaled by 256) from a pixel */
+#define luma(pixel) weigh_pixel(pixel, 77, 150, 29, 128)
+#define chroma_blue(pixel) weigh_pixel(pixel, -43, -85, 128, 32896)
+#define chroma_red(pixel) weigh_pixel(pixel, 128, -107, -21, 32896)
+
+#ifdef USE_SSE2
+/**
+ * Utility function to compute a weighted sum of the red, green and blue
+ * channels of 4 pixels at once, like weigh_pixel(), but without clamping.
+ * @param pixels The pixels
+ * @param weights The weights as 16-bit integers, blue, green, red, 0, twice
+ * @param offset Added to each sum, including rounding
+ * @return The 4 channels as 32-bit integers
+ */
+static __m128i weigh_epi32(__m128i pixels, __m128i weights, __m128i offset) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+  const __m128i high =
+      _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+
+  // each pixel has two partial sums, blue + green and red + alpha * 0
+  const __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(low),
+                                     _mm_castsi128_ps(high), 0x88);
+  const __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(low),
+                                    _mm_castsi128_ps(high), 0xdd);
+  const __m128i sum =
+      _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+  return _mm_srli_epi32(_mm_add_epi32(sum, offset), 8);
+}
+#endif
+
+/**
+ * Utility function to convert a row of pixels into luma (Y).
+ * @param dst The first luma sample
+ * @param row The first pixel
+ * @param length Number of pixels
+ */
+static void luma_row(uint8_t *dst, const uint32_t *row, size_t length) {
+  size_t i = 0;
+#ifdef USE_SSE2
+  const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+  const __m128i offset = _mm_set1_epi32(128);
+  for (; i + 8 <= length; i += 8) {
+    const __m128i low = weigh_epi32(
+        _mm_loadu_si128((const __m128i *)(row + i)), weights, offset);
+    const __m128i high = weigh_epi32(
+        _mm_loadu_si128((const __m128i *)(row + i + 4)), weights, offset);
+    const __m128i words = _mm_packs_epi32(low, high);
+    _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(words, words));
+  }
+#endif
+  for (; i < length; i++) {
+    dst[i] = luma(row[i]);
+  }
+}
+
+/**
+ * Utility function to convert two rows of pixels into one row of subsampled
+ * chroma (Cb and Cr). Each chroma sample covers 2x2 pixels, a missing last
+ * column is replaced by the column before it.
+ * @param cb The first blue-difference chroma sample
+ * @param cr The first red-difference chroma sample
+ * @param top The first pixel of the upper row
+ * @param bottom The first pixel of the lower row, may be the upper row
+ * @param length Number of pixels per row
+ */
+static void chroma_row(uint8_t *cb, uint8_t *cr, const uint32_t *top,
+                       const uint32_t *bottom, size_t length) {
+  size_t i = 0;
+#ifdef USE_SSE2
+  const __m128i cb_weights =
+      _mm_setr_epi16(128, -85, -43, 0, 128, -85, -43, 0);
+  const __m128i cr_weights =
+      _mm_setr_epi16(-21, -107, 128, 0, -21, -107, 128, 0);
+  const __m128i offset = _mm_set1_epi32(32896);
+  for (; i + 8 <= length; i += 8) {
+    // average vertically first, then the neighbouring columns
+    const __m128i left =
+        _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(top + i)),
+                     _mm_loadu_si128((const __m128i *)(bottom + i)));
+    const __m128i right =
+        _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(top + i + 4)),
+                     _mm_loadu_si128((const __m128i *)(bottom + i + 4)));
+    const __m128 even =
+        _mm_shuffle_ps(_mm_castsi128_ps(left), _mm_castsi128_ps(right), 0x88);
+    const __m128 odd =
+        _mm_shuffle_ps(_mm_castsi128_ps(left), _mm_castsi128_ps(right), 0xdd);
+    const __m128i pixels =
+        _mm_avg_epu8(_mm_castps_si128(even), _mm_castps_si128(odd));
+
+    const __m128i words =
+        _mm_packs_epi32(weigh_epi32(pixels, cb_weights, offset),
+                        weigh_epi32(pixels, cr_weights, offset));
+    const __m128i bytes = _mm_packus_epi16(words, words);
+    const uint32_t cb_samples = (uint32_t)_mm_cvtsi128_si32(bytes);
+    const uint32_t cr_samples =
+        (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));
+    memcpy(cb + (i / 2), &cb_samples, sizeof(cb_samples));
+    memcpy(cr + (i / 2), &cr_samples, sizeof(cr_samples));
+  }
+#endif
+  for (; i < length; i += 2) {
+    const size_t next = i + 1 < length ? i + 1 : i;
+    const uint32_t pixel =
+        average_pixel(average_pixel(top[i], bottom[i]),
+                      average_pixel(top[next], bottom[next]));
+    cb[i / 2] = chroma_blue(pixel);
+    cr[i / 2] = chroma_red(pixel);
+  }
+}
+
+/**
+ * Utility function to pack a row of pixels into 3 bytes per pixel, dropping
+ * the upper 8 bits.
+ * @param dst The first byte
+ * @param row The first pixel
+ * @param length Number of pixels
+ * @param bgr Whether to store blue first instead of red first
+ */
+static void pack_row(uint8_t *dst, const uint32_t *row, size_t length,
+                     int bgr) {
+  const int first = bgr ? 0 : COLOR_RED_OFFSET;
+  const int last = bgr ? COLOR_RED_OFFSET : 0;
+  for (size_t i = 0; i < length; i++) {
+    *dst++ = (uint8_t)(row[i] >> first);
+    *dst++ = (uint8_t)(row[i] >> COLOR_GREEN_OFFSET);
+    *dst++ = (uint8_t)(row[i] >> last);
+  }
+}
+
+/** Arguments of the pack_rows kernel */
+typedef struct pack_args {
+  uint8_t *dst;  // first byte of the first packed row
+  lua_Integer dst_stride;  // bytes, negative to store the rows bottom-up
+  const uint32_t *src;  // first pixel of the first row
+  lua_Integer width;    // pixels per row, also the stride of the pixels
+  size_t padding;       // zero bytes after each packed row
+  int bgr;
+} pack_args;
+
+/**
+ * Pixel kernel that packs rows of pixels into 3 bytes per pixel.
+ * @param p_args The pack_args
+ * @param first The first row
+ * @param last The row after the last row
+ */
+static void pack_rows(void *p_args, lua_Integer first, lua_Integer last) {
+  const pack_args *p_pack = p_args;
+  for (lua_Integer y = first; y < last; y++) {
+    uint8_t *dst = p_pack->dst + (y * p_pack->dst_stride);
+    pack_row(dst, p_pack->src + (y * p_pack->width), p_pack->width,
+             p_pack->bgr);
+    memset(dst + (p_pack->width * PACKED_RGB_SIZE), 0, p_pack->padding);
+  }
+}
+
+/**
+ * Utility function to get the smallest rectangle containing both rectangles.
+ * @param a The first rectangle
+ * @param b The second rectangle
+ * @return The bounding rectangle
+ */
+static damage_rect merge_rects(damage_rect a, damage_rect b) {
+  return (damage_rect){
+      a.left < b.left ? a.left : b.left,
+      a.top < b.top ? a.top : b.top,
+      a.right > b.right ? a.right : b.right,
+      a.bottom > b.bottom ? a.bottom : b.bottom,
+  };
+}
+
+/** Macro to get the area of a rectangle */
+#define rect_area(rect) \
+  (((rect).right - (rect).left) * ((rect).bottom - (rect).top))
+
+/**
+ * Utility function to add a rectangle to a list of damaged rectangles. The
+ * rectangle has to be within bounds and not empty. It is merged with all
+ * rectangles it overlaps or touches. If the list is full, it is merged with
+ * the rectangle that grows the least instead.
+ * @param damage The list of damaged rectangles, never overlapping or touching
+ * @param p_damage_count The number of rectangles in the list
+ * @param rect The rectangle to add
+ */
+static void add_damage(damage_rect *damage, int *p_damage_count,
+                       damage_rect rect) {
+  // nothing to do if the rectangle is already damaged completely (this is
+  // the common case for single pixels and after clearing the window)
+  for (int i = 0; i < *p_damage_count; i++) {
+    if (rect.left >= damage[i].left && rect.top >= damage[i].top &&
+        rect.right <= damage[i].right && rect.bottom <= damage[i].bottom) {
+      return;
+    }
+  }
+
+  for (;;) {
+    // merge with the first overlapping or touching rectangle and start over,
+    // since the grown rectangle might touch others now
+    int merged = 0;
+    for (int i = 0; i < *p_damage_count; i++) {
+      if (rect.left <= damage[i].right && damage[i].left <= rect.right &&
+          rect.top <= damage[i].bottom && damage[i].top <= rect.bottom) {
+        rect = merge_rects(rect, damage[i]);
+        damage[i] = damage[--*p_damage_count];
+        merged = 1;
+        break;
+      }
+    }
+    if (merged) {
+      continue;
+    }
+
+    if (*p_damage_count < MAX_DAMAGE_RECTS) {
+      damage[(*p_damage_count)++] = rect;
+      return;
+    }
+
+    // the list is full, so take out the rectangle that grows the least when
+    // merged with the new one and merge them
+    int best = 0;
+    lua_Integer best_growth = -1;
+    for (int i = 0; i < *p_damage_count; i++) {
+      const lua_Integer growth =
+          rect_area(merge_rects(rect, damage[i])) - rect_area(damage[i]);
+      if (best_growth < 0 || growth < best_growth) {
+        best = i;
+        best_growth = growth;
+      }
+    }
+    rect = merge_rects(rect, damage[best]);
+    damage[best] = damage[--*p_damage_count];
+  }
+}
+
+/**
+ * Utility function to present damaged rectangles of a window buffer. Each
+ * rectangle is copied into the fenster buffer while scaling it up (each row is
+ * only scaled once and then copied to the remaining rows of the scaled area)
+ * and then sent to the screen on its own. If the window buffer is the fenster
+ * buffer, there is nothing to copy. Headless windows only count the damaged
+ * pixels. Only reads the window, so the present thread can call it as well.
+ * @param p_window The window userdata
+ * @param pixels The unscaled window buffer to present
+ * @param damage The damaged rectangles
+ * @param damage_count The number of damaged rectangles
+ * @return The number of damaged (unscaled) pixels
+ */
+static lua_Integer present_rects(const window *p_window, const uint32_t *pixels,
+                                 const damage_rect *damage, int damage_count) {
+  struct fenster *p_fenster = p_window->p_fenster;
+  const lua_Integer scale = p_window->scale;
+  lua_Integer damaged_pixels = 0;
+
+  for (int i = 0; i < damage_count; i++) {
+    const damage_rect *p_rect = &damage[i];
+    const lua_Integer width = p_rect->right - p_rect->left;
+    const lua_Integer height = p_rect->bottom - p_rect->top;
+    damaged_pixels += rect_area(*p_rect);
+    if (p_window->headless) {
+      continue;
+    }
+
+    if (pixels != p_fenster->buf) {
+      upscale_args upscale = {
+          p_fenster->buf + (p_rect->top * scale * p_fenster->width) +
+              (p_rect->left * scale),
+          p_fenster->width,
+          pixels + (p_rect->top * p_window->width) + p_rect->left,
+          p_window->width,
+          width,
+          scale,
+      };
+      parallel_rows(upscale_rows, &upscale, height,
+                    width * height * scale * scale * sizeof(uint32_t));
+    }
+
+    // (narrow casts to int are fine, the scaled window size is an int too)
+    fenster_present(p_fenster, (int)(p_rect->left * scale),
+                    (int)(p_rect->top * scale), (int)(width * scale),
+                    (int)(height * scale));
+  }
+
+  return damaged_pixels;
+}
+
+/** Macro to get the number of bytes sent to the screen for damaged pixels */
+#define presented_bytes(p_window, damaged_pixels)                   \
+  ((p_window)->headless ? 0                                         \
+                        : (damaged_pixels) * (p_window)->scale *    \
+                              (p_window)->scale *                   \
+                              (lua_Integer)sizeof(uint32_t))
+
+/**
+ * Main function of the present thread. Presents the queued frames one after
+ * another and frees their buffers, until it is told to stop.
+ * @param p_window The window userdata
+ */
+static void run_presenter(window *p_window) {
+  presenter *p_presenter = p_window->p_presenter;
+  mutex_lock(&p_presenter->mutex);
+  for (;;) {
+    while (!p_presenter->stop && p_presenter->queue_count == 0) {
+      cond_wait(&p_presenter->frame_queued, &p_presenter->mutex);
+    }
+    if (p_presenter->stop) {
+      break;
+    }
+
+    // copy the frame, so the queue slot can be reused while presenting
+    const present_frame frame = p_presenter->queue[p_presenter->queue_first];
+    p_presenter->queue_first = (p_presenter->queue_first + 1) % MAX_BUFFERS;
+    p_presenter->queue_count--;
+    p_presenter->buffer_states[frame.buffer] = BUFFER_PRESENTING;
+    mutex_unlock(&p_presenter->mutex);
+
+    const lua_Integer damaged_pixels =
+        present_rects(p_window, p_presenter->buffers[frame.buffer],
+                      frame.damage, frame.damage_count);
+#if !defined(_WIN32) && !defined(__APPLE__)
+    if (!p_window->headless) {
+      // send the image right away instead of with the next events
+      fenster_flush(p_window->p_fenster);
+    }
+#endif
+
+    mutex_lock(&p_presenter->mutex);
+    p_presenter->buffer_states[frame.buffer] = BUFFER_FREE;
+    p_presenter->presented_bytes += presented_bytes(p_window, damaged_pixels);
+    cond_signal(&p_presenter->buffer_freed);
+  }
+  mutex_unlock(&p_presenter->mutex);
+}
+
+THREAD_MAIN(present_thread_main, p_window) {
+  run_presenter(p_window);
+  return THREAD_RETURN;
+}
+
+/**
+ * Utility function to start presenting the window asynchronously. Allocates
+ * the additional window buffers and starts the present thread. The current
+ * window buffer becomes the first buffer of the presenter.
+ * @param p_window The window userdata
+ * @param buffer_count The number of window buffers, 2 or 3
+ * @param preserve Whether to copy the finished buffer into the next one
+ * @param drop Whether to drop queued frames instead of waiting for a buffer
+ * @return 0 on success, otherwise an error code
+ */
+static int start_presenter(window *p_window, int buffer_count, int preserve,
+                           int drop) {
+  presenter *p_presenter = calloc(1, sizeof(presenter));
+  if (p_presenter == NULL) {
+    return errno;
+  }
+  p_presenter->buffers[0] = p_window->pixels;
+  p_presenter->buffer_states[0] = BUFFER_DRAWING;
+  for (int i = 1; i < buffer_count; i++) {
+    p_presenter->buffers[i] = calloc(p_window->pixels_length, sizeof(uint32_t));
+    if (p_presenter->buffers[i] == NULL) {
+      const int error = errno;
+      for (int j = 1; j < i; j++) {
+        free(p_presenter->buffers[j]);
+      }
+      free(p_presenter);
+      return error;
+    }
+    p_presenter->buffer_states[i] = BUFFER_FREE;
+  }
+  p_presenter->buffer_count = buffer_count;
+  p_presenter->preserve = preserve;
+  p_presenter->drop = drop;
+
+  int result = mutex_init(&p_presenter->mutex);
+  if (result == 0) {
+    result = cond_init(&p_presenter->frame_queued);
+    if (result == 0) {
+      result = cond_init(&p_presenter->buffer_freed);
+      if (result == 0) {
+        p_window->p_presenter = p_presenter;
+#if !defined(_WIN32) && !defined(__APPLE__)
+        // only the present thread presents and flushes the fenster from now on
+        p_window->p_fenster->async = 1;
+#endif
+        result =
+            thread_start(&p_presenter->thread, present_thread_main, p_window);
+        if (result == 0) {
+          return 0;
+        }
+#if !defined(_WIN32) && !defined(__APPLE__)
+        p_window->p_fenster->async = 0;
+#endif
+        p_window->p_presenter = NULL;
+        cond_destroy(&p_presenter->buffer_freed);
+      }
+      cond_destroy(&p_presenter->frame_queued);
+    }
+    mutex_destroy(&p_presenter->mutex);
+  }
+  for (int i = 1; i < buffer_count; i++) {
+    free(p_presenter->buffers[i]);
+  }
+  free(p_presenter);
+  return result;
+}
+
+/**
+ * Utility function to stop the present thread and free the presenter with all
+ * of its window buffers. Queued frames are not presented anymore.
+ * @param p_presenter The presenter
+ */
+static void stop_presenter(presenter *p_presenter) {
+  mutex_lock(&p_presenter->mutex);
+  p_presenter->stop = 1;
+  cond_signal(&p_presenter->frame_queued);
+  mutex_unlock(&p_presenter->mutex);
+  thread_join(&p_presenter->thread);
+
+  cond_destroy(&p_presenter->buffer_freed);
+  cond_destroy(&p_presenter->frame_queued);
+  mutex_destroy(&p_presenter->mutex);
+  for (int i = 0; i < p_presenter->buffer_count; i++) {
+    free(p_presenter->buffers[i]);
+  }
+  free(p_presenter);
+}
+
+/** Marker that starts every frame of a YUV4MPEG2 stream */
+static const char Y4M_FRAME_MARKER[] = "FRAME\n";
+
+/**
+ * Utility function to get the size of one encoded frame of a recording.
+ * @param format The recording format
+ * @param width The width of the frame in pixels
+ * @param height The height of the frame in pixels
+ * @return The size in bytes
+ */
+static size_t encoded_frame_size(int format, lua_Integer width,
+                                 lua_Integer height) {
+  if (format == RECORD_Y4M) {
+    const size_t chroma_size = ((width + 1) / 2) * ((height + 1) / 2);
+    return (sizeof(Y4M_FRAME_MARKER) - 1) + (width * height) +
+           (2 * chroma_size);
+  }
+  return width * height * PACKED_RGB_SIZE;
+}
+
+/**
+ * Utility function to encode a snapshot of the window buffer into the encode
+ * buffer of the recorder.
+ * @param p_recorder The recorder
+ * @param pixels The snapshot
+ */
+static void encode_frame(recorder *p_recorder, const uint32_t *pixels) {
+  const lua_Integer width = p_recorder->width;
+  const lua_Integer height = p_recorder->height;
+  uint8_t *encoded = p_recorder->encoded;
+
+  if (p_recorder->format == RECORD_Y4M) {
+    const size_t marker_size = sizeof(Y4M_FRAME_MARKER) - 1;
+    const lua_Integer chroma_width = (width + 1) / 2;
+    uint8_t *y_plane = encoded + marker_size;
+    uint8_t *cb_plane = y_plane + (width * height);
+    uint8_t *cr_plane = cb_plane + (chroma_width * ((height + 1) / 2));
+    memcpy(encoded, Y4M_FRAME_MARKER, marker_size);
+    for (lua_Integer y = 0; y < height; y++) {
+      luma_row(y_plane + (y * width), pixels + (y * width), width);
+    }
+    for (lua_Integer y = 0; y < height; y += 2) {
+      const uint32_t *top = pixels + (y * width);
+      chroma_row(cb_plane + ((y / 2) * chroma_width),
+                 cr_plane + ((y / 2) * chroma_width), top,
+                 y + 1 < height ? top + width : top, width);
+    }
+    return;
+  }
+
+  pack_row(encoded, pixels, width * height, 0);
+}
+
+/**
+ * Main function of the recording thread. Encodes and writes the queued
+ * snapshots one after another and frees their slots. When told to stop, it
+ * writes the frames that are still queued first. After a failed write, the
+ * remaining frames are dropped.
+ * @param p_recorder The recorder
+ */
+static void run_recorder(recorder *p_recorder) {
+  const size_t pixels_length = p_recorder->width * p_recorder->height;
+  mutex_lock(&p_recorder->mutex);
+  for (;;) {
+    while (!p_recorder->stop && p_recorder->queue_count == 0) {
+      cond_wait(&p_recorder->frame_queued, &p_recorder->mutex);
+    }
+    if (p_recorder->queue_count == 0) {
+      break;
+    }
+
+    // the slot stays queued while it's written, so it's not reused
+    const uint32_t *pixels =
+        p_recorder->slots + (p_recorder->queue_first * pixels_length);
+    const int failed = p_recorder->error != 0;
+    mutex_unlock(&p_recorder->mutex);
+
+    int error = 0;
+    if (!failed) {
+      encode_frame(p_recorder, pixels);
+      if (fwrite(p_recorder->encoded, 1, p_recorder->encoded_size,
+                 p_recorder->file) != p_recorder->encoded_size) {
+        error = errno != 0 ? errno : EIO;
+      }
+    }
+
+    mutex_lock(&p_recorder->mutex);
+    if (error != 0) {
+      p_recorder->error = error;
+    }
+    if (failed || error != 0) {
+      p_recorder->dropped_frames++;
+    } else {
+      p_recorder->written_frames++;
+    }
+    p_recorder->queue_first =
+        (p_recorder->queue_first + 1) % p_recorder->slot_count;
+    p_recorder->queue_count--;
+  }
+  mutex_unlock(&p_recorder->mutex);
+}
+
+THREAD_MAIN(recorder_thread_main, p_recorder) {
+  run_recorder(p_recorder);
+  return THREAD_RETURN;
+}
+
+/**
+ * Utility function to start recording the window into an open file. Writes
+ * the header, allocates the frame slots and starts the recording thread. The
+ * recorder owns the file, it is closed on failure as well.
+ * @param p_window The window userdata
+ * @param file The file to write to
+ * @param format The recording format
+ * @param slot_count The number of frame slots
+ * @param fps The frame rate written into the header
+ * @return 0 on success, otherwise an error code
+ */
+static int start_recorder(window *p_window, FILE *file, int format,
+                          int slot_count, lua_Integer fps) {
+  const lua_Integer width = p_window->width;
+  const lua_Integer height = p_window->height;
+  if (format == RECORD_Y4M &&
+      fprintf(file,
+              "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n",
+              (int)width, (int)height, (int)fps) < 0) {
+    const int error = errno != 0 ? errno : EIO;
+    fclose(file);
+    return error;
+  }
+
+  recorder *p_recorder = calloc(1, sizeof(recorder));
+  if (p_recorder == NULL) {
+    const int error = errno;
+    fclose(file);
+    return error;
+  }
+  p_recorder->file = file;
+  p_recorder->format = format;
+  p_recorder->width = width;
+  p_recorder->height = height;
+  p_recorder->slot_count = slot_count;
+  p_recorder->encoded_size = encoded_frame_size(format, width, height);
+  p_recorder->slots =
+      malloc(slot_count * p_window->pixels_length * sizeof(uint32_t));
+  p_recorder->encoded = malloc(p_recorder->encoded_size);
+
+  int result = p_recorder->slots == NULL || p_recorder->encoded == NULL
+                   ? ENOMEM
+                   : mutex_init(&p_recorder->mutex);
+  if (result == 0) {
+    result = cond_init(&p_recorder->frame_queued);
+    if (result == 0) {
+      result =
+          thread_start(&p_recorder->thread, recorder_thread_main, p_recorder);
+      if (result == 0) {
+        p_window->p_recorder = p_recorder;
+        return 0;
+      }
+      cond_destroy(&p_recorder->frame_queued);
+    }
+    mutex_destroy(&p_recorder->mutex);
+  }
+  free(p_recorder->encoded);
+  free(p_recorder->slots);
+  free(p_recorder);
+  fclose(file);
+  return result;
+}
+
+/**
+ * Utility function to snapshot the window buffer into the next free frame
+ * slot of the recorder. Never waits for the recording thread: if all slots
+ * are queued, the frame is dropped instead.
+ * @param p_window The window userdata
+ */
+static void record_frame(window *p_window) {
+  recorder *p_recorder = p_window->p_recorder;
+  mutex_lock(&p_recorder->mutex);
+  if (p_recorder->queue_count == p_recorder->slot_count) {
+    p_recorder->dropped_frames++;
+    mutex_unlock(&p_recorder->mutex);
+    return;
+  }
+  const int slot = (p_recorder->queue_first + p_recorder->queue_count) %
+                   p_recorder->slot_count;
+  mutex_unlock(&p_recorder->mutex);
+
+  // the recording thread only touches queued slots, so the free slot can be
+  // written without holding the lock
+  copy_args copy = {
+      p_recorder->slots + (slot * p_window->pixels_length),
+      p_window->width,
+      p_window->pixels,
+      p_window->width,
+      p_window->width * sizeof(uint32_t),
+      BLEND_REPLACE,
+  };
+  parallel_rows(copy_rows, &copy, p_window->height,
+                p_window->pixels_length * sizeof(uint32_t));
+
+  mutex_lock(&p_recorder->mutex);
+  p_recorder->queue_count++;
+  cond_signal(&p_recorder->frame_queued);
+  mutex_unlock(&p_recorder->mutex);
+}
+
+/**
+ * Utility function to stop recording. Waits until the recording thread has
+ * written the queued frames, closes the file and frees the recorder.
+ * @param p_recorder The recorder
+ * @param p_written_frames Set to the number of written frames
+ * @param p_dropped_frames Set to the number of dropped frames
+ * @return 0 on success, otherwise the error code of the first failed write
+ */
+static int stop_recorder(recorder *p_recorder, lua_Integer *p_written_frames,
+                         lua_Integer *p_dropped_frames) {
+  mutex_lock(&p_recorder->mutex);
+  p_recorder->stop = 1;
+  cond_signal(&p_recorder->frame_queued);
+  mutex_unlock(&p_recorder->mutex);
+  thread_join(&p_recorder->thread);
+
+  int error = p_recorder->error;
+  if (fclose(p_recorder->file) != 0 && error == 0) {
+    error = errno != 0 ? errno : EIO;
+  }
+  *p_written_frames = p_recorder->written_frames;
+  *p_dropped_frames = p_recorder->dropped_frames;
+  cond_destroy(&p_recorder->frame_queued);
+  mutex_destroy(&p_recorder->mutex);
+  free(p_recorder->encoded);
+  free(p_recorder->slots);
+  free(p_recorder);
+  return error;
+}
+
+/**
+ * Opens a window with the given width, height, title, scale, target FPS and
+ * options. Returns a userdata representing the window with all the methods and
+ * properties we defined on the metatable.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_open(lua_State *L) {
+  const lua_Integer width = check_dimension(L, 1);
+  const lua_Integer height = check_dimension(L, 2);
+  const char *title = luaL_optstring(L, 3, DEFAULT_TITLE);
+  const lua_Integer scale = luaL_optinteger(L, 4, DEFAULT_SCALE);
+  luaL_argcheck(L, scale > 0 && scale <= MAX_DIMENSION, 4,
+                "scale must be in range 1-15360");
+  const lua_Number target_fps = luaL_optnumber(L, 5, DEFAULT_TARGET_FPS);
+  luaL_argcheck(L, target_fps >= 0.0, 5, "target fps must be non-negative");
+  window_options options;
+  check_options(L, 6, &options);
+
+  // allocate memory for the unscaled window buffer, unless the window is not
+  // scaled, not headless and presents synchronously - then we can draw into
+  // the fenster buffer directly
+  // (one buffer means there is no back buffer, so it's synchronous as well)
+  const int async =
+      options.buffers > 1 && CAN_PRESENT_ASYNC(options.headless);
+  const size_t pixels_length = width * height;
+  uint32_t *pixels = NULL;
+  if (options.headless || scale > 1 || async) {
+    pixels = calloc(pixels_length, sizeof(uint32_t));
+    if (pixels == NULL) {
+      const int error = errno;
+      return luaL_error(
+          L, "failed to allocate memory of size %d for window buffer (%d)",
+          pixels_length * sizeof(uint32_t), error);
+    }
+  }
+
+  // use a temporary fenster struct to copy into the "real" one later
+  // (width and height use narrow casts to int, but we made sure it's in range)
+  // (the fenster buffer is left empty, so fenster allocates it - on X11 in a
+  // shared memory segment if possible, so it never has to be sent to the
+  // X server over the socket)
+  struct fenster temp_fenster = {
+      .title = title,
+      .width = (int)(width * scale),
+      .height = (int)(height * scale),
+      .buf = NULL,
+  };
+
+  // allocate memory for the "real" fenster struct
+  struct fenster *p_fenster = malloc(sizeof(struct fenster));
+  if (p_fenster == NULL) {
+    const int error = errno;
+    free(pixels);
+    pixels = NULL;
+    return luaL_error(L, "failed to allocate memory of size %d for window (%d)",
+                      sizeof(struct fenster), error);
+  }
+
+  // copy temporary fenster struct into the "real" one
+  // (we have to do it this way because width and height are const)
+  memcpy(p_fenster, &temp_fenster, sizeof(struct fenster));
+
+  // open window and check success
+  // (headless windows don't open a real window and only need the buffer)
+  if (!options.headless) {
+    const int result = fenster_open(p_fenster);
+    if (result != 0) {
+      free(pixels);
+      pixels = NULL;
+      free(p_fenster);
+      p_fenster = NULL;
+      return luaL_error(L, "failed to open window (%d)", result);
+    }
+    if (pixels == NULL) {
+      pixels = p_fenster->buf;
+    }
+  }
+
+  // initialize the keys table and put it in the registry
+  lua_createtable(L, KEYS_LENGTH, 0);
+  for (int i = 0; i < KEYS_LENGTH; i++) {
+    lua_pushboolean(L, 0);
+    lua_rawseti(L, -2, i);
+  }
+  lua_pushvalue(L, -1);  // copy the keys table since luaL_ref pops it
+  const int keys_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  if (keys_ref == LUA_REFNIL || keys_ref == LUA_NOREF) {
+    if (pixels != p_fenster->buf) {
+      free(pixels);
+    }
+    pixels = NULL;
+    close_fenster(p_fenster, options.headless);
+    free(p_fenster);
+    p_fenster = NULL;
+    return luaL_error(L, "failed to create keys table (%d)", keys_ref);
+  }
+  lua_rawseti(L, LUA_REGISTRYINDEX, keys_ref);
+
+  // create the window userdata and initialize it
+  window *p_window = lua_newuserdata(L, sizeof(window));
+  p_window->p_fenster = p_fenster;
+  p_window->p_presenter = NULL;
+  p_window->p_recorder = NULL;
+  p_window->keys_ref = keys_ref;
+  p_window->headless = options.headless;
+  p_window->catchup = options.catchup;
+  p_window->target_frame_time =
+      target_fps ? llroundl(NS_PER_SEC / target_fps) : 0;
+  p_window->start_frame_time = 0;
+  p_window->frame_deadline = 0;
+  p_window->pixels = pixels;
+  p_window->pixels_length = pixels_length;
+  p_window->indices = NULL;
+  for (int i = 0; i < PALETTE_SIZE; i++) {
+    p_window->palette[i] = (uint32_t)i * 0x010101;  // grayscale
+  }
+  p_window->delta = 0.0;
+  p_window->scaled_mouse_x = 0;
+  p_window->scaled_mouse_y = 0;
+  p_window->mod_control = 0;
+  p_window->mod_shift = 0;
+  p_window->mod_alt = 0;
+  p_window->mod_gui = 0;
+  p_window->width = width;
+  p_window->height = height;
+  p_window->scale = scale;
+  p_window->target_fps = target_fps;
+  p_window->damaged_pixels = 0;
+  p_window->missed_frames = 0;
+  p_window->total_frames = 0;
+  p_window->total_missed_frames = 0;
+  p_window->total_presented_bytes = 0;
+  p_window->total_dropped_frames = 0;
+
+  // nothing is measured before the first frame
+  p_window->timing = (frame_timing){0, 0, 0, 0};
+  p_window->frame_end_time = fenster_time_ns();
+  p_window->history_length = (int)options.stats_frames;
+  p_window->history_count = 0;
+  p_window->history_next = 0;
+  p_window->budget = 0;
+  p_window->budget_ref = LUA_NOREF;
+  p_window->direct_access = 0;
+  p_window->blend = BLEND_REPLACE;
+
+  // the first frame always has to be presented completely
+  p_window->damage[0] = (damage_rect){0, 0, width, height};
+  p_window->damage_count = 1;
+
+  // receive the input events of the window (the keys table starts all false)
+  p_window->event_count = 0;
+  memset(p_window->keys, 0, sizeof(p_window->keys));
+  memset(p_window->pressed, 0, sizeof(p_window->pressed));
+  memset(p_window->released, 0, sizeof(p_window->released));
+  p_window->pending_event_count = 0;
+  memset(p_window->pending_pressed, 0, sizeof(p_window->pending_pressed));
+  memset(p_window->pending_released, 0, sizeof(p_window->pending_released));
+  p_fenster->userdata = p_window;
+  p_fenster->event = queue_event;
+  luaL_setmetatable(L, WINDOW_METATABLE);
+
+  // allocate the index buffer and start the present thread last, so the
+  // garbage collector cleans up the window if it fails
+  if (options.indexed) {
+    p_window->indices = calloc(pixels_length, sizeof(uint8_t));
+    if (p_window->indices == NULL) {
+      const int error = errno;
+      return luaL_error(
+          L, "failed to allocate memory of size %d for index buffer (%d)",
+          pixels_length, error);
+    }
+  }
+  if (async) {
+    const int result = start_presenter(p_window, (int)options.buffers,
+                                       options.preserve, options.drop_frames);
+    if (result != 0) {
+      return luaL_error(L, "failed to start present thread (%d)", result);
+    }
+  }
+  return 1;
+}
+
+/**
+ * Pauses for a given number of milliseconds.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_sleep(lua_State *L) {
+  const lua_Integer milliseconds = luaL_checkinteger(L, 1);
+
+  fenster_sleep(milliseconds);
+
+  return 0;
+}
+
+/**
+ * Returns the current time in milliseconds.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_time(lua_State *L) {
+  lua_pushinteger(L, fenster_time());
+  return 1;
+}
+
+/**
+ * Returns the current time in nanoseconds. Only differences between two values
+ * are meaningful, the clock does not start at the Unix epoch.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_timens(lua_State *L) {
+  lua_pushinteger(L, fenster_time_ns());
+  return 1;
+}
+
+/**
+ * Utility function to get the number of logical processors.
+ * @return The number of logical processors, at least 1
+ */
+static int processor_count(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  const long count = (long)info.dwNumberOfProcessors;
+#else
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return count < 1 ? 1 : (count > MAX_THREADS ? MAX_THREADS : (int)count);
+}
+
+/**
+ * Sets the number of threads that run the built-in pixel kernels (clearing,
+ * filling, blitting and upscaling). Defaults to the number of processors.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_setthreads(lua_State *L) {
+  const lua_Integer thread_count =
+      luaL_optinteger(L, 1, (lua_Integer)processor_count());
+  luaL_argcheck(L, thread_count >= 1 && thread_count <= MAX_THREADS, 1,
+                "thread count must be between 1 and 64");
+
+  const int result = set_thread_count((int)thread_count);
+  if (result != 0) {
+    return luaL_error(L, "failed to start worker thread (%d)", result);
+  }
+  lua_pushinteger(L, pool.thread_count);
+  return 1;
+}
+
+/**
+ * Stops the worker threads when the Lua state is closed, before the module
+ * (and with it the code of the threads) might be unloaded.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int threads_gc(lua_State *L) {
+  (void)L;
+  set_thread_count(1);
+  return 0;
+}
+
+/**
+ * Utility function to get a color value from the Lua stack and check if it's
+ * within the allowed range.
+ * @param L Lua state
+ * @param index Index of the color value on the Lua stack
+ * @return The color value
+ */
+static lua_Integer check_color(lua_State *L, int index) {
+  const lua_Integer color = luaL_checkinteger(L, index);
+  luaL_argcheck(L, color >= 0 && color <= MAX_ALPHA_COLOR, index,
+                "color must be in range 0x00000000-0xffffffff");
+  return color;
+}
+
+/**
+ * Utility function to get an optional color value from the Lua stack and check
+ * if it's within the allowed range.
+ * @param L Lua state
+ * @param index Index of the color value on the Lua stack
+ * @param def Default color value if the argument is nil or missing
+ * @return The color value
+ */
+static lua_Integer opt_color(lua_State *L, int index, lua_Integer def) {
+  const lua_Integer color = luaL_optinteger(L, index, def);
+  luaL_argcheck(L, color >= 0 && color <= MAX_ALPHA_COLOR, index,
+                "color must be in range 0x00000000-0xffffffff");
+  return color;
+}
+
+/**
+ * Utility function to get a palette index from the Lua stack and check if
+ * it's within the allowed range.
+ * @param L Lua state
+ * @param index Index of the palette index on the Lua stack
+ * @return The palette index
+ */
+static lua_Integer check_palette_index(lua_State *L, int index) {
+  const lua_Integer palette_index = luaL_checkinteger(L, index);
+  luaL_argcheck(L, palette_index >= 0 && palette_index < PALETTE_SIZE, index,
+                "palette index must be in range 0-255");
+  return palette_index;
+}
+
+/**
+ * Utility function to get a color component from the Lua stack and check if
+ * it's within the allowed range.
+ * @param L Lua state
+ * @param index Index of the color component on the Lua stack
+ * @return The color component value
+ */
+static lua_Integer check_color_component(lua_State *L, int index) {
+  const lua_Integer color_component = luaL_checkinteger(L, index);
+  luaL_argcheck(L,
+                color_component >= 0 && color_component <= MAX_COLOR_COMPONENT,
+                index, "color component must be in range 0-255");
+  return color_component;
+}
+
+/**
+ * Utility function to convert a color value to RGB components or vice versa.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_rgb(lua_State *L) {
+  // check if the function was called with less than 3 arguments
+  if (lua_gettop(L) < 3) {
+    // get color value argument (without alpha, see fenster.rgba)
+    const lua_Integer color = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, color >= 0 && color <= MAX_COLOR, 1,
+                  "color must be in range 0x000000-0xffffff");
+
+    // return RGB components
+    lua_pushinteger(L, (color >> COLOR_RED_OFFSET) & MAX_COLOR_COMPONENT);
+    lua_pushinteger(L, (color >> COLOR_GREEN_OFFSET) & MAX_COLOR_COMPONENT);
+    lua_pushinteger(L, color & MAX_COLOR_COMPONENT);
+    return 3;
+  }
+
+  // get RGB component arguments
+  const lua_Integer red = check_color_component(L, 1);
+  const lua_Integer green = check_color_component(L, 2);
+  const lua_Integer blue = check_color_component(L, 3);
+
+  // return color value
+  lua_pushinteger(
+      L, (red << COLOR_RED_OFFSET) | (green << COLOR_GREEN_OFFSET) | blue);
+  return 1;
+}
+
+/**
+ * Utility function to convert a color value with alpha (0xAARRGGBB) to RGBA
+ * components or vice versa.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_rgba(lua_State *L) {
+  // check if the function was called with less than 4 arguments
+  if (lua_gettop(L) < 4) {
+    // get color value argument
+    const lua_Integer color = check_color(L, 1);
+
+    // return RGBA components
+    lua_pushinteger(L, (color >> COLOR_RED_OFFSET) & MAX_COLOR_COMPONENT);
+    lua_pushinteger(L, (color >> COLOR_GREEN_OFFSET) & MAX_COLOR_COMPONENT);
+    lua_pushinteger(L, color & MAX_COLOR_COMPONENT);
+    lua_pushinteger(L, (color >> COLOR_ALPHA_OFFSET) & MAX_COLOR_COMPONENT);
+    return 4;
+  }
+
+  // get RGBA component arguments
+  const lua_Integer red = check_color_component(L, 1);
+  const lua_Integer green = check_color_component(L, 2);
+  const lua_Integer blue = check_color_component(L, 3);
+  const lua_Integer alpha = check_color_component(L, 4);
+
+  // return color value
+  lua_pushinteger(L, (alpha << COLOR_ALPHA_OFFSET) |
+                         (red << COLOR_RED_OFFSET) |
+                         (green << COLOR_GREEN_OFFSET) | blue);
+  return 1;
+}
+
+/** Macro to get the window userdata from the Lua stack */
+#define check_window(L) (luaL_checkudata(L, 1, WINDOW_METATABLE))
+
+/** Macro to check if the window is closed */
+#define is_window_closed(p_window) ((p_window)->p_fenster == NULL)
+
+/**
+ * Utility function to get the window userdata from the Lua stack and check if
+ * the window is open.
+ * @param L Lua state
+ * @return The window userdata
+ */
+static window *check_open_window(lua_State *L) {
+  window *p_window = check_window(L);
+  if (is_window_closed(p_window)) {
+    luaL_error(L, "attempt to use a closed window");
+  }
+  return p_window;
+}
+
+/**
+ * Close the window. Does nothing if the window is already closed.
+ * The __gc and __close meta methods also call this function, so the user
+ * likely won't need to call this function manually.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_close(lua_State *L) {
+  window *p_window = check_open_window(L);
+
+  // finish the recording (errors can't be reported anymore)
+  if (p_window->p_recorder != NULL) {
+    lua_Integer written_frames = 0;
+    lua_Integer dropped_frames = 0;
+    stop_recorder(p_window->p_recorder, &written_frames, &dropped_frames);
+    p_window->p_recorder = NULL;
+  }
+
+  // close and free window (and the window buffer if it's a separate one)
+  // (the presenter owns all buffers, so the present thread has to stop first)
+  if (p_window->p_presenter != NULL) {
+    stop_presenter(p_window->p_presenter);
+    p_window->p_presenter = NULL;
+  } else if (p_window->pixels != p_window->p_fenster->buf) {
+    free(p_window->pixels);
+  }
+  p_window->pixels = NULL;
+  free(p_window->indices);
+  p_window->indices = NULL;
+  close_fenster(p_window->p_fenster, p_window->headless);
+  free(p_window->p_fenster);
+  p_window->p_fenster = NULL;
+  luaL_unref(L, LUA_REGISTRYINDEX, p_window->keys_ref);  // free keys table
+  p_window->keys_ref = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, p_window->budget_ref);
+  p_window->budget_ref = LUA_NOREF;
+
+  return 0;
+}
+
+/** Macro to get a pixel of the (unscaled) window buffer */
+#define window_pixel(p_window, x, y) \
+  ((p_window)->pixels[((y) * (p_window)->width) + (x)])
+
+/**
+ * Utility function to mark a rectangle of the window as changed, so it is
+ * presented in the next frame. The rectangle has to be within bounds and not
+ * empty.
+ * @param p_window The window userdata
+ * @param x The x coordinate of the top left corner
+ * @param y The y coordinate of the top left corner
+ * @param width The width of the rectangle
+ * @param height The height of the rectangle
+ */
+static void damage_window(window *p_window, lua_Integer x, lua_Integer y,
+                          lua_Integer width, lua_Integer height) {
+  add_damage(p_window->damage, &p_window->damage_count,
+             (damage_rect){x, y, x + width, y + height});
+}
+
+/**
+ * Utility function to hand the finished window buffer to the present thread
+ * and continue with the next free buffer. If no buffer is free, it either
+ * waits for the present thread or drops the oldest queued frame, whose damage
+ * is then presented together with this frame instead.
+ * @param p_window The window userdata
+ * @return The number of dropped frames
+ */
+static lua_Integer submit_frame(window *p_window) {
+  presenter *p_presenter = p_window->p_presenter;
+  lua_Integer dropped_frames = 0;
+  int current = 0;
+  while (p_presenter->buffers[current] != p_window->pixels) {
+    current++;
+  }
+
+  mutex_lock(&p_presenter->mutex);
+  present_frame frame;
+  frame.buffer = current;
+  memcpy(frame.damage, p_window->damage,
+         p_window->damage_count * sizeof(damage_rect));
+  frame.damage_count = p_window->damage_count;
+
+  // find a free buffer to continue with
+  int next = -1;
+  for (;;) {
+    for (int i = 0; i < p_presenter->buffer_count; i++) {
+      if (p_presenter->buffer_states[i] == BUFFER_FREE) {
+        next = i;
+        break;
+      }
+    }
+    if (next >= 0) {
+      break;
+    }
+    if (p_presenter->drop && p_presenter->queue_count > 0) {
+      // the oldest frame is never presented, so its damage moves on
+      const present_frame *p_dropped =
+          &p_presenter->queue[p_presenter->queue_first];
+      for (int i = 0; i < p_dropped->damage_count; i++) {
+        add_damage(frame.damage, &frame.damage_count, p_dropped->damage[i]);
+      }
+      p_presenter->buffer_states[p_dropped->buffer] = BUFFER_FREE;
+      p_presenter->queue_first = (p_presenter->queue_first + 1) % MAX_BUFFERS;
+      p_presenter->queue_count--;
+      dropped_frames++;
+    } else {
+      cond_wait(&p_presenter->buffer_freed, &p_presenter->mutex);
+    }
+  }
+
+  // queue the finished frame and take the next buffer
+  p_presenter->queue[(p_presenter->queue_first + p_presenter->queue_count) %
+                     MAX_BUFFERS] = frame;
+  p_presenter->queue_count++;
+  p_presenter->buffer_states[current] = BUFFER_QUEUED;
+  p_presenter->buffer_states[next] = BUFFER_DRAWING;
+  p_window->total_presented_bytes += p_presenter->presented_bytes;
+  p_presenter->presented_bytes = 0;
+  cond_signal(&p_presenter->frame_queued);
+  mutex_unlock(&p_presenter->mutex);
+
+  // the present thread only reads the finished buffer, so it can be copied
+  // without holding the lock
+  if (p_presenter->preserve) {
+    memcpy(p_presenter->buffers[next], p_presenter->buffers[current],
+           p_window->pixels_length * sizeof(uint32_t));
+  }
+  p_window->pixels = p_presenter->buffers[next];
+  return dropped_frames;
+}
+
+/**
+ * Utility function to present the damaged rectangles of the window, either
+ * directly or by handing them to the present thread. Afterwards, nothing is
+ * damaged.
+ * @param p_window The window userdata
+ */
+static void present_window(window *p_window) {
+  // writes through window:buffer() can't be tracked
+  if (p_window->direct_access) {
+    damage_window(p_window, 0, 0, p_window->width, p_window->height);
+  }
+
+  lua_Integer damaged_pixels = 0;
+  for (int i = 0; i < p_window->damage_count; i++) {
+    const damage_rect *p_rect = &p_window->damage[i];
+    damaged_pixels += rect_area(*p_rect);
+
+    // indexed windows draw into the indices, so expand what changed
+    if (p_window->indices != NULL) {
+      const lua_Integer offset = (p_rect->top * p_window->width) + p_rect->left;
+      expand_args expand = {
+          p_window->pixels + offset,
+          p_window->indices + offset,
+          p_window->width,
+          p_rect->right - p_rect->left,
+          p_window->palette,
+      };
+      parallel_rows(expand_rows, &expand, p_rect->bottom - p_rect->top,
+                    rect_area(*p_rect) * sizeof(uint32_t));
+    }
+  }
+
+  // snapshot the frame before the present thread gets its buffer
+  if (p_window->p_recorder != NULL) {
+    record_frame(p_window);
+  }
+
+  if (p_window->p_presenter != NULL) {
+    // (exposed windows are damaged already, so nothing changed on screen
+    // either and the current buffer can be drawn into further)
+    if (p_window->damage_count > 0) {
+      p_window->total_dropped_frames += submit_frame(p_window);
+    }
+  } else {
+    present_rects(p_window, p_window->pixels, p_window->damage,
+                  p_window->damage_count);
+    p_window->total_presented_bytes +=
+        presented_bytes(p_window, damaged_pixels);
+  }
+
+  p_window->damaged_pixels = damaged_pixels;
+  p_window->damage_count = 0;
+}
+
+/**
+ * Utility function to start the next frame of the input. The pending input
+ * becomes the input of the last frame, and the keys, mouse coordinates and
+ * modifier keys are updated from the fenster struct. The events have to be
+ * processed already.
+ * @param L Lua state
+ * @param p_window The window userdata
+ */
+static void read_input(lua_State *L, window *p_window) {
+  // the pending input replaces the input events of the last frame
+  p_window->event_count = p_window->pending_event_count;
+  memcpy(p_window->events, p_window->pending_events,
+         p_window->event_count * sizeof(input_event));
+  memcpy(p_window->pressed, p_window->pending_pressed,
+         sizeof(p_window->pressed));
+  memcpy(p_window->released, p_window->pending_released,
+         sizeof(p_window->released));
+  p_window->pending_event_count = 0;
+  memset(p_window->pending_pressed, 0, sizeof(p_window->pending_pressed));
+  memset(p_window->pending_released, 0, sizeof(p_window->pending_released));
+
+  // update only the changed keys in the keys table in the registry
+  int keys_table_pushed = 0;
+  for (int i = 0; i < KEYS_LENGTH; i++) {
+    const uint8_t key = p_window->p_fenster->keys[i] != 0;
+    if (key != p_window->keys[i]) {
+      if (!keys_table_pushed) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, p_window->keys_ref);
+        keys_table_pushed = 1;
+      }
+      lua_pushboolean(L, key);
+      lua_rawseti(L, -2, i);
+      p_window->keys[i] = key;
+    }
+  }
+  if (keys_table_pushed) {
+    lua_pop(L, 1);
+  }
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+  // the present thread redraws exposed windows with the next frame
+  if (p_window->p_fenster->exposed) {
+    p_window->p_fenster->exposed = 0;
+    damage_window(p_window, 0, 0, p_window->width, p_window->height);
+  }
+#endif
+
+  // update the scaled mouse coordinates (floors the coordinates)
+  p_window->scaled_mouse_x = p_window->p_fenster->x / p_window->scale;
+  p_window->scaled_mouse_y = p_window->p_fenster->y / p_window->scale;
+
+  // update the modifier keys
+  p_window->mod_control = p_window->p_fenster->mod & 1;
+  p_window->mod_shift = (p_window->p_fenster->mod >> 1) & 1;
+  p_window->mod_alt = (p_window->p_fenster->mod >> 2) & 1;
+  p_window->mod_gui = (p_window->p_fenster->mod >> 3) & 1;
+}
+
+/**
+ * Utility function to process the pending events of the window and start the
+ * next frame of the input. Pushes true if the window is still open and false
+ * if it's closed.
+ * @param L Lua state
+ * @param p_window The window userdata
+ */
+static void update_window(lua_State *L, window *p_window) {
+  // (headless windows have no events to process)
+  const int open =
+      p_window->headless || fenster_events(p_window->p_fenster) == 0;
+  read_input(L, p_window);
+  lua_pushboolean(L, open);
+}
+
+/**
+ * Utility function to wait until the given deadline. Sleeps for most of the
+ * time and busy-waits for the last part, since sleeping is not precise enough.
+ * @param deadline The deadline in nanoseconds
+ */
+static void sleep_until(int64_t deadline) {
+  int64_t remaining = deadline - fenster_time_ns();
+  while (remaining - SPIN_NS >= NS_PER_MS) {
+    fenster_sleep((remaining - SPIN_NS) / NS_PER_MS);
+    remaining = deadline - fenster_time_ns();
+  }
+  while (fenster_time_ns() < deadline) {
+    // spin for the remaining sub-millisecond
+  }
+}
+
+/**
+ * Utility function to finish the frame statistics after the events were
+ * processed. Adds the frame to the rolling statistics and calls the budget
+ * callback if the time spent outside of sleeping exceeded the budget. The
+ * timing of all other phases has to be filled in already.
+ * @param L Lua state
+ * @param p_window The window userdata
+ * @param index Stack index of the window userdata, passed to the callback
+ * @param events_start_time When processing the events started, in nanoseconds
+ */
+static void finish_frame(lua_State *L, window *p_window, int index,
+                         int64_t events_start_time) {
+  const int64_t now = fenster_time_ns();
+  frame_timing *p_timing = &p_window->timing;
+  p_timing->events = now - events_start_time;
+  p_window->frame_end_time = now;
+
+  const int64_t busy = p_timing->work + p_timing->present + p_timing->events;
+  p_window->frame_history[p_window->history_next] = busy + p_timing->sleep;
+  p_window->work_history[p_window->history_next] = p_timing->work;
+  p_window->history_next = (p_window->history_next + 1) %
+                           p_window->history_length;
+  if (p_window->history_count < p_window->history_length) {
+    p_window->history_count++;
+  }
+  p_window->total_frames++;
+  p_window->total_missed_frames += p_window->missed_frames;
+
+  // the callback might close the window, so this has to come last
+  if (p_window->budget > 0 && busy > p_window->budget) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, p_window->budget_ref);
+    lua_pushvalue(L, index);
+    lua_pushnumber(L, (lua_Number)busy / NS_PER_MS);
+    lua_call(L, 2, 0);
+  }
+}
+
+/**
+ * Utility function to start a frame of the window. Sleeps until the frame
+ * deadline and updates the delta time. If frames took too long and deadlines
+ * were missed, the missed frames are skipped, or caught up by not sleeping
+ * until back on schedule if the catchup option is set.
+ * @param p_window The window userdata
+ * @param loop_start_time When the loop was entered, in nanoseconds
+ * @return When the frame started (after sleeping), in nanoseconds
+ */
+static int64_t pace_frame(window *p_window, int64_t loop_start_time) {
+  const int64_t frame_time = p_window->target_frame_time;
+  int64_t now = fenster_time_ns();
+  p_window->timing.work = loop_start_time - p_window->frame_end_time;
+  p_window->missed_frames = 0;
+  if (p_window->start_frame_time == 0) {
+    // initialize start frame time (this is the first frame)
+    p_window->start_frame_time = now;
+    p_window->frame_deadline = now + frame_time;
+  } else {
+    if (frame_time > 0) {
+      if (now < p_window->frame_deadline) {
+        sleep_until(p_window->frame_deadline);
+      } else {
+        p_window->missed_frames =
+            (now - p_window->frame_deadline) / frame_time;
+        if (!p_window->catchup) {
+          // stay on the same schedule, but drop the frames we missed
+          p_window->frame_deadline += p_window->missed_frames * frame_time;
+        }
+      }
+      p_window->frame_deadline += frame_time;
+    }
+    now = fenster_time_ns();  // update timestamp after sleeping
+    p_window->delta =
+        (lua_Number)(now - p_window->start_frame_time) / NS_PER_SEC;
+    p_window->start_frame_time = now;
+  }
+  p_window->timing.sleep = now - loop_start_time;
+  return now;
+}
+
+/**
+ * Main loop for the window. Handles FPS limiting and updates delta time, keys,
+ * mouse coordinates, modifier keys and the whole screen. Returns true if the
+ * window is still open and false if it's closed (only on Windows right now).
+ * Frames are paced against absolute deadlines, so oversleeping doesn't add up.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_loop(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const int64_t now = pace_frame(p_window, fenster_time_ns());
+
+  // only present what changed since the last frame
+  present_window(p_window);
+  const int64_t events_start_time = fenster_time_ns();
+  p_window->timing.present = events_start_time - now;
+  update_window(L, p_window);
+  finish_frame(L, p_window, 1, events_start_time);
+  return 1;
+}
+
+/**
+ * Utility function to get an open window from a table of windows. Throws an
+ * error if the value is not an open window.
+ * @param L Lua state
+ * @param index Stack index of the table
+ * @param i Index of the window in the table
+ * @return The window userdata
+ */
+static window *check_window_at(lua_State *L, int index, lua_Integer i) {
+  lua_rawgeti(L, index, i);
+  window *p_window = luaL_testudata(L, -1, WINDOW_METATABLE);
+  if (p_window == NULL || is_window_closed(p_window)) {
+    luaL_argerror(L, index,
+                  lua_pushfstring(L, "value at index %d must be an open window",
+                                  (int)i));
+  }
+  lua_pop(L, 1);
+  return p_window;
+}
+
+/**
+ * Main loop for several windows at once, like calling window:loop() for each
+ * of them, but it sleeps only once for all of them. The windows are paced by
+ * the latest of their frame deadlines, so they run at the lowest target FPS
+ * among them (without counting the frames the faster windows skip this way as
+ * missed). All windows are presented first, then the events of all windows
+ * are processed in one pass (on X11, the windows share one connection to the
+ * X server, so the events of every window are dispatched while processing the
+ * events of any of them). Returns true if all windows are still open and false
+ * if any of them is closed (only on Windows right now).
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_loopall(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const lua_Integer count = (lua_Integer)lua_rawlen(L, 1);
+  luaL_argcheck(L, count > 0, 1, "windows must not be empty");
+  window **windows = lua_newuserdata(L, count * sizeof(window *));
+  for (lua_Integer i = 0; i < count; i++) {
+    windows[i] = check_window_at(L, 1, i + 1);
+  }
+
+  // sleep once, until the latest frame deadline of the windows
+  const int64_t loop_start_time = fenster_time_ns();
+  int64_t deadline = 0;
+  for (lua_Integer i = 0; i < count; i++) {
+    if (windows[i]->start_frame_time != 0 &&
+        windows[i]->target_frame_time > 0 &&
+        windows[i]->frame_deadline > deadline) {
+      deadline = windows[i]->frame_deadline;
+    }
+  }
+  sleep_until(deadline);
+
+  // move the deadlines of the faster windows along by the time they waited
+  // for the others, so that waiting is not counted as missed frames
+  for (lua_Integer i = 0; i < count; i++) {
+    window *p_window = windows[i];
+    if (p_window->start_frame_time != 0 && p_window->target_frame_time > 0) {
+      const int64_t waited =
+          deadline - (p_window->frame_deadline > loop_start_time
+                          ? p_window->frame_deadline
+                          : loop_start_time);
+      if (waited > 0) {
+        p_window->frame_deadline += waited;
+      }
+    }
+  }
+
+  // (the deadlines have all passed, so this does not sleep anymore)
+  for (lua_Integer i = 0; i < count; i++) {
+    const int64_t now = pace_frame(windows[i], loop_start_time);
+    present_window(windows[i]);
+    windows[i]->timing.present = fenster_time_ns() - now;
+  }
+
+  // process the events of all windows
+  const int64_t events_start_time = fenster_time_ns();
+  int open = 1;
+#if !defined(_WIN32) && !defined(__APPLE__)
+  struct fenster *p_events_fenster = NULL;
+  for (lua_Integer i = 0; i < count; i++) {
+    if (windows[i]->headless) {
+      continue;
+    }
+    if (p_events_fenster == NULL) {
+      p_events_fenster = windows[i]->p_fenster;
+    } else if (!windows[i]->p_fenster->async) {
+      // (the present thread flushes what it presented itself)
+      fenster_flush(windows[i]->p_fenster);
+    }
+  }
+  if (p_events_fenster != NULL && fenster_events(p_events_fenster) != 0) {
+    open = 0;
+  }
+#else
+  for (lua_Integer i = 0; i < count; i++) {
+    if (!windows[i]->headless && fenster_events(windows[i]->p_fenster) != 0) {
+      open = 0;
+    }
+  }
+#endif
+  for (lua_Integer i = 0; i < count; i++) {
+    read_input(L, windows[i]);
+  }
+
+  // a budget callback might close any of the windows or take them out of the
+  // table (after which they might have been collected), so look them up again
+  for (lua_Integer i = 0; i < count; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    window *p_window = luaL_testudata(L, -1, WINDOW_METATABLE);
+    if (p_window == windows[i] && !is_window_closed(p_window)) {
+      finish_frame(L, p_window, lua_gettop(L), events_start_time);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pushboolean(L, open);
+  return 1;
+}
+
+/**
+ * Event-driven alternative to window:loop() for windows that only change in
+ * response to input. Presents what changed, then blocks until an input or
+ * expose event arrives or the optional timeout (in milliseconds) expires,
+ * instead of waking up at the target FPS. Afterwards it updates delta time,
+ * keys, mouse coordinates and modifier keys just like window:loop(). Headless
+ * windows never receive events, so they only sleep for the timeout.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_wait(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const lua_Integer timeout = luaL_optinteger(L, 2, -1);
+  luaL_argcheck(L,
+                lua_isnoneornil(L, 2) || (timeout >= 0 && timeout <= INT_MAX),
+                2, "timeout must be in range 0-2147483647");
+
+  // present first, so the window shows the current frame while waiting
+  const int64_t present_start_time = fenster_time_ns();
+  p_window->timing.work = present_start_time - p_window->frame_end_time;
+  present_window(p_window);
+  const int64_t wait_start_time = fenster_time_ns();
+  p_window->timing.present = wait_start_time - present_start_time;
+  if (!p_window->headless) {
+    fenster_wait(p_window->p_fenster, (int)timeout);
+  } else if (timeout > 0) {
+    fenster_sleep(timeout);
+  }
+
+  // start a new frame schedule, since waiting is not paced
+  const int64_t now = fenster_time_ns();
+  if (p_window->start_frame_time != 0) {
+    p_window->delta =
+        (lua_Number)(now - p_window->start_frame_time) / NS_PER_SEC;
+  }
+  p_window->start_frame_time = now;
+  p_window->frame_deadline = now + p_window->target_frame_time;
+  p_window->missed_frames = 0;
+  p_window->timing.sleep = now - wait_start_time;
+
+  update_window(L, p_window);
+  finish_frame(L, p_window, 1, now);
+  return 1;
+}
+
+/**
+ * Utility function to compare two int64_t values for qsort.
+ * @param a Pointer to the first value
+ * @param b Pointer to the second value
+ * @return Negative, zero or positive like strcmp
+ */
+static int compare_int64(const void *a, const void *b) {
+  const int64_t x = *(const int64_t *)a;
+  const int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Utility function to push a table with the min, avg, p50, p95, p99 and max of
+ * the given frame history in milliseconds. The history is sorted in place.
+ * @param L Lua state
+ * @param history The frame history, in nanoseconds
+ * @param count Number of frames in the history
+ */
+static void push_history_stats(lua_State *L, int64_t *history, int count) {
+  static const struct {
+    const char *name;
+    int percent;
+  } PERCENTILES[] = {{"p50", 50}, {"p95", 95}, {"p99", 99}};
+
+  lua_createtable(L, 0, 6);
+  if (count == 0) {
+    return;
+  }
+
+  qsort(history, count, sizeof(int64_t), compare_int64);
+  int64_t sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += history[i];
+  }
+  lua_pushnumber(L, (lua_Number)history[0] / NS_PER_MS);
+  lua_setfield(L, -2, "min");
+  lua_pushnumber(L, (lua_Number)sum / count / NS_PER_MS);
+  lua_setfield(L, -2, "avg");
+  for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); i++) {
+    // nearest-rank percentile
+    const int rank = (PERCENTILES[i].percent * count + 99) / 100;
+    lua_pushnumber(L, (lua_Number)history[rank - 1] / NS_PER_MS);
+    lua_setfield(L, -2, PERCENTILES[i].name);
+  }
+  lua_pushnumber(L, (lua_Number)history[count - 1] / NS_PER_MS);
+  lua_setfield(L, -2, "max");
+}
+
+/**
+ * Returns a table with statistics about the frames of the window. It contains
+ * the phases of the last frame, the rolling statistics of the frame and work
+ * times and the totals since the window was opened. All times are in
+ * milliseconds.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_stats(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const frame_timing *p_timing = &p_window->timing;
+
+  lua_createtable(L, 0, 7);
+
+  // phases of the last frame
+  lua_createtable(L, 0, 5);
+  lua_pushnumber(L, (lua_Number)(p_timing->work + p_timing->sleep +
+                                 p_timing->present + p_timing->events) /
+                        NS_PER_MS);
+  lua_setfield(L, -2, "frame");
+  lua_pushnumber(L, (lua_Number)p_timing->work / NS_PER_MS);
+  lua_setfield(L, -2, "work");
+  lua_pushnumber(L, (lua_Number)p_timing->sleep / NS_PER_MS);
+  lua_setfield(L, -2, "sleep");
+  lua_pushnumber(L, (lua_Number)p_timing->present / NS_PER_MS);
+  lua_setfield(L, -2, "present");
+  lua_pushnumber(L, (lua_Number)p_timing->events / NS_PER_MS);
+  lua_setfield(L, -2, "events");
+  lua_setfield(L, -2, "last");
+
+  // rolling statistics (sorting a copy keeps the order of the ring buffers)
+  int64_t history[MAX_STATS_FRAMES];
+  const size_t history_size = p_window->history_count * sizeof(int64_t);
+  memcpy(history, p_window->frame_history, history_size);
+  push_history_stats(L, history, p_window->history_count);
+  lua_setfield(L, -2, "frame");
+  memcpy(history, p_window->work_history, history_size);
+  push_history_stats(L, history, p_window->history_count);
+  lua_setfield(L, -2, "work");
+
+  // totals since the window was opened
+  lua_pushinteger(L, p_window->total_frames);
+  lua_setfield(L, -2, "frames");
+  lua_pushinteger(L, p_window->total_missed_frames);
+  lua_setfield(L, -2, "missed");
+  lua_pushinteger(L, p_window->total_presented_bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, p_window->total_dropped_frames);
+  lua_setfield(L, -2, "dropped");
+
+  // progress of the recording, if there is one
+  recorder *p_recorder = p_window->p_recorder;
+  if (p_recorder != NULL) {
+    lua_createtable(L, 0, 3);
+    mutex_lock(&p_recorder->mutex);
+    const lua_Integer written_frames = p_recorder->written_frames;
+    const lua_Integer dropped_frames = p_recorder->dropped_frames;
+    const lua_Integer queued_frames = p_recorder->queue_count;
+    mutex_unlock(&p_recorder->mutex);
+    lua_pushinteger(L, written_frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, dropped_frames);
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, queued_frames);
+    lua_setfield(L, -2, "queued");
+    lua_setfield(L, -2, "recording");
+  }
+  return 1;
+}
+
+/**
+ * Sets a callback that is called with the window and the busy time of the
+ * frame in milliseconds whenever a frame takes longer than the given budget.
+ * The busy time is everything except pacing and waiting, i.e. the time spent
+ * in Lua code, presenting and processing events. Calling this without a
+ * budget removes the callback again.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_setbudget(lua_State *L) {
+  window *p_window = check_open_window(L);
+  int64_t budget = 0;
+  if (!lua_isnoneornil(L, 2)) {
+    const lua_Number milliseconds = luaL_checknumber(L, 2);
+    luaL_argcheck(L, milliseconds > 0.0, 2, "budget must be positive");
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+    budget = llroundl(milliseconds * NS_PER_MS);
+  }
+
+  luaL_unref(L, LUA_REGISTRYINDEX, p_window->budget_ref);
+  p_window->budget_ref = LUA_NOREF;
+  p_window->budget = 0;
+  if (budget > 0) {
+    lua_pushvalue(L, 3);
+    p_window->budget_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    p_window->budget = budget;
+  }
+  return 0;
+}
+
+/**
+ * Iterator function for window:events(). The index of the next event is stored
+ * as an upvalue, the window is the invariant state of the generic for loop.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_events_next(lua_State *L) {
+  window *p_window = check_window(L);
+  const lua_Integer index = lua_tointeger(L, lua_upvalueindex(1));
+  if (is_window_closed(p_window) || index >= p_window->event_count) {
+    return 0;
+  }
+  lua_pushinteger(L, index + 1);
+  lua_replace(L, lua_upvalueindex(1));
+
+  const input_event *p_event = &p_window->events[index];
+  lua_pushstring(L, EVENT_NAMES[p_event->type]);
+  lua_pushinteger(L, p_event->code);
+  lua_pushinteger(L, p_event->x);
+  lua_pushinteger(L, p_event->y);
+  lua_pushinteger(L, p_event->time);
+  return 5;
+}
+
+/**
+ * Returns an iterator over the input events of the last frame, in the order
+ * they happened. Each iteration returns the event name, the key, mouse button
+ * or modifier mask, the mouse coordinates and the time of the event.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_events(lua_State *L) {
+  check_open_window(L);
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, window_events_next, 1);
+  lua_pushvalue(L, 1);
+  return 2;
+}
+
+/**
+ * Get a pointer to the window buffer for writing pixels from native code, e.g.
+ * through the LuaJIT FFI. From then on, the whole window is presented every
+ * frame, since direct writes can't be tracked.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_buffer(lua_State *L) {
+  window *p_window = check_open_window(L);
+
+  p_window->direct_access = 1;
+  if (p_window->indices != NULL) {
+    lua_pushlightuserdata(L, p_window->indices);
+  } else {
+    lua_pushlightuserdata(L, p_window->pixels);
+  }
+  lua_pushinteger(L, p_window->width);
+  lua_pushinteger(L, p_window->height);
+  lua_pushinteger(L, p_window->width);  // stride in pixels
+  lua_pushinteger(L, p_window->scale);
+  return 5;
+}
+
+/**
+ * Starts recording everything the window presents into a file, or stops the
+ * recording if no path is given. Every frame is copied into one of the frame
+ * slots and a separate thread encodes and writes it, so the frame loop never
+ * waits for the disk. If all slots are still queued, the frame is dropped.
+ * Starting returns true, or nil and an error message if the file can't be
+ * opened. Stopping waits for the queued frames and returns the number of
+ * written and dropped frames, or nil and an error message if writing failed.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_record(lua_State *L) {
+  window *p_window = check_open_window(L);
+
+  if (lua_isnoneornil(L, 2)) {
+    if (p_window->p_recorder == NULL) {
+      return 0;
+    }
+    lua_Integer written_frames = 0;
+    lua_Integer dropped_frames = 0;
+    const int error = stop_recorder(p_window->p_recorder, &written_frames,
+                                    &dropped_frames);
+    p_window->p_recorder = NULL;
+    if (error != 0) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "failed to write recording: %s", strerror(error));
+      return 2;
+    }
+    lua_pushinteger(L, written_frames);
+    lua_pushinteger(L, dropped_frames);
+    return 2;
+  }
+
+  const char *path = luaL_checkstring(L, 2);
+  luaL_argcheck(L, p_window->p_recorder == NULL, 1,
+                "window is already recording");
+  int format = RECORD_Y4M;
+  lua_Integer slot_count = DEFAULT_RECORD_SLOTS;
+  const lua_Number target_fps = p_window->target_fps;
+  lua_Integer fps = target_fps >= 1.0 && target_fps <= MAX_RECORD_FPS
+                        ? (lua_Integer)llround(target_fps)
+                        : (lua_Integer)llround(DEFAULT_TARGET_FPS);
+  if (!lua_isnoneornil(L, 3)) {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_getfield(L, 3, "format");
+    if (!lua_isnil(L, -1)) {
+      const char *name = lua_tostring(L, -1);
+      for (format = 0; RECORD_FORMAT_NAMES[format] != NULL; format++) {
+        if (name != NULL && strcmp(name, RECORD_FORMAT_NAMES[format]) == 0) {
+          break;
+        }
+      }
+      luaL_argcheck(L, RECORD_FORMAT_NAMES[format] != NULL, 3,
+                    "format option must be 'y4m' or 'rgb'");
+    }
+    lua_pop(L, 1);
+    slot_count = opt_integer_field(L, 3, "slots", slot_count, 1,
+                                   MAX_RECORD_SLOTS);
+    fps = opt_integer_field(L, 3, "fps", fps, 1, MAX_RECORD_FPS);
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    const int error = errno;
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to open file: %s: %s", path, strerror(error));
+    return 2;
+  }
+  const int result =
+      start_recorder(p_window, file, format, (int)slot_count, fps);
+  if (result != 0) {
+    return luaL_error(L, "failed to start recording (%d)", result);
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Set one color of the palette of an indexed window, or several at once from
+ * a table. Everything is presented again in the next frame, since any pixel
+ * might use the changed colors.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_setpalette(lua_State *L) {
+  window *p_window = check_open_window(L);
+  luaL_argcheck(L, p_window->indices != NULL, 1, "window is not indexed");
+
+  if (lua_type(L, 2) == LUA_TTABLE) {
+    const lua_Integer first =
+        lua_isnoneornil(L, 3) ? 0 : check_palette_index(L, 3);
+    const lua_Integer count = (lua_Integer)lua_rawlen(L, 2);
+    luaL_argcheck(L, first + count <= PALETTE_SIZE, 2,
+                  "colors don't fit into the palette");
+    for (lua_Integer i = 0; i < count; i++) {
+      lua_rawgeti(L, 2, i + 1);
+      int is_integer = 0;
+      const lua_Integer color = lua_tointegerx(L, -1, &is_integer);
+      if (!is_integer || color < 0 || color > MAX_ALPHA_COLOR) {
+        return luaL_argerror(
+            L, 2,
+            lua_pushfstring(L,
+                            "color at index %d must be an integer in range "
+                            "0x00000000-0xffffffff",
+                            (int)(i + 1)));
+      }
+      lua_pop(L, 1);
+      p_window->palette[first + i] = (uint32_t)color;
+    }
+  } else {
+    const lua_Integer palette_index = check_palette_index(L, 2);
+    p_window->palette[palette_index] = (uint32_t)check_color(L, 3);
+  }
+
+  damage_window(p_window, 0, 0, p_window->width, p_window->height);
+  return 0;
+}
+
+/**
+ * Utility function to get a key from the Lua stack and check if it's within
+ * the range of the keys table.
+ * @param L Lua state
+ * @param index Index of the key on the Lua stack
+ * @return The key
+ */
+static lua_Integer check_key(lua_State *L, int index) {
+  const lua_Integer key = luaL_checkinteger(L, index);
+  luaL_argcheck(L, key >= 0 && key < KEYS_LENGTH, index,
+                "key must be in range 0-255");
+  return key;
+}
+
+/**
+ * Returns whether the key was pressed during the last frame, even if it was
+ * released again within the same frame.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_pressed(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const lua_Integer key = check_key(L, 2);
+  lua_pushboolean(L, p_window->pressed[key]);
+  return 1;
+}
+
+/**
+ * Returns whether the key was released during the last frame, even if it was
+ * pressed again within the same frame.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_released(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const lua_Integer key = check_key(L, 2);
+  lua_pushboolean(L, p_window->released[key]);
+  return 1;
+}
+
+/**
+ * Utility function to get the x coordinate from the Lua stack and check if it's
+ * within bounds.
+ * @param L Lua state
+ * @param width The width of the window or surface
+ * @return The x coordinate
+ */
+static lua_Integer check_x(lua_State *L, lua_Integer width) {
+  const lua_Integer x = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, x >= 0 && x < width, 2,
+                "x coordinate must be in range 0-[width-1]");
+  return x;
+}
+
+/**
+ * Utility function to get the y coordinate from the Lua stack and check if it's
+ * within bounds.
+ * @param L Lua state
+ * @param height The height of the window or surface
+ * @return The y coordinate
+ */
+static lua_Integer check_y(lua_State *L, lua_Integer height) {
+  const lua_Integer y = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, y >= 0 && y < height, 3,
+                "y coordinate must be in range 0-[height-1]");
+  return y;
+}
+
+/**
+ * Utility function to get a coordinate from the Lua stack that may be outside
+ * of the window or surface bounds and is clipped later, but still has to be in
+ * a range where no overflows can happen during clipping.
+ * @param L Lua state
+ * @param index Index of the coordinate on the Lua stack
+ * @return The coordinate
+ */
+static lua_Integer check_coordinate(lua_State *L, int index) {
+  const lua_Integer coordinate = luaL_checkinteger(L, index);
+  luaL_argcheck(L,
+                coordinate >= -MAX_COORDINATE && coordinate <= MAX_COORDINATE,
+                index, "coordinate must be in range -2147483647-2147483647");
+  return coordinate;
+}
+
+/**
+ * Set a pixel in the window buffer at the given coordinates to the given color.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_set(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const lua_Integer x = check_x(L, p_window->width);
+  const lua_Integer y = check_y(L, p_window->height);
+  if (p_window->indices != NULL) {
+    p_window->indices[(y * p_window->width) + x] =
+        (uint8_t)check_palette_index(L, 4);
+    damage_window(p_window, x, y, 1, 1);
+    return 0;
+  }
+  const lua_Integer color = check_color(L, 4);
+
+  uint32_t *p_pixel = &window_pixel(p_window, x, y);
+  *p_pixel = p_window->blend == BLEND_REPLACE
+                 ? color
+                 : blend_pixel(*p_pixel, color, p_window->blend);
+  damage_window(p_window, x, y, 1, 1);
+  return 0;
+}
+
+/**
+ * Get the color of a pixel in the window buffer at the given coordinates.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_get(lua_State *L) {
+  window *p_window = check_open_window(L);
+  const lua_Integer x = check_x(L, p_window->width);
+  const lua_Integer y = check_y(L, p_window->height);
+
+  if (p_window->indices != NULL) {
+    lua_pushinteger(L, p_window->indices[(y * p_window->width) + x]);
+  } else {
+    lua_pushinteger(L, window_pixel(p_window, x, y));
+  }
+  return 1;
+}
+
+/**
+ * Utility function to fill a span of pixels with the given color. Uses
+ * aligned SIMD stores where available, and non-temporal stores that bypass
+ * the cache for very large spans (which wouldn't fit into the cache anyway).
+ * @param span The first pixel of the span
+ * @param length Number of pixels in the span
+ * @param color The color
+ */
+static void fill_span(uint32_t *span, size_t length, uint32_t color) {
+  size_t i = 0;
+#if defined(USE_AVX2)
+  // scalar stores until the span is aligned for the vector stores
+  for (; i < length && ((uintptr_t)(span + i) & 31) != 0; i++) {
+    span[i] = color;
+  }
+  const __m256i colors = _mm256_set1_epi32((int)color);
+  if (length - i >= STREAM_FILL_PIXELS) {
+    for (; i + 8 <= length; i += 8) {
+      _mm256_stream_si256((__m256i *)(span + i), colors);
+    }
+    _mm_sfence();  // make the streamed stores visible before continuing
+  } else {
+    for (; i + 8 <= length; i += 8) {
+      _mm256_store_si256((__m256i *)(span + i), colors);
+    }
+  }
+#elif defined(USE_SSE2)
+  // scalar stores until the span is aligned for the vector stores
+  for (; i < length && ((uintptr_t)(span + i) & 15) != 0; i++) {
+    span[i] = color;
+  }
+  const __m128i colors = _mm_set1_epi32((int)color);
+  if (length - i >= STREAM_FILL_PIXELS) {
+    for (; i + 4 <= length; i += 4) {
+      _mm_stream_si128((__m128i *)(span + i), colors);
+    }
+    _mm_sfence();  // make the streamed stores visible before continuing
+  } else {
+    for (; i + 4 <= length; i += 4) {
+      _mm_store_si128((__m128i *)(span + i), colors);
+    }
+  }
+#endif
+  for (; i < length; i++) {
+    span[i] = color;
+  }
+}
+
+/** Arguments of the fill_rows kernel */
+typedef struct fill_args {
+  uint32_t *pixels;  // first pixel of the first row
+  lua_Integer stride;
+  lua_Integer width;  // pixels per row
+  uint32_t color;
+  int mode;  // blend mode
+} fill_args;
+
+/**
+ * Pixel kernel that fills rows with a color or blends it over them. If the
+ * rows span the whole buffer width, they are filled as a single span.
+ * @param p_args The fill_args
+ * @param first The first row
+ * @param last The row after the last row
+ */
+static void fill_rows(void *p_args, lua_Integer first, lua_Integer last) {
+  const fill_args *p_fill = p_args;
+  uint32_t *row = p_fill->pixels + (first * p_fill->stride);
+  lua_Integer width = p_fill->width;
+  if (width == p_fill->stride) {
+    width *= last - first;
+    last = first + 1;
+  }
+  for (lua_Integer y = first; y < last; y++, row += p_fill->stride) {
+    if (p_fill->mode == BLEND_REPLACE) {
+      fill_span(row, width, p_fill->color);
+    } else {
+      blend_span(row, width, p_fill->color, p_fill->mode);
+    }
+  }
+}
+
+/**
+ * Utility function to fill a rectangle of a pixel buffer with the given color.
+ * The rectangle has to be completely within bounds. Large rectangles are
+ * filled by several threads.
+ * @param pixels The pixel buffer
+ * @param buffer_width The width of the pixel buffer
+ * @param x The x coordinate of the top left corner
+ * @param y The y coordinate of the top left corner
+ * @param width The width of the rectangle
+ * @param height The height of the rectangle
+ * @param color The color
+ * @param mode The blend mode
+ */
+static void fill_rect(uint32_t *pixels, lua_Integer buffer_width,
+                      lua_Integer x, lua_Integer y, lua_Integer width,
+                      lua_Integer height, uint32_t color, int mode) {
+  fill_args fill = {pixels + (y * buffer_width) + x, buffer_width, width,
+                    color, mode};
+  parallel_rows(fill_rows, &fill, height, width * height * sizeof(uint32_t));
+}
+
+/**
+ * Utility function to clip a rectangle to the bounds of a window or surface.
+ * @param p_x The x coordinate of the top left corner, updated in place
+ * @param p_y The y coordinate of the top left corner, updated in place
+ * @param p_width The width of the rectangle, updated in place
+ * @param p_height The height of the rectangle, updated in place
+ * @param bounds_width The width of the window or surface
+ * @param bounds_height The height of the window or surface
+ * @return Whether anything of the rectangle is left after clipping
+ */
+static int clip_rect(lua_Integer *p_x, lua_Integer *p_y, lua_Integer *p_width,
+                     lua_Integer *p_height, lua_Integer bounds_width,
+                     lua_Integer bounds_height) {
+  if (*p_x < 0) {
+    *p_width += *p_x;
+    *p_x = 0;
+  }
+  if (*p_y < 0) {
+    *p_height += *p_y;
+    *p_y = 0;
+  }
+  if (*p_x + *p_width > bounds_width) {
+    *p_width = bounds_width - *p_x;
+  }
+  if (*p_y + *p_height > bounds_height) {
+    *p_height = bounds_height - *p_y;
+  }
+  return *p_width > 0 && *p_height > 0;
+}
+
+/**
+ * Clear the window buffer with the given color.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_clear(lua_State *L) {
+  window *p_window = check_open_window(L);
+
+  // overwrite the whole buffer with the given color (or palette index)
+  if (p_window->indices != NULL) {
+    const lua_Integer palette_index =
+        lua_isnoneornil(L, 2) ? 0 : check_palette_index(L, 2);
+    memset(p_window->indices, (int)palette_index, p_window->pixels_length);
+  } else {
+    const lua_Integer color = opt_color(L, 2, 0x000000);
+    fill_rect(p_window->pixels, p_window->width, 0, 0, p_window->width,
+              p_window->height, color, BLEND_REPLACE);
+  }
+  damage_window(p_window, 0, 0, p_window->width, p_window->height);
+
+  return 0;
+}
+
+/**
+ * Utility function to write a row of pixels into the window buffer at the
+ * given coordinates. The row has to be completely within bounds.
+ * @param p_window The window userdata
+ * @param x The x coordinate of the first pixel
+ * @param y The y coordinate of the row
+ * @param row The colors of the pixels
+ * @param length Number of pixels in the row
+ */
+static void write_row(window *p_window, lua_Integer x, lua_Integer y,
+                      const uint32_t *row, size_t length) {
+  memcpy(&window_pixel(p_window, x, y), row, length * sizeof(uint32_t));
+}
+
+/** Formats of the pixel data accepted by the setregion method */
+typedef enum region_format {
+  REGION_TABLE,
+  REGION_PACKED_COLOR,
+  REGION_PACKED_RGB,
+} region_format;
+
+/**
+ * Set a rectangular region of pixels in the window buffer at once. The pixel
+ * data can either be a table of colors or a string of packed colors (4 bytes
+ * native-endian ARGB each or 3 bytes RGB each), row by row. The pixels are
+ * replaced, alpha included, without blending. Pixels outside the window are
+ * clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_setregion(lua_State *L) {
+  window *p_window = check_open_window(L);
+  luaL_argcheck(L, p_window->indices == NULL, 1,
+                "setregion is not supported for indexed windows");
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer width = check_dimension(L, 4);
+  const lua_Integer height = check_dimension(L, 5);
+  const size_t pixels = width * height;
+
+  // figure out the format of the pixel data by its type and size
+  region_format format = REGION_TABLE;
+  const char *data = NULL;
+  if (lua_type(L, 6) == LUA_TSTRING) {
+    size_t data_size = 0;
+    data = lua_tolstring(L, 6, &data_size);
+    if (data_size == pixels * PACKED_COLOR_SIZE) {
+      format = REGION_PACKED_COLOR;
+    } else if (data_size == pixels * PACKED_RGB_SIZE) {
+      format = REGION_PACKED_RGB;
+    } else {
+      return luaL_argerror(
+          L, 6, "data must contain width*height packed colors or RGB colors");
+    }
+  } else {
+    luaL_checktype(L, 6, LUA_TTABLE);
+    luaL_argcheck(L, lua_rawlen(L, 6) == pixels, 6,
+                  "data must contain width*height colors");
+  }
+
+  // clip the region to the window bounds
+  if (x >= p_window->width || y >= p_window->height) {
+    return 0;  // region is completely outside the window
+  }
+  const lua_Integer begin_x = x < 0 ? 0 : x;
+  const lua_Integer begin_y = y < 0 ? 0 : y;
+  const lua_Integer end_x =
+      x + width > p_window->width ? p_window->width : x + width;
+  const lua_Integer end_y =
+      y + height > p_window->height ? p_window->height : y + height;
+  if (begin_x >= end_x || begin_y >= end_y) {
+    return 0;  // region is completely outside the window
+  }
+  const size_t row_length = end_x - begin_x;
+
+  damage_window(p_window, begin_x, begin_y, row_length, end_y - begin_y);
+
+  // temporary row buffer (as userdata, so it is freed even if we throw)
+  uint32_t *row = lua_newuserdata(L, row_length * sizeof(uint32_t));
+
+  for (lua_Integer row_y = begin_y; row_y < end_y; row_y++) {
+    // index of the first visible pixel of this row in the pixel data
+    const size_t offset = ((row_y - y) * width) + (begin_x - x);
+
+    switch (format) {
+      case REGION_PACKED_COLOR:
+        // (copied bytewise, since the string might not be aligned for
+        // uint32_t)
+        memcpy(row, data + (offset * PACKED_COLOR_SIZE),
+               row_length * sizeof(uint32_t));
+        break;
+      case REGION_PACKED_RGB: {
+        const unsigned char *rgb =
+            (const unsigned char *)data + (offset * PACKED_RGB_SIZE);
+        for (size_t i = 0; i < row_length; i++, rgb += PACKED_RGB_SIZE) {
+          row[i] = ((uint32_t)rgb[0] << COLOR_RED_OFFSET) |
+                   ((uint32_t)rgb[1] << COLOR_GREEN_OFFSET) | rgb[2];
+        }
+      } break;
+      case REGION_TABLE:
+        for (size_t i = 0; i < row_length; i++) {
+          lua_rawgeti(L, 6, (lua_Integer)(offset + i + 1));
+          int is_integer = 0;
+          const lua_Integer color = lua_tointegerx(L, -1, &is_integer);
+          if (!is_integer || color < 0 || color > MAX_ALPHA_COLOR) {
+            return luaL_argerror(
+                L, 6,
+                lua_pushfstring(L,
+                                "color at index %d must be an integer in range "
+                                "0x00000000-0xffffffff",
+                                (int)(offset + i + 1)));
+          }
+          row[i] = color;
+          lua_pop(L, 1);
+        }
+        break;
+    }
+
+    write_row(p_window, begin_x, row_y, row, row_length);
+  }
+
+  return 0;
+}
+
+/**
+ * Index function for the window userdata. Its first upvalue is a lookup table
+ * built by luaopen_fenster, which maps the method names to the methods and the
+ * property names to their window_property, so any key is resolved with a
+ * single raw table access (the key strings are interned by Lua, so that is a
+ * hash lookup without any string comparison). The second upvalue is the window
+ * metatable, which is compared directly instead of looking it up by name in
+ * the registry.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_index(lua_State *L) {
+  if (!lua_getmetatable(L, 1) || !lua_rawequal(L, -1, lua_upvalueindex(2))) {
+    check_window(L);  // throws the usual error
+  }
+  window *p_window = lua_touserdata(L, 1);
+  if (is_window_closed(p_window)) {
+    return luaL_error(L, "attempt to use a closed window");
+  }
+  luaL_checkstring(L, 2);
+
+  lua_pushvalue(L, 2);
+  if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNUMBER) {
+    return 1;  // either the method or nil for unknown keys
+  }
+
+  switch ((enum window_property)lua_tointeger(L, -1)) {
+    case WINDOW_KEYS:
+      // retrieve the keys table from the registry
+      lua_rawgeti(L, LUA_REGISTRYINDEX, p_window->keys_ref);
+      break;
+    case WINDOW_DELTA:
+      lua_pushnumber(L, p_window->delta);
+      break;
+    case WINDOW_MOUSE_X:
+      lua_pushinteger(L, p_window->scaled_mouse_x);
+      break;
+    case WINDOW_MOUSE_Y:
+      lua_pushinteger(L, p_window->scaled_mouse_y);
+      break;
+    case WINDOW_MOUSE_DOWN:
+      lua_pushboolean(L, p_window->p_fenster->mouse);
+      break;
+    case WINDOW_MOD_CONTROL:
+      lua_pushboolean(L, p_window->mod_control);
+      break;
+    case WINDOW_MOD_SHIFT:
+      lua_pushboolean(L, p_window->mod_shift);
+      break;
+    case WINDOW_MOD_ALT:
+      lua_pushboolean(L, p_window->mod_alt);
+      break;
+    case WINDOW_MOD_GUI:
+      lua_pushboolean(L, p_window->mod_gui);
+      break;
+    case WINDOW_WIDTH:
+      lua_pushinteger(L, p_window->width);
+      break;
+    case WINDOW_HEIGHT:
+      lua_pushinteger(L, p_window->height);
+      break;
+    case WINDOW_TITLE:
+      lua_pushstring(L, p_window->p_fenster->title);
+      break;
+    case WINDOW_SCALE:
+      lua_pushinteger(L, p_window->scale);
+      break;
+    case WINDOW_TARGET_FPS:
+      lua_pushnumber(L, p_window->target_fps);
+      break;
+    case WINDOW_SHM:
+      lua_pushboolean(L, p_window->p_fenster->shm);
+      break;
+    case WINDOW_HEADLESS:
+      lua_pushboolean(L, p_window->headless);
+      break;
+    case WINDOW_DAMAGE:
+      lua_pushinteger(L, p_window->damaged_pixels);
+      break;
+    case WINDOW_MISSED:
+      lua_pushinteger(L, p_window->missed_frames);
+      break;
+    case WINDOW_BLEND:
+      lua_pushstring(L, BLEND_MODE_NAMES[p_window->blend]);
+      break;
+    case WINDOW_INDEXED:
+      lua_pushboolean(L, p_window->indices != NULL);
+      break;
+  }
+  return 1;  // return the property value
+}
+
+/**
+ * Get the mouse state of the window in one call, which is cheaper than
+ * reading the mousex, mousey and mousedown properties one by one.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_mouse(lua_State *L) {
+  const window *p_window = check_open_window(L);
+
+  lua_pushinteger(L, p_window->scaled_mouse_x);
+  lua_pushinteger(L, p_window->scaled_mouse_y);
+  lua_pushboolean(L, p_window->p_fenster->mouse);
+  return 3;
+}
+
+/**
+ * Get the state of the modifier keys of the window in one call, which is
+ * cheaper than reading the modcontrol, modshift, modalt and modgui properties
+ * one by one.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_mods(lua_State *L) {
+  const window *p_window = check_open_window(L);
+
+  lua_pushboolean(L, p_window->mod_control);
+  lua_pushboolean(L, p_window->mod_shift);
+  lua_pushboolean(L, p_window->mod_alt);
+  lua_pushboolean(L, p_window->mod_gui);
+  return 4;
+}
+
+/**
+ * Close the window when the window userdata is garbage collected.
+ * Just calls the close method but ignores if the window is already closed.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_gc(lua_State *L) {
+  window *p_window = check_window(L);
+
+  // ignore if the window is already closed
+  if (!is_window_closed(p_window)) {
+    window_close(L);
+  }
+
+  return 0;
+}
+
+/**
+ * Returns a string representation of the window userdata.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int window_tostring(lua_State *L) {
+  window *p_window = check_window(L);
+
+  if (is_window_closed(p_window)) {
+    lua_pushliteral(L, "window (closed)");
+  } else {
+    lua_pushfstring(L, "window (%p)", p_window);
+  }
+  return 1;
+}
+
+/**
+ * Utility function to create a surface filled with black and push it onto the
+ * Lua stack. The pixels of the surface are stored in the same userdata, so
+ * they are freed together with the surface by the garbage collector.
+ * @param L Lua state
+ * @param width The width of the surface (already checked)
+ * @param height The height of the surface (already checked)
+ * @return The surface userdata
+ */
+static surface *new_surface(lua_State *L, lua_Integer width,
+                            lua_Integer height) {
+  const size_t pixels_size = width * height * sizeof(uint32_t);
+  surface *p_surface = lua_newuserdata(L, sizeof(surface) + pixels_size);
+  p_surface->pixels = (uint32_t *)(p_surface + 1);
+  memset(p_surface->pixels, 0, pixels_size);
+  p_surface->width = width;
+  p_surface->height = height;
+  p_surface->blend = BLEND_REPLACE;
+  luaL_setmetatable(L, SURFACE_METATABLE);
+  return p_surface;
+}
+
+/**
+ * Creates an offscreen surface with the given width and height.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_surface(lua_State *L) {
+  const lua_Integer width = check_dimension(L, 1);
+  const lua_Integer height = check_dimension(L, 2);
+
+  new_surface(L, width, height);
+  return 1;
+}
+
+/** Macro to get the surface userdata from the Lua stack */
+#define check_surface(L) \
+  ((surface *)luaL_checkudata(L, 1, SURFACE_METATABLE))
+
+/** Macro to get a pixel of a surface */
+#define surface_pixel(p_surface, x, y) \
+  ((p_surface)->pixels[((y) * (p_surface)->width) + (x)])
+
+/**
+ * Set a pixel in the surface at the given coordinates to the given color.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int surface_set(lua_State *L) {
+  surface *p_surface = check_surface(L);
+  const lua_Integer x = check_x(L, p_surface->width);
+  const lua_Integer y = check_y(L, p_surface->height);
+  const lua_Integer color = check_color(L, 4);
+
+  uint32_t *p_pixel = &surface_pixel(p_surface, x, y);
+  *p_pixel = p_surface->blend == BLEND_REPLACE
+                 ? color
+                 : blend_pixel(*p_pixel, color, p_surface->blend);
+  return 0;
+}
+
+/**
+ * Get the color of a pixel in the surface at the given coordinates.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int surface_get(lua_State *L) {
+  surface *p_surface = check_surface(L);
+  const lua_Integer x = check_x(L, p_surface->width);
+  const lua_Integer y = check_y(L, p_surface->height);
+
+  lua_pushinteger(L, surface_pixel(p_surface, x, y));
+  return 1;
+}
+
+/**
+ * Clear the surface with the given color.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int surface_clear(lua_State *L) {
+  surface *p_surface = check_surface(L);
+  const lua_Integer color = opt_color(L, 2, 0x000000);
+
+  fill_rect(p_surface->pixels, p_surface->width, 0, 0, p_surface->width,
+            p_surface->height, color, BLEND_REPLACE);
+  return 0;
+}
+
+/**
+ * Copy a rectangular area of the surface into another surface or a window at
+ * the given coordinates. The area defaults to the whole surface. Everything
+ * outside the source or destination bounds is clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int surface_blit(lua_State *L) {
+  surface *p_src = check_surface(L);
+
+  // the destination can either be a surface or an open window
+  surface *p_dst = luaL_testudata(L, 2, SURFACE_METATABLE);
+  window *p_window = NULL;
+  if (p_dst == NULL) {
+    p_window = luaL_testudata(L, 2, WINDOW_METATABLE);
+    luaL_argcheck(L, p_window != NULL, 2, "surface or window expected");
+    luaL_argcheck(L, !is_window_closed(p_window), 2,
+                  "attempt to use a closed window");
+    luaL_argcheck(L, p_window->indices == NULL, 2,
+                  "can't blit colors into an indexed window");
+  }
+  const lua_Integer dst_width = p_dst ? p_dst->width : p_window->width;
+  const lua_Integer dst_height = p_dst ? p_dst->height : p_window->height;
+
+  lua_Integer dst_x = check_coordinate(L, 3);
+  lua_Integer dst_y = check_coordinate(L, 4);
+  lua_Integer src_x = luaL_opt(L, check_coordinate, 5, 0);
+  lua_Integer src_y = luaL_opt(L, check_coordinate, 6, 0);
+  lua_Integer width = luaL_opt(L, check_dimension, 7, p_src->width);
+  lua_Integer height = luaL_opt(L, check_dimension, 8, p_src->height);
+
+  // clip the area to the source bounds
+  if (src_x < 0) {
+    width += src_x;
+    dst_x -= src_x;
+    src_x = 0;
+  }
+  if (src_y < 0) {
+    height += src_y;
+    dst_y -= src_y;
+    src_y = 0;
+  }
+  if (src_x + width > p_src->width) {
+    width = p_src->width - src_x;
+  }
+  if (src_y + height > p_src->height) {
+    height = p_src->height - src_y;
+  }
+
+  // clip the area to the destination bounds
+  if (dst_x < 0) {
+    width += dst_x;
+    src_x -= dst_x;
+    dst_x = 0;
+  }
+  if (dst_y < 0) {
+    height += dst_y;
+    src_y -= dst_y;
+    dst_y = 0;
+  }
+  if (dst_x + width > dst_width) {
+    width = dst_width - dst_x;
+  }
+  if (dst_y + height > dst_height) {
+    height = dst_height - dst_y;
+  }
+  if (width <= 0 || height <= 0) {
+    return 0;  // nothing left to copy
+  }
+
+  // copying into a window or another surface can be split across threads,
+  // the rows never overlap
+  const size_t row_size = width * sizeof(uint32_t);
+  if (p_src != p_dst) {
+    copy_args copy = {
+        p_window ? &window_pixel(p_window, dst_x, dst_y)
+                 : &surface_pixel(p_dst, dst_x, dst_y),
+        dst_width,
+        &surface_pixel(p_src, src_x, src_y),
+        p_src->width,
+        row_size,
+        p_window ? p_window->blend : p_dst->blend,
+    };
+    if (p_window != NULL) {
+      damage_window(p_window, dst_x, dst_y, width, height);
+    }
+    parallel_rows(copy_rows, &copy, height, row_size * height);
+    return 0;
+  }
+
+  // when copying within the same surface, the rows might overlap, so copy
+  // them bottom to top if the area moves down, and blend from a copy of
+  // each source row
+  uint32_t *row = NULL;
+  if (p_dst->blend != BLEND_REPLACE) {
+    row = lua_newuserdata(L, row_size);
+  }
+  const lua_Integer step = dst_y > src_y ? -1 : 1;
+  for (lua_Integer i = 0, y = step < 0 ? height - 1 : 0; i < height;
+       i++, y += step) {
+    uint32_t *dst = &surface_pixel(p_dst, dst_x, dst_y + y);
+    const uint32_t *src = &surface_pixel(p_src, src_x, src_y + y);
+    if (row == NULL) {
+      memmove(dst, src, row_size);
+    } else {
+      memcpy(row, src, row_size);
+      blend_row(dst, row, width, p_dst->blend);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Utility function to read a big-endian 32-bit integer.
+ * @param bytes The first byte of the integer
+ * @return The integer
+ */
+static uint32_t read_u32be(const unsigned char *bytes) {
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+         ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+/**
+ * Utility function to read a little-endian 32-bit integer.
+ * @param bytes The first byte of the integer
+ * @return The integer
+ */
+static uint32_t read_u32le(const unsigned char *bytes) {
+  return ((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) |
+         ((uint32_t)bytes[1] << 8) | bytes[0];
+}
+
+/**
+ * Utility function to read a little-endian 16-bit integer.
+ * @param bytes The first byte of the integer
+ * @return The integer
+ */
+static uint32_t read_u16le(const unsigned char *bytes) {
+  return ((uint32_t)bytes[1] << 8) | bytes[0];
+}
+
+/**
+ * Utility function to write a big-endian 32-bit integer.
+ * @param bytes The first byte of the integer
+ * @param value The integer
+ */
+static void write_u32be(unsigned char *bytes, uint32_t value) {
+  bytes[0] = (unsigned char)(value >> 24);
+  bytes[1] = (unsigned char)(value >> 16);
+  bytes[2] = (unsigned char)(value >> 8);
+  bytes[3] = (unsigned char)value;
+}
+
+/**
+ * Utility function to write a little-endian 32-bit integer.
+ * @param bytes The first byte of the integer
+ * @param value The integer
+ */
+static void write_u32le(unsigned char *bytes, uint32_t value) {
+  bytes[0] = (unsigned char)value;
+  bytes[1] = (unsigned char)(value >> 8);
+  bytes[2] = (unsigned char)(value >> 16);
+  bytes[3] = (unsigned char)(value >> 24);
+}
+
+/**
+ * Utility function to write a little-endian 16-bit integer.
+ * @param bytes The first byte of the integer
+ * @param value The integer
+ */
+static void write_u16le(unsigned char *bytes, uint32_t value) {
+  bytes[0] = (unsigned char)value;
+  bytes[1] = (unsigned char)(value >> 8);
+}
+
+/**
+ * Utility function to create a surface for a decoded image and push it onto
+ * the Lua stack, or to return an error message if the image is too large or
+ * the file is too short for its pixels. The file size is checked before the
+ * surface is allocated, so a small file can't claim a huge image.
+ * @param L Lua state
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param max_pixels The most pixels the rest of the file can hold
+ * @param p_error Set to the error message if the image can't be decoded
+ * @return The surface, or NULL if the image can't be decoded
+ */
+static surface *new_image_surface(lua_State *L, uint32_t width,
+                                  uint32_t height, uint64_t max_pixels,
+                                  const char **p_error) {
+  if (width == 0 || height == 0 || width > MAX_DIMENSION ||
+      height > MAX_DIMENSION) {
+    *p_error = lua_pushfstring(
+        L, "image size (%dx%d) must be in range 1x1-15360x15360", (int)width,
+        (int)height);
+    return NULL;
+  }
+  if ((uint64_t)width * height > max_pixels) {
+    *p_error = "unexpected end of file while reading pixel data";
+    return NULL;
+  }
+  return new_surface(L, width, height);
+}
+
+/** Position in the data of an image file that is being decoded */
+typedef struct image_reader {
+  const unsigned char *data;
+  size_t size;
+  size_t position;
+} image_reader;
+
+/**
+ * Utility function to read an unsigned integer from the header or the pixel
+ * data of a PPM image, skipping leading whitespace and comments.
+ * @param p_reader The image reader
+ * @param p_value Set to the integer
+ * @return An error message, or NULL on success
+ */
+static const char *read_ppm_uint(image_reader *p_reader, uint32_t *p_value) {
+  const unsigned char *data = p_reader->data;
+  size_t position = p_reader->position;
+  for (;;) {
+    if (position >= p_reader->size) {
+      return "unexpected end of file";
+    }
+    if (data[position] == '#') {
+      while (position < p_reader->size && data[position] != '\n' &&
+             data[position] != '\r') {
+        position++;
+      }
+    } else if (data[position] == ' ' || data[position] == '\t' ||
+               data[position] == '\n' || data[position] == '\r') {
+      position++;
+    } else {
+      break;
+    }
+  }
+  if (data[position] < '0' || data[position] > '9') {
+    return "expected an unsigned integer but found invalid data";
+  }
+  uint32_t value = 0;
+  while (position < p_reader->size && data[position] >= '0' &&
+         data[position] <= '9') {
+    const uint32_t digit = data[position] - '0';
+    if (value > (0x7fffffffU - digit) / 10) {
+      return "integer value is too large to process";
+    }
+    value = (value * 10) + digit;
+    position++;
+  }
+  p_reader->position = position;
+  *p_value = value;
+  return NULL;
+}
+
+/**
+ * Utility function to decode a PPM image (plain P3 or raw P6 with 8 or 16 bits
+ * per sample) into a new surface on the Lua stack.
+ * @param L Lua state
+ * @param data The contents of the image file
+ * @param size The size of the image file
+ * @return An error message, or NULL on success
+ */
+static const char *decode_ppm(lua_State *L, const unsigned char *data,
+                              size_t size) {
+  image_reader reader = {data, size, 2};
+  const int raw = data[1] == '6';
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t maxval = 0;
+  const char *error = NULL;
+  if ((error = read_ppm_uint(&reader, &width)) != NULL ||
+      (error = read_ppm_uint(&reader, &height)) != NULL ||
+      (error = read_ppm_uint(&reader, &maxval)) != NULL) {
+    return lua_pushfstring(L, "failed to read PPM header: %s", error);
+  }
+  if (maxval == 0 || maxval > 65535) {
+    return lua_pushfstring(L, "max color value (%d) must be in range 1-65535",
+                           (int)maxval);
+  }
+
+  // raw samples follow after exactly one whitespace character, plain samples
+  // take at least a digit and the whitespace before it
+  const size_t bytes_per_sample = maxval < 256 ? 1 : 2;
+  if (raw) {
+    reader.position++;
+  }
+  const size_t rest = size < reader.position ? 0 : size - reader.position;
+  surface *p_surface = new_image_surface(
+      L, width, height, rest / (3 * (raw ? bytes_per_sample : 2)), &error);
+  if (p_surface == NULL) {
+    return error;
+  }
+
+  const size_t pixels = (size_t)width * height;
+  for (size_t i = 0; i < pixels; i++) {
+    uint32_t rgb[3];
+    for (int j = 0; j < 3; j++) {
+      if (!raw) {
+        if ((error = read_ppm_uint(&reader, &rgb[j])) != NULL) {
+          return lua_pushfstring(L, "failed to read pixel data: %s", error);
+        }
+      } else if (bytes_per_sample == 1) {
+        rgb[j] = data[reader.position++];
+      } else {
+        rgb[j] = ((uint32_t)data[reader.position] << 8) |
+                 data[reader.position + 1];
+        reader.position += 2;
+      }
+      if (rgb[j] > maxval) {
+        return lua_pushfstring(L,
+                               "color value (%d) exceeds max color value (%d)",
+                               (int)rgb[j], (int)maxval);
+      }
+      if (maxval != MAX_COLOR_COMPONENT) {
+        rgb[j] = rgb[j] * MAX_COLOR_COMPONENT / maxval;
+      }
+    }
+    p_surface->pixels[i] = (rgb[0] << COLOR_RED_OFFSET) |
+                           (rgb[1] << COLOR_GREEN_OFFSET) | rgb[2];
+  }
+  return NULL;
+}
+
+/** Sizes of the QOI header and end marker */
+enum { QOI_HEADER_SIZE = 14, QOI_END_MARKER_SIZE = 8 };
+
+/**
+ * Utility function to decode a QOI image into a new surface on the Lua stack.
+ * Images with 4 channels keep their alpha, images with 3 channels get an alpha
+ * of 0 like other colors without alpha.
+ * @param L Lua state
+ * @param data The contents of the image file
+ * @param size The size of the image file
+ * @return An error message, or NULL on success
+ */
+static const char *decode_qoi(lua_State *L, const unsigned char *data,
+                              size_t size) {
+  if (size < QOI_HEADER_SIZE + QOI_END_MARKER_SIZE) {
+    return "unexpected end of file while reading QOI header";
+  }
+  // a run chunk is the shortest way to encode pixels, with 62 pixels per byte
+  const uint64_t max_pixels =
+      (uint64_t)(size - QOI_HEADER_SIZE - QOI_END_MARKER_SIZE) * 62;
+  const char *error = NULL;
+  surface *p_surface = new_image_surface(L, read_u32be(data + 4),
+                                         read_u32be(data + 8), max_pixels,
+                                         &error);
+  if (p_surface == NULL) {
+    return error;
+  }
+
+  const int has_alpha = data[12] == 4;
+
+  // colors are kept as separate r, g, b and a bytes while decoding
+  unsigned char index[64][4];
+  memset(index, 0, sizeof(index));
+  unsigned char px[4] = {0, 0, 0, 255};
+  size_t position = QOI_HEADER_SIZE;
+  const size_t chunks_end = size - QOI_END_MARKER_SIZE;
+  int run = 0;
+  const size_t pixels = p_surface->width * p_surface->height;
+  for (size_t i = 0; i < pixels; i++) {
+    if (run > 0) {
+      run--;
+    } else {
+      if (position >= chunks_end) {
+        return "unexpected end of file while reading pixel data";
+      }
+      const unsigned char b1 = data[position++];
+      if (b1 == 0xfe || b1 == 0xff) {  // QOI_OP_RGB / QOI_OP_RGBA
+        const size_t length = b1 == 0xfe ? 3 : 4;
+        if (chunks_end - position < length) {
+          return "unexpected end of file while reading pixel data";
+        }
+        memcpy(px, data + position, length);
+        position += length;
+      } else if ((b1 & 0xc0) == 0x00) {  // QOI_OP_INDEX
+        memcpy(px, index[b1], sizeof(px));
+      } else if ((b1 & 0xc0) == 0x40) {  // QOI_OP_DIFF
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += (b1 & 0x03) - 2;
+      } else if ((b1 & 0xc0) == 0x80) {  // QOI_OP_LUMA
+        if (position >= chunks_end) {
+          return "unexpected end of file while reading pixel data";
+        }
+        const unsigned char b2 = data[position++];
+        const int vg = (b1 & 0x3f) - 32;
+        px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 + (b2 & 0x0f);
+      } else {  // QOI_OP_RUN
+        run = b1 & 0x3f;
+      }
+      memcpy(index[((px[0] * 3) + (px[1] * 5) + (px[2] * 7) + (px[3] * 11)) %
+                   64],
+             px, sizeof(px));
+    }
+    p_surface->pixels[i] = ((uint32_t)px[0] << COLOR_RED_OFFSET) |
+                           ((uint32_t)px[1] << COLOR_GREEN_OFFSET) | px[2];
+    if (has_alpha) {
+      p_surface->pixels[i] |= (uint32_t)px[3] << COLOR_ALPHA_OFFSET;
+    }
+  }
+  return NULL;
+}
+
+/** Sizes and offsets of the BMP headers */
+enum {
+  BMP_FILE_HEADER_SIZE = 14,
+  BMP_INFO_HEADER_SIZE = 40,
+  BMP_MASKS_SIZE = 12,
+  BMP_V3_INFO_HEADER_SIZE = 56,  // BITMAPV3INFOHEADER adds the alpha mask
+};
+
+/**
+ * Utility function to extract a color component of a BMP pixel with the
+ * given bit mask, scaled to 0-255.
+ * @param pixel The pixel value
+ * @param mask The bit mask of the color component
+ * @return The color component
+ */
+static uint32_t extract_bmp_component(uint32_t pixel, uint32_t mask) {
+  if (mask == 0) {
+    return 0;
+  }
+  int shift = 0;
+  while (((mask >> shift) & 1) == 0) {
+    shift++;
+  }
+  const uint32_t max = mask >> shift;
+  return (((pixel & mask) >> shift) * MAX_COLOR_COMPONENT) / max;
+}
+
+/**
+ * Utility function to decode an uncompressed BMP image (1, 4, 8 bits per pixel
+ * with a palette, or 16, 24, 32 bits per pixel, optionally with bit masks)
+ * into a new surface on the Lua stack. Only images with an alpha mask (in a
+ * BITMAPV3INFOHEADER or later) keep their alpha, all others get an alpha of 0.
+ * @param L Lua state
+ * @param data The contents of the image file
+ * @param size The size of the image file
+ * @return An error message, or NULL on success
+ */
+static const char *decode_bmp(lua_State *L, const unsigned char *data,
+                              size_t size) {
+  if (size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE) {
+    return "unexpected end of file while reading BMP header";
+  }
+  const unsigned char *info = data + BMP_FILE_HEADER_SIZE;
+  const uint32_t pixels_offset = read_u32le(data + 10);
+  const uint32_t info_size = read_u32le(info);
+  const int32_t width = (int32_t)read_u32le(info + 4);
+  const int32_t height = (int32_t)read_u32le(info + 8);
+  const uint32_t bits = read_u16le(info + 14);
+  const uint32_t compression = read_u32le(info + 16);
+  uint32_t colors = read_u32le(info + 32);
+  if (info_size < BMP_INFO_HEADER_SIZE) {
+    return "unsupported BMP header (only BITMAPINFOHEADER and later)";
+  }
+  if (compression != 0 && compression != 3) {
+    return lua_pushfstring(L, "unsupported BMP compression (%d)",
+                           (int)compression);
+  }
+  if (bits != 1 && bits != 4 && bits != 8 && bits != 16 && bits != 24 &&
+      bits != 32) {
+    return lua_pushfstring(L, "unsupported BMP bits per pixel (%d)",
+                           (int)bits);
+  }
+
+  // default masks, or the masks right after the info header (the alpha mask
+  // is part of the later info headers)
+  uint32_t masks[4] = {0xff0000, 0xff00, 0xff, 0};
+  if (bits == 16) {
+    masks[0] = 0x7c00, masks[1] = 0x03e0, masks[2] = 0x001f;
+  }
+  if (compression == 3) {
+    if (bits != 16 && bits != 32) {
+      return "BMP bit masks are only supported for 16 and 32 bits per pixel";
+    }
+    if (size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + BMP_MASKS_SIZE) {
+      return "unexpected end of file while reading BMP header";
+    }
+    for (int i = 0; i < 3; i++) {
+      masks[i] = read_u32le(info + BMP_INFO_HEADER_SIZE + (i * 4));
+    }
+    if (info_size >= BMP_V3_INFO_HEADER_SIZE) {
+      if (size < BMP_FILE_HEADER_SIZE + BMP_V3_INFO_HEADER_SIZE) {
+        return "unexpected end of file while reading BMP header";
+      }
+      masks[3] = read_u32le(info + BMP_INFO_HEADER_SIZE + BMP_MASKS_SIZE);
+    }
+  }
+
+  // palette of blue, green, red and unused bytes after the headers
+  const unsigned char *palette = info + info_size;
+  if (bits <= 8) {
+    if (colors == 0 || colors > (1U << bits)) {
+      colors = 1U << bits;
+    }
+    if (info_size > size - BMP_FILE_HEADER_SIZE ||
+        (size - BMP_FILE_HEADER_SIZE - info_size) / 4 < colors) {
+      return "unexpected end of file while reading BMP palette";
+    }
+  }
+
+  // negative heights mean that the rows are stored top to bottom
+  const int top_down = height < 0;
+  const uint32_t image_width = width < 0 ? 0 : (uint32_t)width;
+  const uint64_t row_size = ((((uint64_t)image_width * bits) + 31) / 32) * 4;
+  const uint64_t rows = pixels_offset > size || row_size == 0
+                            ? 0
+                            : (size - pixels_offset) / row_size;
+  const char *error = NULL;
+  surface *p_surface = new_image_surface(
+      L, image_width, top_down ? (uint32_t)-(int64_t)height : (uint32_t)height,
+      rows * image_width, &error);
+  if (p_surface == NULL) {
+    return error;
+  }
+
+  for (lua_Integer y = 0; y < p_surface->height; y++) {
+    const unsigned char *row =
+        data + pixels_offset +
+        ((top_down ? y : p_surface->height - 1 - y) * row_size);
+    uint32_t *dst = &surface_pixel(p_surface, 0, y);
+    for (lua_Integer x = 0; x < p_surface->width; x++) {
+      if (bits <= 8) {
+        const size_t bit = x * bits;
+        const uint32_t color_index =
+            (row[bit / 8] >> (8 - bits - (bit % 8))) & ((1U << bits) - 1);
+        if (color_index >= colors) {
+          return lua_pushfstring(L,
+                                 "color index (%d) exceeds palette size (%d)",
+                                 (int)color_index, (int)colors);
+        }
+        const unsigned char *bgr = palette + (color_index * 4);
+        dst[x] = ((uint32_t)bgr[2] << COLOR_RED_OFFSET) |
+                 ((uint32_t)bgr[1] << COLOR_GREEN_OFFSET) | bgr[0];
+      } else if (bits == 24) {
+        const unsigned char *bgr = row + (x * 3);
+        dst[x] = ((uint32_t)bgr[2] << COLOR_RED_OFFSET) |
+                 ((uint32_t)bgr[1] << COLOR_GREEN_OFFSET) | bgr[0];
+      } else {
+        const uint32_t pixel =
+            bits == 16 ? read_u16le(row + (x * 2)) : read_u32le(row + (x * 4));
+        dst[x] = (extract_bmp_component(pixel, masks[3])
+                  << COLOR_ALPHA_OFFSET) |
+                 (extract_bmp_component(pixel, masks[0]) << COLOR_RED_OFFSET) |
+                 (extract_bmp_component(pixel, masks[1])
+                  << COLOR_GREEN_OFFSET) |
+                 extract_bmp_component(pixel, masks[2]);
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Loads a PPM (P3/P6), QOI or uncompressed BMP image file into a new surface.
+ * The format is detected by the contents of the file. Returns the surface, or
+ * nil and an error message if the file can't be read or decoded.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_loadimage(lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+
+  // read the whole file into a userdata, so it is freed even if we throw
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    const int error = errno;
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to open file: %s: %s", path, strerror(error));
+    return 2;
+  }
+  long size = -1;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    size = ftell(file);
+  }
+  if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+    const int error = errno;
+    fclose(file);
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to read file: %s: %s", path, strerror(error));
+    return 2;
+  }
+  unsigned char *data = lua_newuserdata(L, size > 0 ? size : 1);
+  const size_t read = fread(data, 1, size, file);
+  fclose(file);
+  if (read != (size_t)size) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to read file: %s", path);
+    return 2;
+  }
+
+  // detect the format by its magic number
+  const char *error = NULL;
+  if (size >= 2 && data[0] == 'P' && (data[1] == '3' || data[1] == '6')) {
+    error = decode_ppm(L, data, size);
+  } else if (size >= 4 && memcmp(data, "qoif", 4) == 0) {
+    error = decode_qoi(L, data, size);
+  } else if (size >= 2 && data[0] == 'B' && data[1] == 'M') {
+    error = decode_bmp(L, data, size);
+  } else {
+    error = "unknown image format (expected PPM, QOI or BMP)";
+  }
+  if (error != NULL) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to decode image: %s: %s", path, error);
+    return 2;
+  }
+  return 1;  // the surface is on top of the stack
+}
+
+/** Maximum size of the binary PPM header, "P6\n<width> <height>\n255\n" */
+enum { PPM_MAX_HEADER_SIZE = 32 };
+
+/**
+ * Utility function to get the number of bytes of a BMP row, which is padded
+ * to a multiple of 4 bytes.
+ * @param width The width of the image
+ * @return The size of a row in bytes
+ */
+static size_t bmp_row_size(lua_Integer width) {
+  return ((width * PACKED_RGB_SIZE) + 3) & ~(size_t)3;
+}
+
+/**
+ * Utility function to get the maximum size of an encoded image.
+ * @param format The image format
+ * @param width The width of the image
+ * @param height The height of the image
+ * @return The size in bytes
+ */
+static size_t max_encoded_image_size(int format, lua_Integer width,
+                                     lua_Integer height) {
+  switch (format) {
+    case IMAGE_QOI:
+      // QOI_OP_RGB is the largest chunk, 4 bytes per pixel
+      return QOI_HEADER_SIZE + (width * height * 4) + QOI_END_MARKER_SIZE;
+    case IMAGE_BMP:
+      return BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE +
+             (bmp_row_size(width) * height);
+    default:
+      return PPM_MAX_HEADER_SIZE + (width * height * PACKED_RGB_SIZE);
+  }
+}
+
+/**
+ * Utility function to encode pixels as a binary PPM (P6) image. The rows are
+ * packed in parallel for large images.
+ * @param data The encoded image, must fit max_encoded_image_size() bytes
+ * @param pixels The pixels
+ * @param width The width of the image
+ * @param height The height of the image
+ * @return The size of the encoded image
+ */
+static size_t encode_ppm(unsigned char *data, const uint32_t *pixels,
+                         lua_Integer width, lua_Integer height) {
+  const size_t header_size = (size_t)snprintf(
+      (char *)data, PPM_MAX_HEADER_SIZE, "P6\n%d %d\n255\n", (int)width,
+      (int)height);
+  const size_t row_size = width * PACKED_RGB_SIZE;
+  pack_args pack = {
+      data + header_size, (lua_Integer)row_size, pixels, width, 0, 0,
+  };
+  parallel_rows(pack_rows, &pack, height, row_size * height);
+  return header_size + (row_size * height);
+}
+
+/**
+ * Utility function to encode pixels as a QOI image with 3 channels. Each
+ * chunk depends on the pixels before it, so this runs on one thread.
+ * @param data The encoded image, must fit max_encoded_image_size() bytes
+ * @param pixels The pixels
+ * @param width The width of the image
+ * @param height The height of the image
+ * @return The size of the encoded image
+ */
+static size_t encode_qoi(unsigned char *data, const uint32_t *pixels,
+                         lua_Integer width, lua_Integer height) {
+  memcpy(data, "qoif", 4);
+  write_u32be(data + 4, (uint32_t)width);
+  write_u32be(data + 8, (uint32_t)height);
+  data[12] = 3;  // channels
+  data[13] = 0;  // sRGB with linear alpha
+
+  // colors are compared without the alpha bits, which are always 255 here
+  // (the decoder starts with transparent black, which no color matches)
+  uint32_t index[64];
+  memset(index, 0xff, sizeof(index));
+  uint32_t previous = 0;
+  size_t position = QOI_HEADER_SIZE;
+  int run = 0;
+  const size_t length = width * height;
+  for (size_t i = 0; i < length; i++) {
+    const uint32_t px = pixels[i] & (uint32_t)MAX_COLOR;
+    if (px == previous) {
+      run++;
+      if (run == 62) {
+        data[position++] = (unsigned char)(0xc0 | (run - 1));  // QOI_OP_RUN
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      data[position++] = (unsigned char)(0xc0 | (run - 1));  // QOI_OP_RUN
+      run = 0;
+    }
+
+    const int r = (int)(px >> COLOR_RED_OFFSET);
+    const int g = (int)((px >> COLOR_GREEN_OFFSET) & 0xff);
+    const int b = (int)(px & 0xff);
+    const int hash = ((r * 3) + (g * 5) + (b * 7) + (255 * 11)) % 64;
+    if (index[hash] == px) {
+      data[position++] = (unsigned char)hash;  // QOI_OP_INDEX
+    } else {
+      index[hash] = px;
+      // differences wrap around like the unsigned bytes of the decoder
+      const int dr = (signed char)(r - (int)(previous >> COLOR_RED_OFFSET));
+      const int dg = (signed char)(g -
+                                   (int)((previous >> COLOR_GREEN_OFFSET) &
+                                         0xff));
+      const int db = (signed char)(b - (int)(previous & 0xff));
+      const int dr_dg = dr - dg;
+      const int db_dg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+        data[position++] = (unsigned char)(0x40 | ((dr + 2) << 4) |
+                                           ((dg + 2) << 2) |
+                                           (db + 2));  // QOI_OP_DIFF
+      } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                 db_dg >= -8 && db_dg <= 7) {
+        data[position++] = (unsigned char)(0x80 | (dg + 32));  // QOI_OP_LUMA
+        data[position++] = (unsigned char)(((dr_dg + 8) << 4) | (db_dg + 8));
+      } else {
+        data[position++] = 0xfe;  // QOI_OP_RGB
+        data[position++] = (unsigned char)r;
+        data[position++] = (unsigned char)g;
+        data[position++] = (unsigned char)b;
+      }
+    }
+    previous = px;
+  }
+  if (run > 0) {
+    data[position++] = (unsigned char)(0xc0 | (run - 1));  // QOI_OP_RUN
+  }
+
+  memset(data + position, 0, QOI_END_MARKER_SIZE - 1);
+  data[position + QOI_END_MARKER_SIZE - 1] = 1;
+  return position + QOI_END_MARKER_SIZE;
+}
+
+/**
+ * Utility function to encode pixels as an uncompressed 24-bit BMP image. The
+ * rows are stored bottom-up and packed in parallel for large images.
+ * @param data The encoded image, must fit max_encoded_image_size() bytes
+ * @param pixels The pixels
+ * @param width The width of the image
+ * @param height The height of the image
+ * @return The size of the encoded image
+ */
+static size_t encode_bmp(unsigned char *data, const uint32_t *pixels,
+                         lua_Integer width, lua_Integer height) {
+  const size_t row_size = bmp_row_size(width);
+  const size_t pixels_offset = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE;
+  const size_t size = pixels_offset + (row_size * height);
+  memset(data, 0, pixels_offset);
+  data[0] = 'B';
+  data[1] = 'M';
+  write_u32le(data + 2, (uint32_t)size);
+  write_u32le(data + 10, (uint32_t)pixels_offset);
+
+  unsigned char *info = data + BMP_FILE_HEADER_SIZE;
+  write_u32le(info, BMP_INFO_HEADER_SIZE);
+  write_u32le(info + 4, (uint32_t)width);
+  write_u32le(info + 8, (uint32_t)height);  // positive means bottom-up
+  write_u16le(info + 12, 1);                // planes
+  write_u16le(info + 14, 24);               // bits per pixel
+  write_u32le(info + 20, (uint32_t)(row_size * height));
+  write_u32le(info + 24, 2835);  // 72 DPI in pixels per meter
+  write_u32le(info + 28, 2835);
+
+  pack_args pack = {
+      data + pixels_offset + ((height - 1) * row_size),
+      -(lua_Integer)row_size,
+      pixels,
+      width,
+      row_size - (width * PACKED_RGB_SIZE),
+      1,
+  };
+  parallel_rows(pack_rows, &pack, height, row_size * height);
+  return size;
+}
+
+/**
+ * Utility function to encode pixels in the given image format into a
+ * temporary userdata on the Lua stack, which is freed by the garbage
+ * collector.
+ * @param L Lua state
+ * @param pixels The pixels
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param format The image format
+ * @param p_size Set to the size of the encoded image
+ * @return The encoded image
+ */
+static unsigned char *push_encoded_image(lua_State *L, const uint32_t *pixels,
+                                         lua_Integer width, lua_Integer height,
+                                         int format, size_t *p_size) {
+  unsigned char *data =
+      lua_newuserdata(L, max_encoded_image_size(format, width, height));
+  switch (format) {
+    case IMAGE_QOI:
+      *p_size = encode_qoi(data, pixels, width, height);
+      break;
+    case IMAGE_BMP:
+      *p_size = encode_bmp(data, pixels, width, height);
+      break;
+    default:
+      *p_size = encode_ppm(data, pixels, width, height);
+      break;
+  }
+  return data;
+}
+
+/** Window or surface that the drawing functions draw into */
+typedef struct canvas {
+  uint32_t *pixels;
+  lua_Integer width;
+  lua_Integer height;
+  uint8_t *indices;  // what indexed windows draw into, NULL otherwise
+  int blend;         // blend mode of the window or surface
+  window *p_window;  // window to mark as damaged, NULL for surfaces
+} canvas;
+
+/**
+ * Utility function to get a window or surface from the Lua stack.
+ * @param L Lua state
+ * @param index Index of the window or surface on the Lua stack
+ * @return The canvas of the window or surface
+ */
+static canvas check_canvas_at(lua_State *L, int index) {
+  canvas c = {NULL, 0, 0, NULL, BLEND_REPLACE, NULL};
+  surface *p_surface = luaL_testudata(L, index, SURFACE_METATABLE);
+  if (p_surface != NULL) {
+    c.pixels = p_surface->pixels;
+    c.width = p_surface->width;
+    c.height = p_surface->height;
+    c.blend = p_surface->blend;
+    return c;
+  }
+  window *p_window = luaL_testudata(L, index, WINDOW_METATABLE);
+  luaL_argcheck(L, p_window != NULL, index, "surface or window expected");
+  if (is_window_closed(p_window)) {
+    luaL_error(L, "attempt to use a closed window");
+  }
+  c.pixels = p_window->pixels;
+  c.width = p_window->width;
+  c.height = p_window->height;
+  c.indices = p_window->indices;
+  c.blend = p_window->blend;
+  c.p_window = p_window;
+  return c;
+}
+
+/** Macro to get the window or surface to draw into from the Lua stack */
+#define check_canvas(L) check_canvas_at(L, 1)
+
+/**
+ * Utility function to get the color to draw into the canvas with from the Lua
+ * stack. Indexed windows take a palette index instead.
+ * @param L Lua state
+ * @param p_canvas The canvas
+ * @param index Index of the color value on the Lua stack
+ * @return The color value or palette index
+ */
+static lua_Integer check_canvas_color(lua_State *L, const canvas *p_canvas,
+                                      int index) {
+  if (p_canvas->indices != NULL) {
+    return check_palette_index(L, index);
+  }
+  return check_color(L, index);
+}
+
+/**
+ * Utility function to get a radius from the Lua stack and check if it's
+ * within the allowed range.
+ * @param L Lua state
+ * @param index Index of the radius on the Lua stack
+ * @return The radius
+ */
+static lua_Integer check_radius(lua_State *L, int index) {
+  const lua_Integer radius = luaL_checkinteger(L, index);
+  luaL_argcheck(L, radius >= 0 && radius <= MAX_DIMENSION, index,
+                "radius must be in range 0-15360");
+  return radius;
+}
+
+/**
+ * Utility function to mark the part of a bounding box that is inside the
+ * canvas as damaged. Does nothing for surfaces.
+ * @param p_canvas The canvas
+ * @param left The left edge of the bounding box (inclusive)
+ * @param top The top edge of the bounding box (inclusive)
+ * @param right The right edge of the bounding box (inclusive)
+ * @param bottom The bottom edge of the bounding box (inclusive)
+ */
+static void damage_canvas(const canvas *p_canvas, lua_Integer left,
+                          lua_Integer top, lua_Integer right,
+                          lua_Integer bottom) {
+  lua_Integer width = right - left + 1;
+  lua_Integer height = bottom - top + 1;
+  if (p_canvas->p_window != NULL &&
+      clip_rect(&left, &top, &width, &height, p_canvas->width,
+                p_canvas->height)) {
+    damage_window(p_canvas->p_window, left, top, width, height);
+  }
+}
+
+/**
+ * Utility function to fill a rectangle of the canvas, clipped to its bounds.
+ * Doesn't mark anything as damaged.
+ * @param p_canvas The canvas
+ * @param x The x coordinate of the top left corner
+ * @param y The y coordinate of the top left corner
+ * @param width The width of the rectangle
+ * @param height The height of the rectangle
+ * @param color The color
+ */
+static void draw_rect(const canvas *p_canvas, lua_Integer x, lua_Integer y,
+                      lua_Integer width, lua_Integer height, uint32_t color) {
+  if (!clip_rect(&x, &y, &width, &height, p_canvas->width, p_canvas->height)) {
+    return;
+  }
+  if (p_canvas->indices != NULL) {
+    for (lua_Integer i = y; i < y + height; i++) {
+      memset(p_canvas->indices + (i * p_canvas->width) + x, (int)color,
+             width);
+    }
+    return;
+  }
+  fill_rect(p_canvas->pixels, p_canvas->width, x, y, width, height, color,
+            p_canvas->blend);
+}
+
+/**
+ * Utility function to fill a horizontal span of the canvas from x0 to x1
+ * (both inclusive), clipped to its bounds. Doesn't mark anything as damaged.
+ * @param p_canvas The canvas
+ * @param x0 The x coordinate of the first pixel
+ * @param x1 The x coordinate of the last pixel
+ * @param y The y coordinate of the span
+ * @param color The color
+ */
+static void draw_span(const canvas *p_canvas, lua_Integer x0, lua_Integer x1,
+                      lua_Integer y, uint32_t color) {
+  if (y < 0 || y >= p_canvas->height) {
+    return;
+  }
+  x0 = x0 < 0 ? 0 : x0;
+  x1 = x1 >= p_canvas->width ? p_canvas->width - 1 : x1;
+  if (x0 > x1) {
+    return;
+  }
+  if (p_canvas->indices != NULL) {
+    memset(p_canvas->indices + (y * p_canvas->width) + x0, (int)color,
+           x1 - x0 + 1);
+    return;
+  }
+  uint32_t *span = p_canvas->pixels + (y * p_canvas->width) + x0;
+  if (p_canvas->blend == BLEND_REPLACE) {
+    fill_span(span, x1 - x0 + 1, color);
+  } else {
+    blend_span(span, x1 - x0 + 1, color, p_canvas->blend);
+  }
+}
+
+/**
+ * Utility function to clip a line to the bounds of the canvas
+ * (Liang-Barsky). Clipped endpoints are rounded to the nearest pixel.
+ * @param p_canvas The canvas
+ * @param p_x0 The x coordinate of the first endpoint, updated in place
+ * @param p_y0 The y coordinate of the first endpoint, updated in place
+ * @param p_x1 The x coordinate of the second endpoint, updated in place
+ * @param p_y1 The y coordinate of the second endpoint, updated in place
+ * @return Whether anything of the line is left after clipping
+ */
+static int clip_line(const canvas *p_canvas, lua_Integer *p_x0,
+                     lua_Integer *p_y0, lua_Integer *p_x1, lua_Integer *p_y1) {
+  const double x0 = (double)*p_x0;
+  const double y0 = (double)*p_y0;
+  const double dx = (double)(*p_x1 - *p_x0);
+  const double dy = (double)(*p_y1 - *p_y0);
+  const double p[4] = {-dx, dx, -dy, dy};
+  const double q[4] = {x0, (double)(p_canvas->width - 1) - x0, y0,
+                       (double)(p_canvas->height - 1) - y0};
+  double t0 = 0.0;
+  double t1 = 1.0;
+  for (int i = 0; i < 4; i++) {
+    if (p[i] == 0.0) {
+      if (q[i] < 0.0) {
+        return 0;  // parallel to and outside of this edge
+      }
+    } else {
+      const double t = q[i] / p[i];
+      if (p[i] < 0.0) {
+        if (t > t1) {
+          return 0;
+        }
+        t0 = t > t0 ? t : t0;
+      } else {
+        if (t < t0) {
+          return 0;
+        }
+        t1 = t < t1 ? t : t1;
+      }
+    }
+  }
+  if (t1 < 1.0) {
+    *p_x1 = llround(x0 + (t1 * dx));
+    *p_y1 = llround(y0 + (t1 * dy));
+  }
+  if (t0 > 0.0) {
+    *p_x0 = llround(x0 + (t0 * dx));
+    *p_y0 = llround(y0 + (t0 * dy));
+  }
+
+  // rounding might still push the endpoints half a pixel out of bounds
+  const lua_Integer max_x = p_canvas->width - 1;
+  const lua_Integer max_y = p_canvas->height - 1;
+  *p_x0 = *p_x0 < 0 ? 0 : (*p_x0 > max_x ? max_x : *p_x0);
+  *p_y0 = *p_y0 < 0 ? 0 : (*p_y0 > max_y ? max_y : *p_y0);
+  *p_x1 = *p_x1 < 0 ? 0 : (*p_x1 > max_x ? max_x : *p_x1);
+  *p_y1 = *p_y1 < 0 ? 0 : (*p_y1 > max_y ? max_y : *p_y1);
+  return 1;
+}
+
+/**
+ * Utility function to draw a one pixel wide line between two points
+ * (Bresenham), clipped to the bounds of the canvas.
+ * @param p_canvas The canvas
+ * @param x0 The x coordinate of the first endpoint
+ * @param y0 The y coordinate of the first endpoint
+ * @param x1 The x coordinate of the second endpoint
+ * @param y1 The y coordinate of the second endpoint
+ * @param color The color
+ */
+static void draw_line(const canvas *p_canvas, lua_Integer x0, lua_Integer y0,
+                      lua_Integer x1, lua_Integer y1, uint32_t color) {
+  if (!clip_line(p_canvas, &x0, &y0, &x1, &y1)) {
+    return;
+  }
+  const lua_Integer dx = x1 > x0 ? x1 - x0 : x0 - x1;
+  const lua_Integer dy = y1 > y0 ? y0 - y1 : y1 - y0;  // negative
+  const lua_Integer sx = x0 < x1 ? 1 : -1;
+  const lua_Integer sy = y0 < y1 ? 1 : -1;
+  lua_Integer error = dx + dy;
+  for (;;) {
+    // (the clipped endpoints are within bounds, and so is everything between)
+    const lua_Integer offset = (y0 * p_canvas->width) + x0;
+    if (p_canvas->indices != NULL) {
+      p_canvas->indices[offset] = (uint8_t)color;
+    } else if (p_canvas->blend == BLEND_REPLACE) {
+      p_canvas->pixels[offset] = color;
+    } else {
+      p_canvas->pixels[offset] =
+          blend_pixel(p_canvas->pixels[offset], color, p_canvas->blend);
+    }
+    if (x0 == x1 && y0 == y1) {
+      break;
+    }
+    const lua_Integer error2 = 2 * error;
+    if (error2 >= dy) {
+      error += dy;
+      x0 += sx;
+    }
+    if (error2 <= dx) {
+      error += dx;
+      y0 += sy;
+    }
+  }
+}
+
+/**
+ * Utility function to fill a polygon, clipped to the bounds of the canvas.
+ * A pixel is filled if its center is inside the polygon (even-odd rule),
+ * where the center of a pixel is at its integer coordinates. Pixels on the
+ * left and top edges are inside, pixels on the right and bottom edges are
+ * not, so adjacent polygons never overlap.
+ * @param p_canvas The canvas
+ * @param points The x and y coordinates of the vertices, one after another
+ * @param count Number of vertices
+ * @param crossings Scratch space for at least count numbers
+ * @param color The color
+ * @param p_bounds Set to the bounding box of the polygon (left, top, right
+ * and bottom, all inclusive)
+ */
+static void fill_polygon(const canvas *p_canvas, const double *points,
+                         size_t count, double *crossings, uint32_t color,
+                         lua_Integer *p_bounds) {
+  double min_x = points[0];
+  double max_x = points[0];
+  double min_y = points[1];
+  double max_y = points[1];
+  for (size_t i = 1; i < count; i++) {
+    min_x = points[2 * i] < min_x ? points[2 * i] : min_x;
+    max_x = points[2 * i] > max_x ? points[2 * i] : max_x;
+    min_y = points[(2 * i) + 1] < min_y ? points[(2 * i) + 1] : min_y;
+    max_y = points[(2 * i) + 1] > max_y ? points[(2 * i) + 1] : max_y;
+  }
+  p_bounds[0] = (lua_Integer)ceil(min_x);
+  p_bounds[1] = (lua_Integer)ceil(min_y);
+  p_bounds[2] = (lua_Integer)ceil(max_x) - 1;
+  p_bounds[3] = (lua_Integer)ceil(max_y) - 1;
+
+  // only rows inside the canvas have to be scanned
+  const lua_Integer begin_y = p_bounds[1] < 0 ? 0 : p_bounds[1];
+  const lua_Integer end_y =
+      p_bounds[3] >= p_canvas->height ? p_canvas->height - 1 : p_bounds[3];
+  for (lua_Integer y = begin_y; y <= end_y; y++) {
+    // find the x coordinates where the edges cross this row, sorted
+    const double row = (double)y;
+    size_t crossings_count = 0;
+    for (size_t i = 0; i < count; i++) {
+      const double *a = &points[2 * i];
+      const double *b = &points[2 * ((i + 1) % count)];
+      if ((a[1] <= row && row < b[1]) || (b[1] <= row && row < a[1])) {
+        const double x = a[0] + ((row - a[1]) * (b[0] - a[0]) / (b[1] - a[1]));
+        size_t j = crossings_count++;
+        for (; j > 0 && crossings[j - 1] > x; j--) {
+          crossings[j] = crossings[j - 1];
+        }
+        crossings[j] = x;
+      }
+    }
+
+    // fill between pairs of crossings
+    for (size_t i = 0; i + 1 < crossings_count; i += 2) {
+      draw_span(p_canvas, (lua_Integer)ceil(crossings[i]),
+                (lua_Integer)ceil(crossings[i + 1]) - 1, y, color);
+    }
+  }
+}
+
+/**
+ * Utility function to draw an ellipse, clipped to the bounds of the canvas.
+ * The ellipse contains all pixels whose centers are within the radii plus
+ * half a pixel, which makes small circles look round. The outline consists of
+ * the outermost pixels of the filled ellipse.
+ * @param p_canvas The canvas
+ * @param x The x coordinate of the center
+ * @param y The y coordinate of the center
+ * @param radius_x The horizontal radius
+ * @param radius_y The vertical radius
+ * @param color The color
+ * @param filled Whether to fill the ellipse or only draw the outline
+ */
+static void draw_ellipse(const canvas *p_canvas, lua_Integer x, lua_Integer y,
+                         lua_Integer radius_x, lua_Integer radius_y,
+                         uint32_t color, int filled) {
+  // a pixel (dx, dy) is inside if
+  // 4 * dx^2 * (2 * radius_y + 1)^2 + 4 * dy^2 * (2 * radius_x + 1)^2 <=
+  // (2 * radius_x + 1)^2 * (2 * radius_y + 1)^2
+  // (no overflows, since the radii are at most MAX_DIMENSION)
+  const int64_t a2 = ((2 * radius_x) + 1) * ((2 * radius_x) + 1);
+  const int64_t b2 = ((2 * radius_y) + 1) * ((2 * radius_y) + 1);
+  const int64_t limit = a2 * b2;
+
+  // the half width of the rows only gets smaller from the center outwards
+  lua_Integer half_width = radius_x;
+  for (lua_Integer dy = 0; dy <= radius_y; dy++) {
+    lua_Integer next_half_width = half_width;
+    if (dy < radius_y) {
+      while ((4 * next_half_width * next_half_width * b2) +
+                 (4 * (dy + 1) * (dy + 1) * a2) >
+             limit) {
+        next_half_width--;
+      }
+    }
+
+    if (filled) {
+      draw_span(p_canvas, x - half_width, x + half_width, y + dy, color);
+      if (dy > 0) {
+        draw_span(p_canvas, x - half_width, x + half_width, y - dy, color);
+      }
+    } else {
+      // the pixels that the next row outwards doesn't cover, but at least one
+      // (and the whole row for the last one)
+      lua_Integer inner = 0;
+      if (dy < radius_y) {
+        inner = next_half_width + 1 < half_width ? next_half_width + 1
+                                                 : half_width;
+      }
+      draw_span(p_canvas, x + inner, x + half_width, y + dy, color);
+      draw_span(p_canvas, x - half_width, x - inner, y + dy, color);
+      if (dy > 0) {
+        draw_span(p_canvas, x + inner, x + half_width, y - dy, color);
+        draw_span(p_canvas, x - half_width, x - inner, y - dy, color);
+      }
+    }
+
+    half_width = next_half_width;
+  }
+  damage_canvas(p_canvas, x - radius_x, y - radius_y, x + radius_x,
+                y + radius_y);
+}
+
+/**
+ * Set how everything drawn into the window or surface afterwards is combined
+ * with the pixels it is drawn over. Clearing always replaces the pixels.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_setblend(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const int mode = luaL_checkoption(L, 2, "replace", BLEND_MODE_NAMES);
+  luaL_argcheck(L, c.indices == NULL || mode == BLEND_REPLACE, 2,
+                "indexed windows can't blend");
+
+  if (c.p_window != NULL) {
+    c.p_window->blend = mode;
+  } else {
+    ((surface *)lua_touserdata(L, 1))->blend = mode;
+  }
+  return 0;
+}
+
+/**
+ * Fill a rectangle with the given color. Pixels outside the window or surface
+ * are clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_fillrect(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer width = check_dimension(L, 4);
+  const lua_Integer height = check_dimension(L, 5);
+  const lua_Integer color = check_canvas_color(L, &c, 6);
+
+  draw_rect(&c, x, y, width, height, color);
+  damage_canvas(&c, x, y, x + width - 1, y + height - 1);
+  return 0;
+}
+
+/**
+ * Draw a horizontal line of the given length to the right of the given
+ * coordinates. Pixels outside the window or surface are clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_hline(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer length = check_dimension(L, 4);
+  const lua_Integer color = check_canvas_color(L, &c, 5);
+
+  draw_rect(&c, x, y, length, 1, color);
+  damage_canvas(&c, x, y, x + length - 1, y);
+  return 0;
+}
+
+/**
+ * Draw a vertical line of the given length downwards from the given
+ * coordinates. Pixels outside the window or surface are clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_vline(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer length = check_dimension(L, 4);
+  const lua_Integer color = check_canvas_color(L, &c, 5);
+
+  draw_rect(&c, x, y, 1, length, color);
+  damage_canvas(&c, x, y, x, y + length - 1);
+  return 0;
+}
+
+/**
+ * Draw a line between two points with an optional thickness. Thick lines are
+ * drawn as filled rectangles along the line. Pixels outside the window or
+ * surface are clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_line(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x0 = check_coordinate(L, 2);
+  const lua_Integer y0 = check_coordinate(L, 3);
+  const lua_Integer x1 = check_coordinate(L, 4);
+  const lua_Integer y1 = check_coordinate(L, 5);
+  const lua_Integer color = check_canvas_color(L, &c, 6);
+  const lua_Integer thickness = luaL_opt(L, check_dimension, 7, 1);
+
+  if (thickness == 1) {
+    draw_line(&c, x0, y0, x1, y1, color);
+    damage_canvas(&c, x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, x0 > x1 ? x0 : x1,
+                  y0 > y1 ? y0 : y1);
+    return 0;
+  }
+
+  // offsets along the line (half a pixel, so the ends are included like for
+  // thin lines) and across it (half the thickness)
+  const double dx = (double)(x1 - x0);
+  const double dy = (double)(y1 - y0);
+  const double length = sqrt((dx * dx) + (dy * dy));
+  const double half = (double)thickness / 2.0;
+  double along_x = 0.5;
+  double along_y = 0.0;
+  if (length > 0.0) {
+    along_x = dx / length * 0.5;
+    along_y = dy / length * 0.5;
+  }
+  const double across_x = -along_y * 2.0 * half;
+  const double across_y = along_x * 2.0 * half;
+  const double points[8] = {
+      (double)x0 - along_x + across_x, (double)y0 - along_y + across_y,
+      (double)x1 + along_x + across_x, (double)y1 + along_y + across_y,
+      (double)x1 + along_x - across_x, (double)y1 + along_y - across_y,
+      (double)x0 - along_x - across_x, (double)y0 - along_y - across_y,
+  };
+  double crossings[4];
+  lua_Integer bounds[4];
+  fill_polygon(&c, points, 4, crossings, color, bounds);
+  damage_canvas(&c, bounds[0], bounds[1], bounds[2], bounds[3]);
+  return 0;
+}
+
+/**
+ * Draw the outline of a rectangle. Pixels outside the window or surface are
+ * clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_rect(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer width = check_dimension(L, 4);
+  const lua_Integer height = check_dimension(L, 5);
+  const lua_Integer color = check_canvas_color(L, &c, 6);
+
+  draw_rect(&c, x, y, width, 1, color);
+  draw_rect(&c, x, y + height - 1, width, 1, color);
+  if (height > 2) {
+    draw_rect(&c, x, y + 1, 1, height - 2, color);
+    draw_rect(&c, x + width - 1, y + 1, 1, height - 2, color);
+  }
+  damage_canvas(&c, x, y, x + width - 1, y + height - 1);
+  return 0;
+}
+
+/**
+ * Draw the outline of a circle. Pixels outside the window or surface are
+ * clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_circle(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer radius = check_radius(L, 4);
+  const lua_Integer color = check_canvas_color(L, &c, 5);
+
+  draw_ellipse(&c, x, y, radius, radius, color, 0);
+  return 0;
+}
+
+/**
+ * Fill a circle. Pixels outside the window or surface are clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_fillcircle(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer radius = check_radius(L, 4);
+  const lua_Integer color = check_canvas_color(L, &c, 5);
+
+  draw_ellipse(&c, x, y, radius, radius, color, 1);
+  return 0;
+}
+
+/**
+ * Draw the outline of an ellipse. Pixels outside the window or surface are
+ * clipped.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int canvas_ellipse(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer radius_x = check_radius(L, 4);
+  const lua_Integer radius_y = check_radius(L, 5);
+  const lua_Integer color = check_canvas_color(L, &c, 6);
+
+  draw_ellipse(&c, x, y, radius_x, radius_y, color, 0);
+  return 0;
 }
 
 /**
- * Utility function to get a color value from the Lua stack and check if it's
- * within the allowed range.
+ * Fill an ellipse. Pixels outside the window or surface are clipped.
  * @param L Lua state
- * @param index Index of the color value on the Lua stack
- * @return The color value
+ * @return Number of return values on the Lua stack
  */
-static lua_Integer check_color(lua_State *L, int index) {
-  const lua_Integer color = luaL_checkinteger(L, index);
-  luaL_argcheck(L, color >= 0 && color <= MAX_COLOR, index,
-                "color must be in range 0x000000-0xffffff");
-  return color;
+static int canvas_fillellipse(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  const lua_Integer radius_x = check_radius(L, 4);
+  const lua_Integer radius_y = check_radius(L, 5);
+  const lua_Integer color = check_canvas_color(L, &c, 6);
+
+  draw_ellipse(&c, x, y, radius_x, radius_y, color, 1);
+  return 0;
 }
 
 /**
- * Utility function to get a color component from the Lua stack and check if
- * it's within the allowed range.
+ * Fill a triangle. Pixels outside the window or surface are clipped.
  * @param L Lua state
- * @param index Index of the color component on the Lua stack
- * @return The color component value
+ * @return Number of return values on the Lua stack
  */
-static lua_Integer check_color_component(lua_State *L, int index) {
-  const lua_Integer color_component = luaL_checkinteger(L, index);
-  luaL_argcheck(L,
-                color_component >= 0 && color_component <= MAX_COLOR_COMPONENT,
-                index, "color component must be in range 0-255");
-  return color_component;
+static int canvas_filltriangle(lua_State *L) {
+  const canvas c = check_canvas(L);
+  double points[6];
+  for (int i = 0; i < 6; i++) {
+    points[i] = (double)check_coordinate(L, i + 2);
+  }
+  const lua_Integer color = check_canvas_color(L, &c, 8);
+
+  double crossings[3];
+  lua_Integer bounds[4];
+  fill_polygon(&c, points, 3, crossings, color, bounds);
+  damage_canvas(&c, bounds[0], bounds[1], bounds[2], bounds[3]);
+  return 0;
 }
 
 /**
- * Utility function to convert a color value to RGB components or vice versa.
+ * Fill a polygon given as a table of x and y coordinates. Self-intersecting
+ * polygons are filled using the even-odd rule. Pixels outside the window or
+ * surface are clipped.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int lfenster_rgb(lua_State *L) {
-  // check if the function was called with less than 3 arguments
-  if (lua_gettop(L) < 3) {
-    // get color value argument
-    const lua_Integer color = check_color(L, 1);
+static int canvas_fillpolygon(lua_State *L) {
+  const canvas c = check_canvas(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  const size_t length = lua_rawlen(L, 2);
+  luaL_argcheck(L, length >= 6 && length % 2 == 0, 2,
+                "points must contain at least 3 pairs of x and y coordinates");
+  const lua_Integer color = check_canvas_color(L, &c, 3);
 
-    // return RGB components
-    lua_pushinteger(L, (color >> COLOR_RED_OFFSET) & MAX_COLOR_COMPONENT);
-    lua_pushinteger(L, (color >> COLOR_GREEN_OFFSET) & MAX_COLOR_COMPONENT);
-    lua_pushinteger(L, color & MAX_COLOR_COMPONENT);
-    return 3;
+  // vertices and scratch space (as userdata, so it is freed even if we throw)
+  const size_t count = length / 2;
+  double *points = lua_newuserdata(L, (length + count) * sizeof(double));
+  double *crossings = points + length;
+  for (size_t i = 0; i < length; i++) {
+    lua_rawgeti(L, 2, (lua_Integer)(i + 1));
+    int is_integer = 0;
+    const lua_Integer coordinate = lua_tointegerx(L, -1, &is_integer);
+    if (!is_integer || coordinate < -MAX_COORDINATE ||
+        coordinate > MAX_COORDINATE) {
+      return luaL_argerror(
+          L, 2,
+          lua_pushfstring(L,
+                          "coordinate at index %d must be an integer in range "
+                          "-2147483647-2147483647",
+                          (int)(i + 1)));
+    }
+    points[i] = (double)coordinate;
+    lua_pop(L, 1);
   }
 
-  // get RGB component arguments
-  const lua_Integer red = check_color_component(L, 1);
-  const lua_Integer green = check_color_component(L, 2);
-  const lua_Integer blue = check_color_component(L, 3);
-
-  // return color value
-  lua_pushinteger(
-      L, (red << COLOR_RED_OFFSET) | (green << COLOR_GREEN_OFFSET) | blue);
-  return 1;
+  lua_Integer bounds[4];
+  fill_polygon(&c, points, count, crossings, color, bounds);
+  damage_canvas(&c, bounds[0], bounds[1], bounds[2], bounds[3]);
+  return 0;
 }
 
-/** Macro to get the window userdata from the Lua stack */
-#define check_window(L) (luaL_checkudata(L, 1, WINDOW_METATABLE))
+/**
+ * Glyphs of the built-in 8x8 font (MicroKnight) for the printable ASCII
+ * characters, as one bit mask per row with the lowest bit being the leftmost
+ * pixel.
+ */
+static const uint32_t DEFAULT_FONT_ROWS[] = {
+    // clang-format off
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // ' '
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x18, 0x00,  // '!'
+    0x36, 0x36, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00,  // '"'
+    0x36, 0x36, 0x7f, 0x36, 0x7f, 0x36, 0x36, 0x00,  // '#'
+    0x08, 0x3e, 0x0b, 0x3e, 0x68, 0x68, 0x3e, 0x08,  // '$'
+    0x06, 0x69, 0x3e, 0x18, 0x0c, 0x36, 0x4b, 0x30,  // '%'
+    0x0e, 0x1b, 0x0e, 0x6f, 0x3b, 0x1b, 0x3e, 0x60,  // '&'
+    0x18, 0x18, 0x10, 0x08, 0x00, 0x00, 0x00, 0x00,  // '\''
+    0x18, 0x0c, 0x06, 0x06, 0x06, 0x0c, 0x18, 0x00,  // '('
+    0x0c, 0x18, 0x30, 0x30, 0x30, 0x18, 0x0c, 0x00,  // ')'
+    0x00, 0x36, 0x1c, 0x7f, 0x1c, 0x36, 0x00, 0x00,  // '*'
+    0x00, 0x18, 0x18, 0x7e, 0x18, 0x18, 0x00, 0x00,  // '+'
+    0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x10, 0x08,  // ','
+    0x00, 0x00, 0x00, 0x3e, 0x00, 0x00, 0x00, 0x00,  // '-'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00,  // '.'
+    0x00, 0x60, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x00,  // '/'
+    0x00, 0x1e, 0x33, 0x7b, 0x6f, 0x67, 0x3e, 0x00,  // '0'
+    0x18, 0x18, 0x1c, 0x18, 0x18, 0x18, 0x7e, 0x00,  // '1'
+    0x3e, 0x60, 0x3c, 0x06, 0x03, 0x03, 0x7f, 0x00,  // '2'
+    0x3c, 0x60, 0x38, 0x60, 0x62, 0x63, 0x3e, 0x00,  // '3'
+    0x18, 0x18, 0x0c, 0x36, 0x33, 0x7f, 0x30, 0x00,  // '4'
+    0x1f, 0x03, 0x3f, 0x60, 0x62, 0x33, 0x1e, 0x00,  // '5'
+    0x0e, 0x03, 0x3f, 0x63, 0x63, 0x33, 0x1e, 0x00,  // '6'
+    0x7f, 0x60, 0x30, 0x18, 0x18, 0x18, 0x18, 0x00,  // '7'
+    0x1e, 0x33, 0x3e, 0x63, 0x63, 0x33, 0x1e, 0x00,  // '8'
+    0x1e, 0x33, 0x63, 0x63, 0x7e, 0x60, 0x38, 0x00,  // '9'
+    0x00, 0x18, 0x18, 0x00, 0x00, 0x18, 0x18, 0x00,  // ':'
+    0x00, 0x18, 0x18, 0x00, 0x00, 0x18, 0x10, 0x08,  // ';'
+    0x00, 0x18, 0x0c, 0x06, 0x0c, 0x18, 0x00, 0x00,  // '<'
+    0x00, 0x00, 0x3e, 0x00, 0x3e, 0x00, 0x00, 0x00,  // '='
+    0x00, 0x0c, 0x18, 0x30, 0x18, 0x0c, 0x00, 0x00,  // '>'
+    0x3e, 0x63, 0x60, 0x3c, 0x0c, 0x00, 0x0c, 0x00,  // '?'
+    0x1c, 0x36, 0x7b, 0x6f, 0x7b, 0x03, 0x66, 0x3c,  // '@'
+    0x1e, 0x33, 0x63, 0x7f, 0x63, 0x63, 0x63, 0x00,  // 'A'
+    0x1f, 0x33, 0x3f, 0x63, 0x63, 0x33, 0x1f, 0x00,  // 'B'
+    0x1e, 0x33, 0x03, 0x03, 0x03, 0x63, 0x3e, 0x00,  // 'C'
+    0x1f, 0x33, 0x63, 0x63, 0x63, 0x63, 0x3f, 0x00,  // 'D'
+    0x7f, 0x03, 0x3f, 0x03, 0x03, 0x03, 0x7f, 0x00,  // 'E'
+    0x7f, 0x03, 0x3f, 0x03, 0x03, 0x03, 0x03, 0x00,  // 'F'
+    0x1c, 0x06, 0x03, 0x73, 0x63, 0x63, 0x7e, 0x60,  // 'G'
+    0x63, 0x63, 0x63, 0x7f, 0x63, 0x63, 0x63, 0x00,  // 'H'
+    0x7e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00,  // 'I'
+    0x70, 0x60, 0x60, 0x60, 0x63, 0x63, 0x3e, 0x00,  // 'J'
+    0x63, 0x33, 0x1b, 0x0f, 0x1b, 0x33, 0x63, 0x00,  // 'K'
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x7f, 0x00,  // 'L'
+    0x63, 0x77, 0x7f, 0x6b, 0x63, 0x63, 0x63, 0x00,  // 'M'
+    0x63, 0x67, 0x6f, 0x7b, 0x73, 0x63, 0x63, 0x00,  // 'N'
+    0x1e, 0x33, 0x63, 0x63, 0x63, 0x63, 0x3e, 0x00,  // 'O'
+    0x1f, 0x33, 0x63, 0x63, 0x3f, 0x03, 0x03, 0x00,  // 'P'
+    0x1e, 0x33, 0x63, 0x63, 0x63, 0x6b, 0x3e, 0x30,  // 'Q'
+    0x1f, 0x33, 0x63, 0x63, 0x3f, 0x1b, 0x33, 0x60,  // 'R'
+    0x1e, 0x03, 0x3e, 0x60, 0x62, 0x63, 0x3e, 0x00,  // 'S'
+    0x7e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00,  // 'T'
+    0x63, 0x63, 0x63, 0x63, 0x63, 0x63, 0x3e, 0x00,  // 'U'
+    0x63, 0x63, 0x63, 0x36, 0x36, 0x1c, 0x1c, 0x00,  // 'V'
+    0x63, 0x63, 0x63, 0x6b, 0x7f, 0x77, 0x63, 0x00,  // 'W'
+    0x63, 0x36, 0x1c, 0x1c, 0x36, 0x63, 0x63, 0x00,  // 'X'
+    0x63, 0x63, 0x63, 0x3e, 0x30, 0x30, 0x30, 0x00,  // 'Y'
+    0x7f, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x7f, 0x00,  // 'Z'
+    0x1c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1c, 0x00,  // '['
+    0x00, 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x00,  // '\\'
+    0x1c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1c, 0x00,  // ']'
+    0x08, 0x1c, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00,  // '^'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7f,  // '_'
+    0x18, 0x18, 0x08, 0x10, 0x00, 0x00, 0x00, 0x00,  // '`'
+    0x00, 0x3c, 0x60, 0x7e, 0x63, 0x63, 0x7e, 0x00,  // 'a'
+    0x03, 0x1f, 0x33, 0x63, 0x63, 0x63, 0x3f, 0x00,  // 'b'
+    0x00, 0x1e, 0x33, 0x03, 0x03, 0x63, 0x3e, 0x00,  // 'c'
+    0x60, 0x7c, 0x66, 0x63, 0x63, 0x63, 0x7e, 0x00,  // 'd'
+    0x00, 0x1e, 0x33, 0x3f, 0x03, 0x63, 0x3e, 0x00,  // 'e'
+    0x1c, 0x36, 0x06, 0x1e, 0x06, 0x06, 0x06, 0x06,  // 'f'
+    0x00, 0x7e, 0x63, 0x63, 0x63, 0x7e, 0x60, 0x3e,  // 'g'
+    0x03, 0x1f, 0x33, 0x63, 0x63, 0x63, 0x63, 0x00,  // 'h'
+    0x18, 0x00, 0x1c, 0x18, 0x18, 0x18, 0x7e, 0x00,  // 'i'
+    0x30, 0x00, 0x38, 0x30, 0x30, 0x30, 0x32, 0x1c,  // 'j'
+    0x03, 0x33, 0x1b, 0x0f, 0x1b, 0x33, 0x63, 0x00,  // 'k'
+    0x1c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00,  // 'l'
+    0x00, 0x23, 0x77, 0x7f, 0x6b, 0x63, 0x63, 0x00,  // 'm'
+    0x00, 0x1f, 0x33, 0x63, 0x63, 0x63, 0x63, 0x00,  // 'n'
+    0x00, 0x1e, 0x33, 0x63, 0x63, 0x63, 0x3e, 0x00,  // 'o'
+    0x00, 0x1f, 0x33, 0x63, 0x63, 0x63, 0x3f, 0x03,  // 'p'
+    0x00, 0x7c, 0x66, 0x63, 0x63, 0x63, 0x7e, 0x60,  // 'q'
+    0x00, 0x3f, 0x63, 0x03, 0x03, 0x03, 0x03, 0x00,  // 'r'
+    0x00, 0x1e, 0x03, 0x3e, 0x60, 0x63, 0x3e, 0x00,  // 's'
+    0x0c, 0x3e, 0x0c, 0x0c, 0x0c, 0x4c, 0x38, 0x00,  // 't'
+    0x00, 0x63, 0x63, 0x63, 0x63, 0x63, 0x7e, 0x00,  // 'u'
+    0x00, 0x63, 0x63, 0x36, 0x36, 0x1c, 0x1c, 0x00,  // 'v'
+    0x00, 0x63, 0x6b, 0x7f, 0x3e, 0x36, 0x22, 0x00,  // 'w'
+    0x00, 0x63, 0x36, 0x1c, 0x1c, 0x36, 0x63, 0x00,  // 'x'
+    0x00, 0x63, 0x63, 0x63, 0x63, 0x7e, 0x60, 0x3e,  // 'y'
+    0x00, 0x7f, 0x30, 0x18, 0x0c, 0x06, 0x7f, 0x00,  // 'z'
+    0x30, 0x18, 0x18, 0x0c, 0x18, 0x18, 0x30, 0x00,  // '{'
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,  // '|'
+    0x0c, 0x18, 0x18, 0x30, 0x18, 0x18, 0x0c, 0x00,  // '}'
+    0x4e, 0x39, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // '~'
+    // clang-format on
+};
 
-/** Macro to check if the window is closed */
-#define is_window_closed(p_window) ((p_window)->p_fenster == NULL)
+/** The built-in font */
+static const font DEFAULT_FONT = {DEFAULT_FONT_ROWS, ' ', '~' - ' ' + 1, 8, 8};
 
 /**
- * Utility function to get the window userdata from the Lua stack and check if
- * the window is open.
- * @param L Lua state
- * @return The window userdata
+ * Utility function to count the trailing zero bits of a value.
+ * @param value The value, must not be 0
+ * @return Number of trailing zero bits
  */
-static window *check_open_window(lua_State *L) {
-  window *p_window = check_window(L);
-  if (is_window_closed(p_window)) {
-    luaL_error(L, "attempt to use a closed window");
+static int count_trailing_zeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(value);
+#else
+  int count = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    count++;
   }
-  return p_window;
+  return count;
+#endif
 }
 
 /**
- * Close the window. Does nothing if the window is already closed.
- * The __gc and __close meta methods also call this function, so the user
- * likely won't need to call this function manually.
+ * Creates a bitmap font from a string of glyphs with 1 bit per pixel. Each row
+ * of a glyph is stored in whole bytes with the highest bit being the leftmost
+ * pixel, and the glyphs follow each other starting at the given character.
+ * The glyphs are converted to bit masks once, so drawing text doesn't have to
+ * look at single bits.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_close(lua_State *L) {
-  window *p_window = check_open_window(L);
+static int lfenster_font(lua_State *L) {
+  size_t data_size = 0;
+  const unsigned char *data =
+      (const unsigned char *)luaL_checklstring(L, 1, &data_size);
+  const lua_Integer width = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, width > 0 && width <= MAX_GLYPH_WIDTH, 2,
+                "width must be in range 1-32");
+  const lua_Integer height = luaL_checkinteger(L, 3);
+  luaL_argcheck(L, height > 0 && height <= MAX_GLYPH_HEIGHT, 3,
+                "height must be in range 1-128");
+  const lua_Integer first = luaL_optinteger(L, 4, DEFAULT_FONT.first);
+  luaL_argcheck(L, first >= 0 && first < CHARACTERS, 4,
+                "first character must be in range 0-255");
 
-  // close and free window
-  fenster_close(p_window->p_fenster);
-  free(p_window->p_fenster->buf);
-  p_window->p_fenster->buf = NULL;
-  free(p_window->p_fenster);
-  p_window->p_fenster = NULL;
-  luaL_unref(L, LUA_REGISTRYINDEX, p_window->keys_ref);  // free keys table
-  p_window->keys_ref = LUA_NOREF;
+  const size_t row_size = (width + 7) / 8;
+  const size_t glyph_size = row_size * height;
+  luaL_argcheck(L, data_size > 0 && data_size % glyph_size == 0, 1,
+                "data must contain whole glyphs");
+  const lua_Integer count = data_size / glyph_size;
+  luaL_argcheck(L, first + count <= CHARACTERS, 1,
+                "data must not contain glyphs beyond character 255");
 
-  return 0;
+  // the rows are stored in the same userdata, right behind the struct
+  font *p_font =
+      lua_newuserdata(L, sizeof(font) + (count * height * sizeof(uint32_t)));
+  uint32_t *rows = (uint32_t *)(p_font + 1);
+  for (lua_Integer i = 0; i < count * height; i++) {
+    const unsigned char *row = data + (i * row_size);
+    uint32_t mask = 0;
+    for (lua_Integer x = 0; x < width; x++) {
+      if (row[x / 8] & (0x80 >> (x % 8))) {
+        mask |= (uint32_t)1 << x;
+      }
+    }
+    rows[i] = mask;
+  }
+  p_font->rows = rows;
+  p_font->first = first;
+  p_font->count = count;
+  p_font->width = width;
+  p_font->height = height;
+  luaL_setmetatable(L, FONT_METATABLE);
+  return 1;
 }
 
 /**
- * Main loop for the window. Handles FPS limiting and updates delta time, keys,
- * mouse coordinates, modifier keys and the whole screen. Returns true if the
- * window is still open and false if it's closed (only on Windows right now).
+ * Utility function to draw a single glyph, clipped to the bounds of the
+ * canvas. Each row is drawn as spans of consecutive set bits.
+ * @param p_canvas The canvas
+ * @param p_font The font
+ * @param glyph Index of the glyph in the font
+ * @param x The x coordinate of the top left corner
+ * @param y The y coordinate of the top left corner
+ * @param color The color
+ */
+static void draw_glyph(const canvas *p_canvas, const font *p_font,
+                       lua_Integer glyph, lua_Integer x, lua_Integer y,
+                       uint32_t color) {
+  const uint32_t *rows = p_font->rows + (glyph * p_font->height);
+  for (lua_Integer i = 0; i < p_font->height; i++) {
+    uint32_t mask = rows[i];
+    while (mask != 0) {
+      // (the run is counted on 64 bits, so a full 32 bit row still ends)
+      const int start = count_trailing_zeros(mask);
+      const int run = count_trailing_zeros(~((uint64_t)mask >> start));
+      draw_span(p_canvas, x + start, x + start + run - 1, y + i, color);
+      mask &= ~(uint32_t)((((uint64_t)1 << run) - 1) << start);
+    }
+  }
+}
+
+/**
+ * Draw text with the built-in 8x8 font or a custom font. Newlines start a new
+ * line below the first character, characters without a glyph are left blank.
+ * Pixels outside the window or surface are clipped.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_loop(lua_State *L) {
-  window *p_window = check_open_window(L);
-
-  // handle fps limiting
-  int64_t now = fenster_time();
-  if (p_window->start_frame_time == 0) {
-    // initialize start frame time (this is the first frame)
-    p_window->start_frame_time = now;
-  } else {
-    const int64_t last_frame_time = now - p_window->start_frame_time;
-    if (p_window->target_frame_time > last_frame_time) {
-      // sleep for the remaining frame time to reach target frame time
-      fenster_sleep(p_window->target_frame_time - last_frame_time);
-    }
-    now = fenster_time();  // update timestamp after sleeping
-    p_window->delta =
-        (lua_Number)(now - p_window->start_frame_time) / MS_PER_SEC;
-    p_window->start_frame_time = now;
+static int canvas_text(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const lua_Integer x = check_coordinate(L, 2);
+  const lua_Integer y = check_coordinate(L, 3);
+  size_t length = 0;
+  const char *text = luaL_checklstring(L, 4, &length);
+  const lua_Integer color = check_canvas_color(L, &c, 5);
+  const font *p_font = &DEFAULT_FONT;
+  if (!lua_isnoneornil(L, 6)) {
+    p_font = luaL_checkudata(L, 6, FONT_METATABLE);
   }
 
-  if (fenster_loop(p_window->p_fenster) == 0) {
-    // update the keys table in the registry
-    lua_rawgeti(L, LUA_REGISTRYINDEX, p_window->keys_ref);
-    for (int i = 0; i < KEYS_LENGTH; i++) {
-      lua_pushboolean(L, p_window->p_fenster->keys[i]);
-      lua_rawseti(L, -2, i);
+  lua_Integer glyph_x = x;
+  lua_Integer glyph_y = y;
+  lua_Integer right = x;
+  for (size_t i = 0; i < length; i++) {
+    const lua_Integer character = (unsigned char)text[i];
+    if (character == '\n') {
+      glyph_x = x;
+      glyph_y += p_font->height;
+      continue;
     }
 
-    // update the scaled mouse coordinates (floors the coordinates)
-    p_window->scaled_mouse_x = p_window->p_fenster->x / p_window->scale;
-    p_window->scaled_mouse_y = p_window->p_fenster->y / p_window->scale;
-
-    // update the modifier keys
-    p_window->mod_control = p_window->p_fenster->mod & 1;
-    p_window->mod_shift = (p_window->p_fenster->mod >> 1) & 1;
-    p_window->mod_alt = (p_window->p_fenster->mod >> 2) & 1;
-    p_window->mod_gui = (p_window->p_fenster->mod >> 3) & 1;
-
-    lua_pushboolean(L, 1);
-  } else {
-    lua_pushboolean(L, 0);
+    // only draw glyphs that are (partly) visible
+    const lua_Integer glyph = character - p_font->first;
+    if (glyph >= 0 && glyph < p_font->count && glyph_x < c.width &&
+        glyph_x + p_font->width > 0 && glyph_y < c.height &&
+        glyph_y + p_font->height > 0) {
+      draw_glyph(&c, p_font, glyph, glyph_x, glyph_y, color);
+    }
+    glyph_x += p_font->width;
+    right = glyph_x > right ? glyph_x : right;
   }
-  return 1;
+  if (right > x) {
+    damage_canvas(&c, x, y, right - 1, glyph_y + p_font->height - 1);
+  }
+  return 0;
 }
 
 /**
- * Utility function to get the x coordinate from the Lua stack and check if it's
- * within bounds.
+ * Utility function to get the colors of the window or surface for encoding.
+ * Indexed windows are expanded through the palette into a temporary userdata
+ * on the Lua stack first.
  * @param L Lua state
- * @param p_window The window userdata
- * @return The x coordinate
+ * @param p_canvas The canvas
+ * @return The pixels of the canvas
  */
-static lua_Integer check_x(lua_State *L, window *p_window) {
-  const lua_Integer x = luaL_checkinteger(L, 2);
-  luaL_argcheck(L, x >= 0 && x < p_window->width, 2,
-                "x coordinate must be in range 0-[width-1]");
-  return x;
+static const uint32_t *canvas_colors(lua_State *L, const canvas *p_canvas) {
+  if (p_canvas->indices == NULL) {
+    return p_canvas->pixels;
+  }
+  const lua_Integer length = p_canvas->width * p_canvas->height;
+  uint32_t *pixels = lua_newuserdata(L, length * sizeof(uint32_t));
+  expand_args expand = {
+      pixels,
+      p_canvas->indices,
+      p_canvas->width,
+      p_canvas->width,
+      p_canvas->p_window->palette,
+  };
+  parallel_rows(expand_rows, &expand, p_canvas->height,
+                length * sizeof(uint32_t));
+  return pixels;
 }
 
 /**
- * Utility function to get the y coordinate from the Lua stack and check if it's
- * within bounds.
+ * Encode the window or surface as an image in the given format (ppm, qoi or
+ * bmp) and return it as a string. Windows are encoded in their unscaled size.
  * @param L Lua state
- * @param p_window The window userdata
- * @return The y coordinate
+ * @return Number of return values on the Lua stack
  */
-static lua_Integer check_y(lua_State *L, window *p_window) {
-  const lua_Integer y = luaL_checkinteger(L, 3);
-  luaL_argcheck(L, y >= 0 && y < p_window->height, 3,
-                "y coordinate must be in range 0-[height-1]");
-  return y;
+static int canvas_encode(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const int format = luaL_checkoption(L, 2, NULL, IMAGE_FORMAT_NAMES);
+
+  size_t size = 0;
+  const unsigned char *data = push_encoded_image(
+      L, canvas_colors(L, &c), c.width, c.height, format, &size);
+  lua_pushlstring(L, (const char *)data, size);
+  return 1;
 }
 
 /**
- * Set a pixel in the window buffer at the given coordinates to the given color.
- * @param L Lua state
- * @return Number of return values on the Lua stack
+ * Utility function to get the image format from the extension of a path.
+ * @param path The path
+ * @return The image format, or -1 if the extension is unknown
  */
-static int window_set(lua_State *L) {
-  window *p_window = check_open_window(L);
-  const lua_Integer x = check_x(L, p_window);
-  const lua_Integer y = check_y(L, p_window);
-  const lua_Integer color = check_color(L, 4);
-
-  // set the pixel at the scaled coordinates to the given color
-  // (repeat this for each copy of the pixel in an area the size of the scale)
-  lua_Integer scaled_y = y * p_window->scale;
-  const lua_Integer scaled_y_end = scaled_y + p_window->scale;
-  lua_Integer scaled_x;
-  const lua_Integer scaled_x_begin = x * p_window->scale;
-  const lua_Integer scaled_x_end = scaled_x_begin + p_window->scale;
-  for (; scaled_y < scaled_y_end; scaled_y++) {
-    for (scaled_x = scaled_x_begin; scaled_x < scaled_x_end; scaled_x++) {
-      fenster_pixel(p_window->p_fenster, scaled_x, scaled_y) = color;
+static int image_format_of_path(const char *path) {
+  const char *extension = strrchr(path, '.');
+  if (extension == NULL || strlen(extension) != 4) {
+    return -1;
+  }
+  for (int format = 0; IMAGE_FORMAT_NAMES[format] != NULL; format++) {
+    int matches = 1;
+    for (int i = 0; i < 3; i++) {
+      matches &= tolower((unsigned char)extension[i + 1]) ==
+                 IMAGE_FORMAT_NAMES[format][i];
+    }
+    if (matches) {
+      return format;
     }
   }
-
-  return 0;
+  return -1;
 }
 
 /**
- * Get the color of a pixel in the window buffer at the given coordinates.
+ * Save the window or surface as an image file. The format (ppm, qoi or bmp)
+ * defaults to the extension of the path. Windows are saved in their unscaled
+ * size. Returns true, or nil and an error message if the file can't be
+ * written.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_get(lua_State *L) {
-  window *p_window = check_open_window(L);
-  const lua_Integer x = check_x(L, p_window);
-  const lua_Integer y = check_y(L, p_window);
-
-  // get the color of the pixel at the scaled coordinates
-  // (we don't need a loop here like in the set method because we only need
-  // the color of the first pixel in the scaled area - they should all be same)
-  lua_pushinteger(L, fenster_pixel(p_window->p_fenster, x * p_window->scale,
-                                   y * p_window->scale));
+static int canvas_save(lua_State *L) {
+  const canvas c = check_canvas(L);
+  const char *path = luaL_checkstring(L, 2);
+  int format = image_format_of_path(path);
+  luaL_argcheck(L, format >= 0 || !lua_isnoneornil(L, 3), 3,
+                "format is required for unknown file extensions");
+  if (!lua_isnoneornil(L, 3)) {
+    format = luaL_checkoption(L, 3, NULL, IMAGE_FORMAT_NAMES);
+  }
+
+  size_t size = 0;
+  const unsigned char *data = push_encoded_image(
+      L, canvas_colors(L, &c), c.width, c.height, format, &size);
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    const int error = errno;
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to open file: %s: %s", path, strerror(error));
+    return 2;
+  }
+  const size_t written = fwrite(data, 1, size, file);
+  const int error = errno;
+  if (fclose(file) != 0 || written != size) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "failed to write file: %s: %s", path, strerror(error));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
   return 1;
 }
 
 /**
- * Clear the window buffer with the given color.
+ * Index function for the font userdata. Returns the property value if it
+ * exists.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_clear(lua_State *L) {
-  window *p_window = check_open_window(L);
-  // we cant use check_color here since it's optional...
-  const lua_Integer color = luaL_optinteger(L, 2, 0x000000);
-  luaL_argcheck(L, color >= 0 && color <= MAX_COLOR, 2,
-                "color must be in range 0x000000-0xffffff");
+static int font_index(lua_State *L) {
+  font *p_font = luaL_checkudata(L, 1, FONT_METATABLE);
+  const char *key = luaL_checkstring(L, 2);
 
-  // overwrite the whole buffer with the given color
-  for (size_t i = 0; i < p_window->scaled_pixels; i++) {
-    p_window->p_fenster->buf[i] = color;
+  if (strcmp(key, "width") == 0) {
+    lua_pushinteger(L, p_font->width);
+  } else if (strcmp(key, "height") == 0) {
+    lua_pushinteger(L, p_font->height);
+  } else {
+    // no matching key is found, return nil
+    lua_pushnil(L);
   }
+  return 1;
+}
 
-  return 0;
+/**
+ * Returns a string representation of the font userdata.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int font_tostring(lua_State *L) {
+  font *p_font = luaL_checkudata(L, 1, FONT_METATABLE);
+  lua_pushfstring(L, "font (%p)", p_font);
+  return 1;
 }
 
 /**
- * Index function for the window userdata. Checks if the key exists in the
+ * Index function for the surface userdata. Checks if the key exists in the
  * methods metatable and returns the method if it does. Otherwise, checks for
  * properties and returns the property value if it exists.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_index(lua_State *L) {
-  window *p_window = check_open_window(L);
+static int surface_index(lua_State *L) {
+  surface *p_surface = check_surface(L);
   const char *key = luaL_checkstring(L, 2);
 
   // check if the key exists in the methods metatable
-  luaL_getmetatable(L, WINDOW_METATABLE);
+  luaL_getmetatable(L, SURFACE_METATABLE);
   lua_pushvalue(L, 2);
   lua_rawget(L, -2);
   if (lua_isnil(L, -1)) {
     // key not found in the methods metatable, check for properties
-    if (strcmp(key, "keys") == 0) {
-      // retrieve the keys table from the registry
-      lua_rawgeti(L, LUA_REGISTRYINDEX, p_window->keys_ref);
-    } else if (strcmp(key, "delta") == 0) {
-      lua_pushnumber(L, p_window->delta);
-    } else if (strcmp(key, "mousex") == 0) {
-      lua_pushinteger(L, p_window->scaled_mouse_x);
-    } else if (strcmp(key, "mousey") == 0) {
-      lua_pushinteger(L, p_window->scaled_mouse_y);
-    } else if (strcmp(key, "mousedown") == 0) {
-      lua_pushboolean(L, p_window->p_fenster->mouse);
-    } else if (strcmp(key, "modcontrol") == 0) {
-      lua_pushboolean(L, p_window->mod_control);
-    } else if (strcmp(key, "modshift") == 0) {
-      lua_pushboolean(L, p_window->mod_shift);
-    } else if (strcmp(key, "modalt") == 0) {
-      lua_pushboolean(L, p_window->mod_alt);
-    } else if (strcmp(key, "modgui") == 0) {
-      lua_pushboolean(L, p_window->mod_gui);
-    } else if (strcmp(key, "width") == 0) {
-      lua_pushinteger(L, p_window->width);
+    if (strcmp(key, "width") == 0) {
+      lua_pushinteger(L, p_surface->width);
     } else if (strcmp(key, "height") == 0) {
-      lua_pushinteger(L, p_window->height);
-    } else if (strcmp(key, "title") == 0) {
-      lua_pushstring(L, p_window->p_fenster->title);
-    } else if (strcmp(key, "scale") == 0) {
-      lua_pushinteger(L, p_window->scale);
-    } else if (strcmp(key, "targetfps") == 0) {
-      lua_pushnumber(L, p_window->target_fps);
+      lua_pushinteger(L, p_surface->height);
+    } else if (strcmp(key, "blend") == 0) {
+      lua_pushstring(L, BLEND_MODE_NAMES[p_surface->blend]);
     } else {
       // no matching key is found, return nil
       lua_pushnil(L);
@@ -546,36 +5724,237 @@ static int window_index(lua_State *L) {
 }
 
 /**
- * Close the window when the window userdata is garbage collected.
- * Just calls the close method but ignores if the window is already closed.
+ * Returns a string representation of the surface userdata.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_gc(lua_State *L) {
-  window *p_window = check_window(L);
+static int surface_tostring(lua_State *L) {
+  surface *p_surface = check_surface(L);
+  lua_pushfstring(L, "surface (%p)", p_surface);
+  return 1;
+}
 
-  // ignore if the window is already closed
-  if (!is_window_closed(p_window)) {
-    window_close(L);
+/** Primes of the 64-bit xxHash */
+static const uint64_t XXH_PRIME64_1 = 0x9e3779b185ebca87ULL;
+static const uint64_t XXH_PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t XXH_PRIME64_3 = 0x165667b19e3779f9ULL;
+static const uint64_t XXH_PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t XXH_PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+/** Macro to rotate a 64-bit integer to the left */
+#define rotl64(x, bits) (((x) << (bits)) | ((x) >> (64 - (bits))))
+
+/**
+ * Utility function to mix 8 bytes of input into an xxHash accumulator.
+ * @param acc The accumulator
+ * @param input The input
+ * @return The new accumulator
+ */
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc = rotl64(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+/**
+ * Utility function to merge one of the 4 xxHash accumulators into the hash.
+ * @param hash The hash
+ * @param acc The accumulator
+ * @return The new hash
+ */
+static uint64_t xxh64_merge(uint64_t hash, uint64_t acc) {
+  hash ^= xxh64_round(0, acc);
+  return (hash * XXH_PRIME64_1) + XXH_PRIME64_4;
+}
+
+/**
+ * Utility function to compute the 64-bit xxHash (XXH64) of a buffer. Reads the
+ * input in native byte order, like the reference implementation on
+ * little-endian machines.
+ * @param data The buffer
+ * @param length The size of the buffer in bytes
+ * @param seed The seed
+ * @return The hash
+ */
+static uint64_t xxh64(const unsigned char *data, size_t length,
+                      uint64_t seed) {
+  const unsigned char *end = data + length;
+  uint64_t hash = 0;
+  uint64_t lane = 0;
+  if (length >= 32) {
+    uint64_t acc[4] = {seed + XXH_PRIME64_1 + XXH_PRIME64_2,
+                       seed + XXH_PRIME64_2, seed, seed - XXH_PRIME64_1};
+    for (; end - data >= 32; data += 32) {
+      for (int i = 0; i < 4; i++) {
+        memcpy(&lane, data + (i * 8), sizeof(lane));
+        acc[i] = xxh64_round(acc[i], lane);
+      }
+    }
+    hash = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) +
+           rotl64(acc[3], 18);
+    for (int i = 0; i < 4; i++) {
+      hash = xxh64_merge(hash, acc[i]);
+    }
+  } else {
+    hash = seed + XXH_PRIME64_5;
   }
+  hash += length;
 
-  return 0;
+  for (; end - data >= 8; data += 8) {
+    memcpy(&lane, data, sizeof(lane));
+    hash ^= xxh64_round(0, lane);
+    hash = (rotl64(hash, 27) * XXH_PRIME64_1) + XXH_PRIME64_4;
+  }
+  if (end - data >= 4) {
+    uint32_t half = 0;
+    memcpy(&half, data, sizeof(half));
+    hash ^= half * XXH_PRIME64_1;
+    hash = (rotl64(hash, 23) * XXH_PRIME64_2) + XXH_PRIME64_3;
+    data += 4;
+  }
+  for (; data < end; data++) {
+    hash ^= *data * XXH_PRIME64_5;
+    hash = rotl64(hash, 11) * XXH_PRIME64_1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= XXH_PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= XXH_PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
 }
 
 /**
- * Returns a string representation of the window userdata.
+ * Compute a 64-bit hash (XXH64) of all pixels of the window or surface and
+ * return it as a string of 16 hexadecimal digits, which survives Lua versions
+ * without 64-bit integers. Windows are hashed in their unscaled size, indexed
+ * windows after expanding them through the palette.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
-static int window_tostring(lua_State *L) {
-  window *p_window = check_window(L);
+static int canvas_hash(lua_State *L) {
+  const canvas c = check_canvas(L);
 
-  if (is_window_closed(p_window)) {
-    lua_pushliteral(L, "window (closed)");
+  const uint32_t *pixels = canvas_colors(L, &c);
+  const uint64_t hash = xxh64((const unsigned char *)pixels,
+                              c.width * c.height * sizeof(uint32_t), 0);
+  char digits[17];
+  snprintf(digits, sizeof(digits), "%08lx%08lx",
+           (unsigned long)(hash >> 32), (unsigned long)(hash & 0xffffffff));
+  lua_pushstring(L, digits);
+  return 1;
+}
+
+/**
+ * Utility function to count the pixels that differ between two rows, ignoring
+ * the upper 8 bits (alpha), and to find the first and last of them.
+ * @param a The first row
+ * @param b The second row
+ * @param length Number of pixels
+ * @param p_first Set to the first differing pixel, if there is one
+ * @param p_last Set to the last differing pixel, if there is one
+ * @return The number of differing pixels
+ */
+static lua_Integer diff_row(const uint32_t *a, const uint32_t *b,
+                            lua_Integer length, lua_Integer *p_first,
+                            lua_Integer *p_last) {
+  lua_Integer count = 0;
+  lua_Integer i = 0;
+  while (i < length) {
+#ifdef USE_SSE2
+    // skip 4 equal pixels at once, the common case
+    const __m128i mask = _mm_set1_epi32((int)MAX_COLOR);
+    while (i + 4 <= length) {
+      const __m128i equal = _mm_cmpeq_epi32(
+          _mm_and_si128(_mm_loadu_si128((const __m128i *)(a + i)), mask),
+          _mm_and_si128(_mm_loadu_si128((const __m128i *)(b + i)), mask));
+      if (_mm_movemask_epi8(equal) != 0xffff) {
+        break;
+      }
+      i += 4;
+    }
+    const lua_Integer end = i + 4 <= length ? i + 4 : length;
+#else
+    const lua_Integer end = length;
+#endif
+    for (; i < end; i++) {
+      if (((a[i] ^ b[i]) & (uint32_t)MAX_COLOR) != 0) {
+        if (count == 0) {
+          *p_first = i;
+        }
+        *p_last = i;
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * Compare two windows or surfaces of the same size pixel by pixel, ignoring
+ * the upper 8 bits (alpha). Returns the number of differing pixels and, if
+ * there are any, their bounding box as a table with x, y, width and height.
+ * With a third argument of true, it also returns a new surface showing the
+ * differing pixels in red over a darkened copy of the first image.
+ * @param L Lua state
+ * @return Number of return values on the Lua stack
+ */
+static int lfenster_diff(lua_State *L) {
+  const canvas a = check_canvas_at(L, 1);
+  const canvas b = check_canvas_at(L, 2);
+  luaL_argcheck(L, a.width == b.width && a.height == b.height, 2,
+                "images must have the same size");
+  const int want_image = lua_toboolean(L, 3);
+  const uint32_t *a_pixels = canvas_colors(L, &a);
+  const uint32_t *b_pixels = canvas_colors(L, &b);
+
+  lua_Integer count = 0;
+  damage_rect box = {a.width, a.height, 0, 0};
+  for (lua_Integer y = 0; y < a.height; y++) {
+    lua_Integer first = 0;
+    lua_Integer last = 0;
+    const lua_Integer row_count = diff_row(
+        a_pixels + (y * a.width), b_pixels + (y * a.width), a.width, &first,
+        &last);
+    if (row_count > 0) {
+      count += row_count;
+      box.left = first < box.left ? first : box.left;
+      box.right = last + 1 > box.right ? last + 1 : box.right;
+      box.top = y < box.top ? y : box.top;
+      box.bottom = y + 1;
+    }
+  }
+
+  surface *p_image = NULL;
+  if (want_image) {
+    p_image = new_surface(L, a.width, a.height);
+    for (lua_Integer i = 0; i < a.width * a.height; i++) {
+      p_image->pixels[i] = ((a_pixels[i] ^ b_pixels[i]) & MAX_COLOR) != 0
+                               ? 0xff0000
+                               : (a_pixels[i] >> 2) & 0x3f3f3f;
+    }
+  }
+
+  lua_pushinteger(L, count);
+  if (count > 0) {
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, box.left);
+    lua_setfield(L, -2, "x");
+    lua_pushinteger(L, box.top);
+    lua_setfield(L, -2, "y");
+    lua_pushinteger(L, box.right - box.left);
+    lua_setfield(L, -2, "width");
+    lua_pushinteger(L, box.bottom - box.top);
+    lua_setfield(L, -2, "height");
   } else {
-    lua_pushfstring(L, "window (%p)", p_window);
+    lua_pushnil(L);
   }
-  return 1;
+  if (p_image == NULL) {
+    return 2;
+  }
+  lua_pushvalue(L, -3);  // the surface is below the count and the box
+  return 3;
 }
 
 /** Functions for the fenster Lua module */
@@ -583,14 +5962,50 @@ static const struct luaL_Reg lfenster_functions[] = {
     {"open", lfenster_open},
     {"sleep", lfenster_sleep},
     {"time", lfenster_time},
+    {"timens", lfenster_timens},
+    {"setthreads", lfenster_setthreads},
     {"rgb", lfenster_rgb},
+    {"rgba", lfenster_rgba},
+    {"surface", lfenster_surface},
+    {"loadimage", lfenster_loadimage},
+    {"font", lfenster_font},
+    {"diff", lfenster_diff},
+    {"loopall", lfenster_loopall},
 
     // methods can also be used as functions with the userdata as first argument
     {"close", window_close},
     {"loop", window_loop},
+    {"wait", window_wait},
+    {"stats", window_stats},
+    {"mouse", window_mouse},
+    {"mods", window_mods},
+    {"setbudget", window_setbudget},
+    {"buffer", window_buffer},
+    {"record", window_record},
+    {"setpalette", window_setpalette},
+    {"events", window_events},
+    {"pressed", window_pressed},
+    {"released", window_released},
     {"set", window_set},
     {"get", window_get},
     {"clear", window_clear},
+    {"setregion", window_setregion},
+    {"setblend", canvas_setblend},
+    {"fillrect", canvas_fillrect},
+    {"hline", canvas_hline},
+    {"vline", canvas_vline},
+    {"line", canvas_line},
+    {"rect", canvas_rect},
+    {"circle", canvas_circle},
+    {"fillcircle", canvas_fillcircle},
+    {"ellipse", canvas_ellipse},
+    {"fillellipse", canvas_fillellipse},
+    {"filltriangle", canvas_filltriangle},
+    {"fillpolygon", canvas_fillpolygon},
+    {"text", canvas_text},
+    {"encode", canvas_encode},
+    {"save", canvas_save},
+    {"hash", canvas_hash},
 
     {NULL, NULL}};
 
@@ -598,12 +6013,39 @@ static const struct luaL_Reg lfenster_functions[] = {
 static const struct luaL_Reg window_methods[] = {
     {"close", window_close},
     {"loop", window_loop},
+    {"wait", window_wait},
+    {"stats", window_stats},
+    {"mouse", window_mouse},
+    {"mods", window_mods},
+    {"setbudget", window_setbudget},
+    {"buffer", window_buffer},
+    {"record", window_record},
+    {"setpalette", window_setpalette},
+    {"events", window_events},
+    {"pressed", window_pressed},
+    {"released", window_released},
     {"set", window_set},
     {"get", window_get},
     {"clear", window_clear},
+    {"setregion", window_setregion},
+    {"setblend", canvas_setblend},
+    {"fillrect", canvas_fillrect},
+    {"hline", canvas_hline},
+    {"vline", canvas_vline},
+    {"line", canvas_line},
+    {"rect", canvas_rect},
+    {"circle", canvas_circle},
+    {"fillcircle", canvas_fillcircle},
+    {"ellipse", canvas_ellipse},
+    {"fillellipse", canvas_fillellipse},
+    {"filltriangle", canvas_filltriangle},
+    {"fillpolygon", canvas_fillpolygon},
+    {"text", canvas_text},
+    {"encode", canvas_encode},
+    {"save", canvas_save},
+    {"hash", canvas_hash},
 
-    // metamethods
-    {"__index", window_index},
+    // metamethods (__index is set by luaopen_fenster, as it needs upvalues)
     {"__gc", window_gc},
 #if LUA_VERSION_NUM >= 504
     {"__close", window_gc},
@@ -612,12 +6054,70 @@ static const struct luaL_Reg window_methods[] = {
 
     {NULL, NULL}};
 
+/** Methods for the surface userdata */
+static const struct luaL_Reg surface_methods[] = {
+    {"set", surface_set},
+    {"get", surface_get},
+    {"clear", surface_clear},
+    {"blit", surface_blit},
+    {"setblend", canvas_setblend},
+    {"fillrect", canvas_fillrect},
+    {"hline", canvas_hline},
+    {"vline", canvas_vline},
+    {"line", canvas_line},
+    {"rect", canvas_rect},
+    {"circle", canvas_circle},
+    {"fillcircle", canvas_fillcircle},
+    {"ellipse", canvas_ellipse},
+    {"fillellipse", canvas_fillellipse},
+    {"filltriangle", canvas_filltriangle},
+    {"fillpolygon", canvas_fillpolygon},
+    {"text", canvas_text},
+    {"encode", canvas_encode},
+    {"save", canvas_save},
+    {"hash", canvas_hash},
+
+    // metamethods
+    {"__index", surface_index},
+    {"__tostring", surface_tostring},
+
+    {NULL, NULL}};
+
+/** Metamethods for the font userdata */
+static const struct luaL_Reg font_methods[] = {
+    {"__index", font_index},
+    {"__tostring", font_tostring},
+
+    {NULL, NULL}};
+
 /**
  * Entry point for the fenster Lua module.
  * @param L Lua state
  * @return Number of return values on the Lua stack
  */
 FENSTER_EXPORT int luaopen_fenster(lua_State *L) {
+#if !defined(_WIN32) && !defined(__APPLE__)
+  // all windows share one X connection, which the present threads use as
+  // well, and Xlib has to be told before the connection is opened
+  XInitThreads();
+#endif
+
+  // the worker threads are shared by all Lua states, but each state stops
+  // them when it is closed
+  if (!pool_initialized) {
+    if (mutex_init(&pool.dispatch_mutex) != 0 || mutex_init(&pool.mutex) != 0 ||
+        cond_init(&pool.work_queued) != 0 || cond_init(&pool.work_done) != 0) {
+      return luaL_error(L, "failed to initialize worker threads");
+    }
+    pool_initialized = 1;
+  }
+  lua_newuserdata(L, 1);
+  lua_createtable(L, 0, 1);
+  lua_pushcfunction(L, threads_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, THREADS_REGISTRY_KEY);
+
   // create the window metatable
   const int result = luaL_newmetatable(L, WINDOW_METATABLE);
   if (result == 0) {
@@ -626,6 +6126,34 @@ FENSTER_EXPORT int luaopen_fenster(lua_State *L) {
   }
   luaL_setfuncs(L, window_methods, 0);
 
+  // lookup table for window_index, with the methods and the property ids
+  lua_createtable(L, 0, 64);
+  luaL_setfuncs(L, window_methods, 0);
+  for (int i = 0; WINDOW_PROPERTY_NAMES[i] != NULL; i++) {
+    lua_pushinteger(L, i);
+    lua_setfield(L, -2, WINDOW_PROPERTY_NAMES[i]);
+  }
+  lua_pushvalue(L, -2);
+  lua_pushcclosure(L, window_index, 2);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+
+  // create the surface metatable
+  if (luaL_newmetatable(L, SURFACE_METATABLE) == 0) {
+    return luaL_error(L, "fenster metatable already exists (%s)",
+                      SURFACE_METATABLE);
+  }
+  luaL_setfuncs(L, surface_methods, 0);
+  lua_pop(L, 1);
+
+  // create the font metatable
+  if (luaL_newmetatable(L, FONT_METATABLE) == 0) {
+    return luaL_error(L, "fenster metatable already exists (%s)",
+                      FONT_METATABLE);
+  }
+  luaL_setfuncs(L, font_methods, 0);
+  lua_pop(L, 1);
+
   // create and return the fenster Lua module
   luaL_newlib(  // NOLINT(readability-math-missing-parentheses)
       L, lfenster_functions);